@@ -3,6 +3,7 @@
 #include <GL/glew.h>
 #include "hash_map.h"
 #include "util.h"
+#include "physics/mid.h"
 
 Entity** entities;
 Hash_Map entities_map;
@@ -48,7 +49,12 @@ static eid entity_create_ex(Mesh mesh, vec3 world_position, Quaternion world_rot
 	entity->fixed = is_fixed;
 	entity->active = true;
 	entity->deactivation_time = 0.0;
+	entity->island_id = ENTITY_NO_ISLAND;
+	entity->collision_category = ENTITY_DEFAULT_COLLISION_CATEGORY;
+	entity->collision_mask = ENTITY_DEFAULT_COLLISION_MASK;
+	entity->ccd = false;
 	entity->colliders = colliders;
+	mid_create_colliders_bvh(colliders, &entity->colliders_bvh);
 	entity->static_friction_coefficient = static_friction_coefficient;
 	entity->dynamic_friction_coefficient = dynamic_friction_coefficient;
 	entity->restitution_coefficient = restitution_coefficient;
@@ -91,6 +97,7 @@ Entity** entity_get_all() {
 
 void entity_destroy(Entity* entity) {
 	array_free(entity->forces);
+	bvh_destroy(&entity->colliders_bvh);
 
 	// @TODO: avoid the need of this loop
 	for (u32 i = 0; i < array_length(entities); ++i) {
@@ -169,6 +176,19 @@ void entity_activate(Entity* entity) {
 	entity->deactivation_time = 0.0;
 }
 
+// 'category' holds the bits that identify the kind of entity (e.g. debris, sensor) and 'mask' the categories
+// that it collides with. The filter is checked by the broad phase, so filtered pairs never reach the narrow phase.
+void entity_set_collision_filter(Entity* entity, u32 category, u32 mask) {
+	entity->collision_category = category;
+	entity->collision_mask = mask;
+}
+
+// Fast entities (e.g. projectiles) can cross thin entities between two substeps. With continuous collision detection,
+// the time of impact of their pairs is found once per step, which is much cheaper than raising the substep count.
+void entity_set_ccd(Entity* entity, boolean enabled) {
+	entity->ccd = enabled;
+}
+
 // Add a force to an entity
 // If local_coords is false, then the position and force are represented in world coordinates, assuming that the center of the
 // world is the center of the entity. That is, the coordinate (0, 0, 0) corresponds to the center of the entity in world coords.
@@ -4,10 +4,17 @@
 #include <gm.h>
 #include "render/mesh.h"
 #include "physics/collider.h"
+#include "physics/bvh.h"
 #include "quaternion.h"
 
 typedef u64 eid;
 
+#define ENTITY_NO_ISLAND ((u32)-1)
+
+// Two entities collide only if the category of each one is in the mask of the other one
+#define ENTITY_DEFAULT_COLLISION_CATEGORY 0x00000001
+#define ENTITY_DEFAULT_COLLISION_MASK 0xFFFFFFFF
+
 typedef struct {
 	vec3 position;
 	vec3 force;
@@ -25,6 +32,7 @@ typedef struct {
 
 	// Physics Related
 	Collider* colliders;
+	Bvh colliders_bvh; // tree over the local bounds of the colliders, used by the mid-phase
 	r64 bounding_sphere_radius;
 	Physics_Force* forces;
 	r64 inverse_mass;
@@ -35,6 +43,10 @@ typedef struct {
 	boolean fixed;
 	boolean active;
 	r64 deactivation_time;
+	u32 island_id; // persistent simulation island of the entity, managed by the broad phase
+	u32 collision_category;
+	u32 collision_mask;
+	boolean ccd; // the pairs of the entity are swept with continuous collision detection, so it can't tunnel through others
 	r64 static_friction_coefficient;
 	r64 dynamic_friction_coefficient;
 	r64 restitution_coefficient;
@@ -62,6 +74,8 @@ void entity_set_position(Entity* entity, vec3 world_position);
 void entity_set_rotation(Entity* entity, Quaternion world_rotation);
 void entity_set_scale(Entity* entity, vec3 world_scale);
 void entity_activate(Entity* entity);
+void entity_set_collision_filter(Entity* entity, u32 category, u32 mask);
+void entity_set_ccd(Entity* entity, boolean enabled);
 void entity_add_force(Entity* entity, vec3 position, vec3 force, boolean local_coords);
 void entity_clear_forces(Entity* entity);
 
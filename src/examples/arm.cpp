@@ -88,6 +88,8 @@ static Constraint* create_arm() {
 	reset_joint_distance(support_entity, upper_arm_entity, r1_lc, r2_lc);
 	pbd_spherical_joint_constraint_init(&constraint, support_id, upper_arm_id, r1_lc, r2_lc, PBD_POSITIVE_X_AXIS, PBD_POSITIVE_X_AXIS, PBD_POSITIVE_Y_AXIS, PBD_POSITIVE_Y_AXIS,
 		-PI_F, PI_F, -PI_F, PI_F);
+	// Joined segments overlap around the joint, they must not collide with each other
+	constraint.disable_collision = true;
 	array_push(constraints, constraint);
 
 	// Upper Arm - Lower Arm Joint (Elbow)
@@ -96,6 +98,7 @@ static Constraint* create_arm() {
 	reset_joint_distance(upper_arm_entity, lower_arm_entity, r1_lc, r2_lc);
 	pbd_hinge_joint_constraint_limited_init(&constraint, upper_arm_id, lower_arm_id, r1_lc, r2_lc, 0.0, PBD_POSITIVE_X_AXIS, PBD_POSITIVE_X_AXIS, PBD_POSITIVE_Y_AXIS, PBD_POSITIVE_Y_AXIS,
 		0.0, 0.9 * PI_F);
+	constraint.disable_collision = true;
 	array_push(constraints, constraint);
 
 	// Lower Arm - Hand Arm Joint (Wrist)
@@ -104,6 +107,7 @@ static Constraint* create_arm() {
 	reset_joint_distance(lower_arm_entity, hand_entity, r1_lc, r2_lc);
 	pbd_spherical_joint_constraint_init(&constraint, lower_arm_id, hand_id, r1_lc, r2_lc, PBD_POSITIVE_X_AXIS, PBD_POSITIVE_X_AXIS, PBD_POSITIVE_Y_AXIS, PBD_POSITIVE_Y_AXIS,
 		-0.0 * PI_F, 0.0 * PI_F, -0.3 * PI_F, 0.05 * PI_F);
+	constraint.disable_collision = true;
 	array_push(constraints, constraint);
 
 	return constraints;
@@ -1,6 +1,20 @@
 #include "examples_util.h"
 #include <light_array.h>
 #include "../render/obj.h"
+#include "../physics/broad.h"
+#include "../physics/pair_cache.h"
+#include "../physics/support.h"
+#include "../physics/epa.h"
+#include "../physics/sat.h"
+#include "../physics/pbd.h"
+#include "../physics/clipping.h"
+#include "../physics/ccd.h"
+#include "../vendor/imgui.h"
+#include "../util.h"
+#include <math.h>
+
+// Thrown objects are fast enough to cross thin entities at low substep counts, so they use continuous collision detection
+static boolean thrown_objects_use_ccd = true;
 
 Collider* examples_util_create_single_convex_hull_collider_array(Vertex* vertices, u32* indices, vec3 scale) {
 	vec3* vertices_positions = array_new(vec3);
@@ -92,6 +106,7 @@ void examples_util_throw_object(Perspective_Camera* camera, r64 velocity_norm) {
 
 	Entity* e = entity_get_by_id(id);
 	e->linear_velocity = gm_vec3_scalar_product(velocity_norm, gm_vec3_scalar_product(-1.0, camera_z));
+	entity_set_ccd(e, thrown_objects_use_ccd);
 }
 
 Light* examples_util_create_lights() {
@@ -106,4 +121,263 @@ Light* examples_util_create_lights() {
 	array_push(lights, light);
 
 	return lights;
+}
+
+// Compares all broad-phase methods in synthetic swarms of equal-sized cubes resting on a floor, with increasing number
+// of cubes, and prints the average time per frame of each method. The cubes are jittered every frame, so the
+// incremental methods are also exercised.
+void examples_util_broad_phase_benchmark() {
+	const u32 scene_sizes[] = {64, 256, 1024, 4096, 8192};
+	const u32 num_scene_sizes = sizeof(scene_sizes) / sizeof(scene_sizes[0]);
+	const u32 num_frames = 10;
+	const r64 volume_fraction = 0.2;
+	// Use ids that will never clash with real entities
+	const eid base_id = ((eid)1) << 62;
+
+	Vertex* cube_vertices;
+	u32* cube_indices;
+	obj_parse("./res/cube.obj", &cube_vertices, &cube_indices);
+	Collider* cube_colliders = examples_util_create_single_convex_hull_collider_array(cube_vertices, cube_indices, (vec3){1.0, 1.0, 1.0});
+	vec3 floor_scale = (vec3){500.0, 1.0, 500.0};
+	Collider* floor_colliders = examples_util_create_single_convex_hull_collider_array(cube_vertices, cube_indices, floor_scale);
+	array_free(cube_vertices);
+	array_free(cube_indices);
+
+	Broad_Phase_Method selected_method = broad_get_method();
+	r64 crossover[BROAD_PHASE_METHOD_END] = {0};
+
+	printf("Broad-phase crossover benchmark (average time per frame, in ms)\n");
+	printf("%8s", "bodies");
+	for (u32 m = 0; m < BROAD_PHASE_METHOD_END; ++m) {
+		printf(" | %18s", broad_get_method_name((Broad_Phase_Method)m));
+	}
+	printf("\n");
+
+	for (u32 s = 0; s < num_scene_sizes; ++s) {
+		u32 n = scene_sizes[s];
+		r64 side = cbrt(n * 8.0 / volume_fraction);
+
+		Entity* bodies = (Entity*)calloc(n + 1, sizeof(Entity));
+		Entity** entities = array_new_len(Entity*, n + 1);
+		for (u32 i = 0; i <= n; ++i) {
+			Entity* e = &bodies[i];
+			e->id = base_id + i;
+			e->world_rotation = quaternion_new((vec3){0.0, 1.0, 0.0}, 0.0);
+			e->world_scale = (vec3){1.0, 1.0, 1.0};
+			e->collision_category = ENTITY_DEFAULT_COLLISION_CATEGORY;
+			e->collision_mask = ENTITY_DEFAULT_COLLISION_MASK;
+			if (i == 0) {
+				e->fixed = true;
+				e->colliders = floor_colliders;
+				e->world_position = (vec3){0.0, -1.0, 0.0};
+			} else {
+				e->colliders = cube_colliders;
+				e->world_position = (vec3){util_random_float(-side / 2.0, side / 2.0), util_random_float(0.0, side),
+					util_random_float(-side / 2.0, side / 2.0)};
+				e->active = true;
+				e->linear_velocity = (vec3){util_random_float(-1.0, 1.0), util_random_float(-1.0, 1.0), util_random_float(-1.0, 1.0)};
+			}
+			e->bounding_sphere_radius = colliders_get_bounding_sphere_radius(e->colliders);
+			array_push(entities, e);
+		}
+
+		printf("%8u", n);
+		r64 all_pairs_time = 0.0;
+		for (u32 m = 0; m < BROAD_PHASE_METHOD_END; ++m) {
+			broad_set_method((Broad_Phase_Method)m);
+
+			// Warm up (builds the persistent structures). The swarm is dense enough that pairs are always found, none would
+			// mean that the bodies are filtered out and the method is not really exercised.
+			Broad_Collision_Pair* warm_up_pairs = broad_get_collision_pairs(entities, NULL, 1.0 / 60.0);
+			assert(array_length(warm_up_pairs) > 0);
+			array_free(warm_up_pairs);
+
+			r64 total_time = 0.0;
+			for (u32 f = 0; f < num_frames; ++f) {
+				for (u32 i = 1; i <= n; ++i) {
+					vec3 jitter = (vec3){util_random_float(-0.02, 0.02), util_random_float(-0.02, 0.02), util_random_float(-0.02, 0.02)};
+					bodies[i].world_position = gm_vec3_add(bodies[i].world_position, jitter);
+				}
+				array_free(broad_get_collision_pairs(entities, NULL, 1.0 / 60.0));
+				total_time += broad_get_statistics().elapsed_time;
+			}
+
+			r64 average_time = total_time / num_frames;
+			if (m == BROAD_PHASE_METHOD_ALL_PAIRS) {
+				all_pairs_time = average_time;
+			} else if (crossover[m] == 0.0 && average_time < all_pairs_time) {
+				crossover[m] = n;
+			}
+			printf(" | %18.4f", average_time * 1000.0);
+		}
+		printf("\n");
+
+		array_free(entities);
+		free(bodies);
+	}
+
+	for (u32 m = 1; m < BROAD_PHASE_METHOD_END; ++m) {
+		if (crossover[m] > 0.0) {
+			printf("%s beats All Pairs from %u bodies on\n", broad_get_method_name((Broad_Phase_Method)m), (u32)crossover[m]);
+		} else {
+			printf("%s never beats All Pairs in the tested sizes\n", broad_get_method_name((Broad_Phase_Method)m));
+		}
+	}
+
+	// Run all methods once with an empty scene, so their persistent structures release the fake entities
+	Entity** no_entities = array_new(Entity*);
+	for (u32 m = 0; m < BROAD_PHASE_METHOD_END; ++m) {
+		broad_set_method((Broad_Phase_Method)m);
+		array_free(broad_get_collision_pairs(no_entities, NULL, 1.0 / 60.0));
+	}
+	array_free(no_entities);
+	broad_set_method(selected_method);
+
+	colliders_destroy(cube_colliders);
+	array_free(cube_colliders);
+	colliders_destroy(floor_colliders);
+	array_free(floor_colliders);
+}
+
+// Measures the average time of a support query on hulls of increasing size, scanning all vertices with every kernel
+// available in this CPU, and also with the strategy used by the engine (which switches to hill climbing on big hulls).
+// Directions follow a random walk, like the directions of consecutive GJK and EPA queries.
+void examples_util_support_benchmark() {
+	const char* hull_paths[] = {"./res/cube.obj", "./res/ico.obj", "./res/sphere.obj", "./res/spot/spot-hull-2.obj"};
+	const u32 num_hulls = sizeof(hull_paths) / sizeof(hull_paths[0]);
+	const u32 num_queries = 200000;
+
+	vec3* directions = array_new_len(vec3, num_queries);
+	vec3 direction = (vec3){1.0, 0.0, 0.0};
+	for (u32 i = 0; i < num_queries; ++i) {
+		vec3 step = (vec3){util_random_float(-0.1, 0.1), util_random_float(-0.1, 0.1), util_random_float(-0.1, 0.1)};
+		direction = gm_vec3_normalize(gm_vec3_add(direction, step));
+		array_push(directions, direction);
+	}
+
+	printf("Support benchmark (average time per query, in ns), selected kernel: %s\n",
+		support_get_kernel_name(support_get_kernel()));
+	printf("%28s | %8s", "hull", "vertices");
+	for (u32 k = 0; k < SUPPORT_KERNEL_END; ++k) {
+		printf(" | %8s", support_get_kernel_name((Support_Kernel)k));
+	}
+	printf(" | %8s\n", "Engine");
+
+	u64 checksum = 0;
+	for (u32 h = 0; h < num_hulls; ++h) {
+		Vertex* vertices;
+		u32* indices;
+		obj_parse(hull_paths[h], &vertices, &indices);
+		Collider* colliders = examples_util_create_single_convex_hull_collider_array(vertices, indices, (vec3){1.0, 1.0, 1.0});
+		array_free(vertices);
+		array_free(indices);
+		Collider* collider = &colliders[0];
+
+		printf("%28s | %8u", hull_paths[h], (u32)array_length(collider->convex_hull.vertices));
+		for (u32 k = 0; k < SUPPORT_KERNEL_END; ++k) {
+			if (!support_is_kernel_available((Support_Kernel)k)) {
+				printf(" | %8s", "n/a");
+				continue;
+			}
+
+			r64 start_time = util_get_time();
+			for (u32 i = 0; i < num_queries; ++i) {
+				checksum += support_point_get_index_by_scan(collider, directions[i], (Support_Kernel)k);
+			}
+			printf(" | %8.1f", (util_get_time() - start_time) / num_queries * 1e9);
+		}
+
+		r64 start_time = util_get_time();
+		for (u32 i = 0; i < num_queries; ++i) {
+			checksum += support_point_get_index(collider, directions[i]);
+		}
+		printf(" | %8.1f\n", (util_get_time() - start_time) / num_queries * 1e9);
+
+		colliders_destroy(colliders);
+		array_free(colliders);
+	}
+
+	// Printing the checksum keeps the compiler from discarding the queries
+	printf("(checksum %llu)\n", (unsigned long long)checksum);
+	array_free(directions);
+}
+
+// Allows selecting the broad-phase method, the contact refresh interval, the size of the contact manifolds and the use of
+// continuous collision detection by thrown objects, and shows the statistics of the physics engine.
+void examples_util_broad_phase_menu_update() {
+	ImGui::TextWrapped("Broad-phase method:");
+	Broad_Phase_Method method = broad_get_method();
+	if (ImGui::BeginCombo("Broad", broad_get_method_name(method))) {
+		for (u32 i = 0; i < BROAD_PHASE_METHOD_END; ++i) {
+			Broad_Phase_Method candidate = (Broad_Phase_Method)i;
+			if (ImGui::Selectable(broad_get_method_name(candidate), candidate == method)) {
+				broad_set_method(candidate);
+			}
+		}
+		ImGui::EndCombo();
+	}
+
+	ImGui::TextWrapped("Contact refresh interval, in substeps (0 detects contacts once per step):");
+	int contact_refresh_interval = (int)pbd_get_contact_refresh_interval();
+	if (ImGui::SliderInt("Refresh", &contact_refresh_interval, 0, 20)) {
+		pbd_set_contact_refresh_interval((u32)contact_refresh_interval);
+	}
+
+	ImGui::TextWrapped("Maximum contacts per face manifold (0 keeps all of them):");
+	int max_contacts = (int)clipping_get_max_contacts();
+	if (ImGui::SliderInt("Contacts", &max_contacts, 0, 16)) {
+		clipping_set_max_contacts((u32)max_contacts);
+	}
+
+	bool use_ccd = thrown_objects_use_ccd;
+	if (ImGui::Checkbox("Continuous collision detection for thrown objects", &use_ccd)) {
+		thrown_objects_use_ccd = use_ccd;
+	}
+
+	if (ImGui::Button("Run crossover benchmark")) {
+		examples_util_broad_phase_benchmark();
+	}
+	if (ImGui::Button("Run support benchmark")) {
+		examples_util_support_benchmark();
+	}
+
+	Broad_Statistics statistics = broad_get_statistics();
+	ImGui::Text("Entities: %u", statistics.num_entities);
+	ImGui::Text("Static entities: %u", statistics.num_static_entities);
+	ImGui::Text("Pairs: %u", statistics.num_pairs);
+	ImGui::Text("Culled pairs: %u", statistics.num_culled_pairs);
+	ImGui::Text("Filtered pairs: %u", statistics.num_filtered_pairs);
+	ImGui::Text("Broad-phase time: %.3f ms", statistics.elapsed_time * 1000.0);
+	ImGui::Text("Islands: %u (%u sleeping)", statistics.num_islands, statistics.num_sleeping_islands);
+
+	Pair_Cache_Statistics pair_cache_statistics = pair_cache_get_statistics();
+	ImGui::Text("Cached pairs: %u (%u began, %u persisted, %u ended)", pair_cache_statistics.num_pairs,
+		pair_cache_statistics.num_began, pair_cache_statistics.num_persisted, pair_cache_statistics.num_ended);
+
+	// The menu is drawn once per frame, so resetting the counters here shows the updates of the last frame
+	Collider_Update_Statistics collider_update_statistics = colliders_get_update_statistics();
+	colliders_reset_update_statistics();
+	ImGui::Text("Collider updates: %llu (%llu skipped)", (unsigned long long)collider_update_statistics.num_updates,
+		(unsigned long long)collider_update_statistics.num_skipped_updates);
+
+	EPA_Statistics epa_statistics = epa_get_statistics();
+	epa_reset_statistics();
+	ImGui::Text("EPA calls: %llu (%.1f iterations per call, at most %u, %llu failed)", (unsigned long long)epa_statistics.num_calls,
+		epa_statistics.num_calls > 0 ? (r64)epa_statistics.num_iterations / epa_statistics.num_calls : 0.0,
+		epa_statistics.max_iterations, (unsigned long long)epa_statistics.num_failures);
+
+	Clipping_Statistics clipping_statistics = clipping_get_statistics();
+	clipping_reset_statistics();
+	ImGui::Text("Contacts: %llu (%llu removed by manifold reduction, %llu speculative)", (unsigned long long)clipping_statistics.num_contacts,
+		(unsigned long long)clipping_statistics.num_removed_contacts, (unsigned long long)clipping_statistics.num_speculative_contacts);
+
+	CCD_Statistics ccd_statistics = ccd_get_statistics();
+	ccd_reset_statistics();
+	ImGui::Text("CCD pairs: %llu (%llu distance queries, %llu impacts)", (unsigned long long)ccd_statistics.num_calls,
+		(unsigned long long)ccd_statistics.num_iterations, (unsigned long long)ccd_statistics.num_impacts);
+
+	SAT_Statistics sat_statistics = sat_get_statistics();
+	sat_reset_statistics();
+	ImGui::Text("SAT calls: %llu (cached axis: %llu separated, %llu in contact)", (unsigned long long)sat_statistics.num_calls,
+		(unsigned long long)sat_statistics.num_cached_separations, (unsigned long long)sat_statistics.num_cached_contacts);
 }
\ No newline at end of file
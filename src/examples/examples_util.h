@@ -10,5 +10,8 @@ Collider* examples_util_create_single_convex_hull_collider_array(Vertex* vertice
 Collider examples_util_create_convex_hull_collider(Vertex* vertices, u32* indices, vec3 scale);
 void examples_util_throw_object(Perspective_Camera* camera, r64 velocity_norm);
 Light* examples_util_create_lights();
+void examples_util_broad_phase_menu_update();
+void examples_util_broad_phase_benchmark();
+void examples_util_support_benchmark();
 
 #endif
\ No newline at end of file
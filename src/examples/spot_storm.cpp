@@ -278,6 +278,9 @@ void ex_spot_storm_menu_update() {
 	r32 vel = (r32)thrown_objects_initial_linear_velocity_norm;
 	ImGui::SliderFloat("Vel", &vel, 1.0f, 30.0f, "%.2f");
 	thrown_objects_initial_linear_velocity_norm = vel;
+	ImGui::Separator();
+
+	examples_util_broad_phase_menu_update();
 }
 
 Example_Scene spot_storm_example_scene = (Example_Scene) {
@@ -2,124 +2,1603 @@
 #include <light_array.h>
 #include <hash_map.h>
 #include "../util.h"
+#include "bvh.h"
+#include "physics_util.h"
+#include "pair_cache.h"
+
+// Extra distance added to the bounding volumes, to account for velocity changes during the frame (e.g. due to collisions)
+#define BROAD_BASE_MARGIN 0.02
+
+// Pair of entities that must never collide, the smallest id is always stored in e1_id
+typedef struct {
+	eid e1_id;
+	eid e2_id;
+} Broad_Disabled_Pair;
+
+// Motion of an entity during the frame, used to build its swept bounds
+typedef struct {
+	vec3 displacement;    // expected displacement of the entity's center during the frame
+	r64 radius;           // bounding sphere radius, enlarged to account for the margin and trajectory curvature
+	r64 rotation_extent;  // maximum distance that a point of the entity can travel due to its rotation
+} Broad_Motion;
+
+static Broad_Phase_Method broad_method = BROAD_PHASE_METHOD_SWEEP_AND_PRUNE;
+static Broad_Statistics broad_statistics;
+
+void broad_set_method(Broad_Phase_Method method) {
+	assert(method < BROAD_PHASE_METHOD_END);
+	broad_method = method;
+}
+
+Broad_Phase_Method broad_get_method() {
+	return broad_method;
+}
+
+const char* broad_get_method_name(Broad_Phase_Method method) {
+	switch (method) {
+		case BROAD_PHASE_METHOD_ALL_PAIRS: return "All Pairs";
+		case BROAD_PHASE_METHOD_SWEEP_AND_PRUNE: return "Sweep and Prune";
+		case BROAD_PHASE_METHOD_BVH: return "Dynamic AABB Tree";
+		case BROAD_PHASE_METHOD_GRID: return "Uniform Grid";
+		default: break;
+	}
+
+	assert(0);
+	return "";
+}
+
+Broad_Statistics broad_get_statistics() {
+	return broad_statistics;
+}
+
+// Motions of the entities of the current frame, indexed by entity index
+static Broad_Motion* broad_motions;
+
+// Indexes of the non-fixed entities of the current frame. Fixed entities are handled by the static scene, so the
+// broad-phase methods only work with these.
+static u32* broad_dynamic_entities;
+
+// Pairs of entities that share a constraint with 'disable_collision' set, sorted so they can be binary searched
+static Broad_Disabled_Pair* broad_disabled_pairs;
+
+static int disabled_pair_compare(const void* _p1, const void* _p2) {
+	const Broad_Disabled_Pair* p1 = (const Broad_Disabled_Pair*)_p1;
+	const Broad_Disabled_Pair* p2 = (const Broad_Disabled_Pair*)_p2;
+	if (p1->e1_id != p2->e1_id) return p1->e1_id < p2->e1_id ? -1 : 1;
+	if (p1->e2_id != p2->e2_id) return p1->e2_id < p2->e2_id ? -1 : 1;
+	return 0;
+}
+
+static void collect_disabled_pairs(const Constraint* constraints) {
+	if (!broad_disabled_pairs) {
+		broad_disabled_pairs = array_new_len(Broad_Disabled_Pair, 16);
+	}
+
+	array_clear(broad_disabled_pairs);
+	if (!constraints) {
+		return;
+	}
+
+	for (u32 i = 0; i < array_length(constraints); ++i) {
+		const Constraint* constraint = &constraints[i];
+		if (constraint->disable_collision) {
+			Broad_Disabled_Pair pair;
+			pair.e1_id = MIN(constraint->e1_id, constraint->e2_id);
+			pair.e2_id = MAX(constraint->e1_id, constraint->e2_id);
+			array_push(broad_disabled_pairs, pair);
+		}
+	}
+
+	qsort(broad_disabled_pairs, array_length(broad_disabled_pairs), sizeof(Broad_Disabled_Pair), disabled_pair_compare);
+}
+
+// Checks the collision filters of both entities (layers/masks and constraints with 'disable_collision' set)
+static boolean should_collide(const Entity* e1, const Entity* e2) {
+	if (!(e1->collision_category & e2->collision_mask) || !(e2->collision_category & e1->collision_mask)) {
+		return false;
+	}
+
+	if (array_length(broad_disabled_pairs) > 0) {
+		Broad_Disabled_Pair key;
+		key.e1_id = MIN(e1->id, e2->id);
+		key.e2_id = MAX(e1->id, e2->id);
+		if (bsearch(&key, broad_disabled_pairs, array_length(broad_disabled_pairs), sizeof(Broad_Disabled_Pair),
+			disabled_pair_compare)) {
+			return false;
+		}
+	}
+
+	return true;
+}
+
+// Estimates how each entity will move in the next 'dt' seconds, based on its velocities and external forces
+static void calculate_motions(Entity** entities, r64 dt) {
+	if (!broad_motions) {
+		broad_motions = array_new_len(Broad_Motion, 256);
+		broad_dynamic_entities = array_new_len(u32, 256);
+	}
+
+	array_clear(broad_motions);
+	array_clear(broad_dynamic_entities);
+	for (u32 i = 0; i < array_length(entities); ++i) {
+		Entity* e = entities[i];
+		if (!e->fixed) {
+			array_push(broad_dynamic_entities, i);
+		}
+
+		Broad_Motion motion;
+		motion.radius = e->bounding_sphere_radius + BROAD_BASE_MARGIN / 2.0;
+
+		if (e->fixed || !e->active) {
+			motion.displacement = (vec3){0.0, 0.0, 0.0};
+			motion.rotation_extent = 0.0;
+		} else {
+			// x(t) = x0 + v * t + a * t^2 / 2
+			vec3 acceleration = gm_vec3_scalar_product(e->inverse_mass, calculate_external_force(e));
+			motion.displacement = gm_vec3_add(gm_vec3_scalar_product(dt, e->linear_velocity),
+				gm_vec3_scalar_product(0.5 * dt * dt, acceleration));
+
+			// The swept bounds assume a linear trajectory, the parabola deviates at most |a| * t^2 / 8 from it
+			motion.radius += gm_vec3_length(acceleration) * dt * dt / 8.0;
+
+			// A point at distance r from the center moves at most |w| * t * r (and never more than 2 * r)
+			motion.rotation_extent = MIN(gm_vec3_length(e->angular_velocity) * dt, 2.0) * e->bounding_sphere_radius;
+		}
+
+		array_push(broad_motions, motion);
+	}
+}
+
+// AABB that contains the bounding sphere of the entity during the whole frame
+static Collider_AABB get_swept_sphere_aabb(const Entity* e, const Broad_Motion* motion) {
+	r64 r = motion->radius;
+	vec3 start = e->world_position;
+	vec3 end = gm_vec3_add(start, motion->displacement);
+
+	Collider_AABB aabb;
+	aabb.min = (vec3){MIN(start.x, end.x) - r, MIN(start.y, end.y) - r, MIN(start.z, end.z) - r};
+	aabb.max = (vec3){MAX(start.x, end.x) + r, MAX(start.y, end.y) + r, MAX(start.z, end.z) + r};
+	return aabb;
+}
+
+// AABB that contains the colliders of the entity during the whole frame. Tighter than 'get_swept_sphere_aabb' for
+// elongated entities, but more expensive.
+static Collider_AABB get_swept_colliders_aabb(const Entity* e, const Broad_Motion* motion) {
+	Collider_AABB aabb = colliders_get_aabb(e->colliders, e->world_position, &e->world_rotation);
+	aabb = collider_aabb_expand(&aabb, motion->rotation_extent + motion->radius - e->bounding_sphere_radius);
+
+	Collider_AABB end_aabb;
+	end_aabb.min = gm_vec3_add(aabb.min, motion->displacement);
+	end_aabb.max = gm_vec3_add(aabb.max, motion->displacement);
+	return collider_aabb_merge(&aabb, &end_aabb);
+}
+
+// Checks whether the bounding spheres of both entities get close during the frame, by calculating the closest
+// approach of their relative linear motion.
+static boolean are_swept_bounding_spheres_close(const Entity* e1, const Broad_Motion* m1, const Entity* e2, const Broad_Motion* m2) {
+	vec3 d = gm_vec3_subtract(e1->world_position, e2->world_position);
+	vec3 relative_displacement = gm_vec3_subtract(m1->displacement, m2->displacement);
+
+	r64 relative_displacement_sqd = gm_vec3_dot(relative_displacement, relative_displacement);
+	if (relative_displacement_sqd > 0.0) {
+		r64 t = CLAMP(-gm_vec3_dot(d, relative_displacement) / relative_displacement_sqd, 0.0, 1.0);
+		d = gm_vec3_add(d, gm_vec3_scalar_product(t, relative_displacement));
+	}
+
+	r64 max_distance_for_collision = m1->radius + m2->radius;
+	return gm_vec3_dot(d, d) <= max_distance_for_collision * max_distance_for_collision;
+}
+
+// Final test shared by all methods, performed for every pair whose bounds overlap.
+// The pair is always reported with the entity that comes first in the entities array as e1.
+static void test_candidate_pair(Entity** entities, u32 idx1, u32 idx2, Broad_Collision_Pair** collision_pairs) {
+	++broad_statistics.num_candidate_pairs;
+
+	u32 first_idx = MIN(idx1, idx2);
+	u32 second_idx = MAX(idx1, idx2);
+	Entity* e1 = entities[first_idx];
+	Entity* e2 = entities[second_idx];
+
+	if (!should_collide(e1, e2)) {
+		++broad_statistics.num_filtered_pairs;
+		return;
+	}
+
+	if (!are_swept_bounding_spheres_close(e1, &broad_motions[first_idx], e2, &broad_motions[second_idx])) {
+		++broad_statistics.num_culled_pairs;
+		return;
+	}
 
-Broad_Collision_Pair* broad_get_collision_pairs(Entity** entities) {
 	Broad_Collision_Pair pair;
+	pair.e1_id = e1->id;
+	pair.e2_id = e2->id;
+	pair.e1_idx = first_idx;
+	pair.e2_idx = second_idx;
+	array_push(*collision_pairs, pair);
+}
+
+static Broad_Collision_Pair* all_pairs_get_collision_pairs(Entity** entities) {
 	Broad_Collision_Pair* collision_pairs = array_new_len(Broad_Collision_Pair, 32);
 
-	for (u32 i = 0; i < array_length(entities); ++i) {
-		Entity* e1 = entities[i];
-		for (u32 j = i + 1; j < array_length(entities); ++j) {
-			Entity* e2 = entities[j];
-
-			r64 entities_distance = gm_vec3_length(gm_vec3_subtract(e1->world_position, e2->world_position));
-
-			// Increase the distance a little to account for moving objects.
-			// @TODO: We should derivate this value from delta_time, forces, velocities, etc
-			r64 max_distance_for_collision = e1->bounding_sphere_radius + e2->bounding_sphere_radius + 0.1;
-			if (entities_distance <= max_distance_for_collision) {
-				pair.e1_id = e1->id;
-				pair.e2_id = e2->id;
-				array_push(collision_pairs, pair);
+	u32 num_dynamic_entities = array_length(broad_dynamic_entities);
+	for (u32 i = 0; i < num_dynamic_entities; ++i) {
+		u32 idx1 = broad_dynamic_entities[i];
+		Collider_AABB aabb1 = get_swept_sphere_aabb(entities[idx1], &broad_motions[idx1]);
+		for (u32 j = i + 1; j < num_dynamic_entities; ++j) {
+			u32 idx2 = broad_dynamic_entities[j];
+			Collider_AABB aabb2 = get_swept_sphere_aabb(entities[idx2], &broad_motions[idx2]);
+			if (collider_aabb_overlaps(&aabb1, &aabb2)) {
+				test_candidate_pair(entities, idx1, idx2, &collision_pairs);
+			}
+		}
+	}
+
+	return collision_pairs;
+}
+
+// Sweep and Prune
+// Each entity is represented by a proxy holding the AABB of its bounding sphere. Pairs are collected by sweeping the
+// axis in which the entities are most spread, over a list with the min/max endpoints of all proxies sorted by value on
+// that axis. Since entities barely move between frames, the list is almost sorted when a new frame starts, so it is
+// re-sorted with insertion sort, which is ~O(n) in this case. It is only fully sorted again when the sweep axis changes.
+
+#define SAP_MAX_ADDED_PROXIES_FOR_INSERTION_SORT 16
+
+typedef struct {
+	r64 value;
+	u32 proxy_idx;
+	boolean is_max;
+} Sap_Endpoint;
+
+typedef struct {
+	eid id;
+	Entity* entity;       // only valid during the current frame
+	u32 entity_idx;       // index of the entity in the entities array of the current frame
+	vec3 min;
+	vec3 max;
+	u32 frame;            // last frame in which the entity was seen
+	boolean in_use;
+} Sap_Proxy;
+
+typedef struct {
+	boolean initialized;
+	u32 frame;
+	Sap_Proxy* proxies;
+	u32* free_proxies;
+	Sap_Endpoint* endpoints;
+	u32 sweep_axis;       // axis the endpoints are sorted on
+	u32* active_proxies;
+	Hash_Map entity_to_proxy_map;
+} Sweep_And_Prune;
+
+static Sweep_And_Prune sap;
+
+static void sap_init() {
+	sap.frame = 0;
+	sap.proxies = array_new_len(Sap_Proxy, 256);
+	sap.free_proxies = array_new_len(u32, 16);
+	sap.endpoints = array_new_len(Sap_Endpoint, 512);
+	sap.sweep_axis = 0;
+	sap.active_proxies = array_new_len(u32, 64);
+	assert(!hash_map_create(&sap.entity_to_proxy_map, 1024, sizeof(eid), sizeof(u32), util_eid_compare, util_eid_hash));
+	sap.initialized = true;
+}
+
+static r64 vec3_get_axis(vec3 v, u32 axis) {
+	switch (axis) {
+		case 0: return v.x;
+		case 1: return v.y;
+		case 2: return v.z;
+	}
+
+	assert(0);
+	return 0.0;
+}
+
+static u32 sap_proxy_add(Entity* e) {
+	u32 proxy_idx;
+	if (array_length(sap.free_proxies) > 0) {
+		proxy_idx = sap.free_proxies[array_length(sap.free_proxies) - 1];
+		array_length(sap.free_proxies)--;
+	} else {
+		Sap_Proxy new_proxy = {0};
+		proxy_idx = array_length(sap.proxies);
+		array_push(sap.proxies, new_proxy);
+	}
+
+	Sap_Proxy* proxy = &sap.proxies[proxy_idx];
+	proxy->id = e->id;
+	proxy->in_use = true;
+
+	// The endpoints are simply pushed to the end of the list, the insertion sort will put them in the right place.
+	Sap_Endpoint min_endpoint = (Sap_Endpoint){0.0, proxy_idx, false};
+	Sap_Endpoint max_endpoint = (Sap_Endpoint){0.0, proxy_idx, true};
+	array_push(sap.endpoints, min_endpoint);
+	array_push(sap.endpoints, max_endpoint);
+
+	int r = hash_map_put(&sap.entity_to_proxy_map, &e->id, &proxy_idx);
+	assert(r == 0);
+	return proxy_idx;
+}
+
+// Remove all proxies whose entities were not seen in the current frame (e.g. the entity was destroyed)
+static void sap_remove_stale_proxies() {
+	boolean has_stale_proxies = false;
+	for (u32 i = 0; i < array_length(sap.proxies); ++i) {
+		Sap_Proxy* proxy = &sap.proxies[i];
+		if (proxy->in_use && proxy->frame != sap.frame) {
+			hash_map_delete(&sap.entity_to_proxy_map, &proxy->id);
+			proxy->in_use = false;
+			array_push(sap.free_proxies, i);
+			has_stale_proxies = true;
+		}
+	}
+
+	if (!has_stale_proxies) {
+		return;
+	}
+
+	// Compact the endpoint list, keeping it sorted
+	u32 n = 0;
+	for (u32 j = 0; j < array_length(sap.endpoints); ++j) {
+		if (sap.proxies[sap.endpoints[j].proxy_idx].in_use) {
+			sap.endpoints[n++] = sap.endpoints[j];
+		}
+	}
+	array_length(sap.endpoints) = n;
+}
+
+// Min endpoints go first when values are equal, so touching AABBs are still considered overlapping.
+static boolean sap_endpoint_less_than(const Sap_Endpoint* e1, const Sap_Endpoint* e2) {
+	return e1->value < e2->value || (e1->value == e2->value && !e1->is_max && e2->is_max);
+}
+
+static int sap_endpoint_compare(const void* _e1, const void* _e2) {
+	const Sap_Endpoint* e1 = (const Sap_Endpoint*)_e1;
+	const Sap_Endpoint* e2 = (const Sap_Endpoint*)_e2;
+	if (sap_endpoint_less_than(e1, e2)) return -1;
+	if (sap_endpoint_less_than(e2, e1)) return 1;
+	return 0;
+}
+
+static void sap_sort_axis(u32 axis, boolean full_sort) {
+	Sap_Endpoint* endpoints = sap.endpoints;
+
+	// Refresh the endpoint values
+	for (u32 i = 0; i < array_length(endpoints); ++i) {
+		Sap_Endpoint* endpoint = &endpoints[i];
+		const Sap_Proxy* proxy = &sap.proxies[endpoint->proxy_idx];
+		endpoint->value = endpoint->is_max ? vec3_get_axis(proxy->max, axis) : vec3_get_axis(proxy->min, axis);
+	}
+
+	// When a lot of proxies were just added (e.g. in the first frame) or the axis changed, the list is far from sorted and
+	// insertion sort would be quadratic, so we fallback to a full sort.
+	if (full_sort) {
+		qsort(endpoints, array_length(endpoints), sizeof(Sap_Endpoint), sap_endpoint_compare);
+		return;
+	}
+
+	for (u32 i = 1; i < array_length(endpoints); ++i) {
+		Sap_Endpoint endpoint = endpoints[i];
+		s32 j = (s32)i - 1;
+		while (j >= 0 && sap_endpoint_less_than(&endpoint, &endpoints[j])) {
+			endpoints[j + 1] = endpoints[j];
+			--j;
+		}
+		endpoints[j + 1] = endpoint;
+	}
+}
+
+// The sweep axis is the one in which the proxy centers have the biggest variance
+static u32 sap_get_sweep_axis() {
+	vec3 sum = (vec3){0.0, 0.0, 0.0};
+	vec3 sum_sqd = (vec3){0.0, 0.0, 0.0};
+	u32 n = 0;
+	for (u32 i = 0; i < array_length(sap.proxies); ++i) {
+		const Sap_Proxy* proxy = &sap.proxies[i];
+		if (!proxy->in_use) continue;
+		vec3 center = gm_vec3_scalar_product(0.5, gm_vec3_add(proxy->min, proxy->max));
+		sum = gm_vec3_add(sum, center);
+		sum_sqd = gm_vec3_add(sum_sqd, (vec3){center.x * center.x, center.y * center.y, center.z * center.z});
+		++n;
+	}
+
+	if (n == 0) {
+		return 0;
+	}
+
+	vec3 variance = gm_vec3_subtract(gm_vec3_scalar_product(1.0 / n, sum_sqd),
+		gm_vec3_scalar_product(1.0 / (n * (r64)n), (vec3){sum.x * sum.x, sum.y * sum.y, sum.z * sum.z}));
+
+	if (variance.x >= variance.y && variance.x >= variance.z) {
+		return 0;
+	}
+
+	return variance.y >= variance.z ? 1 : 2;
+}
+
+static boolean sap_proxies_overlap(const Sap_Proxy* p1, const Sap_Proxy* p2) {
+	return p1->min.x <= p2->max.x && p2->min.x <= p1->max.x &&
+		p1->min.y <= p2->max.y && p2->min.y <= p1->max.y &&
+		p1->min.z <= p2->max.z && p2->min.z <= p1->max.z;
+}
+
+static Broad_Collision_Pair* sap_get_collision_pairs(Entity** entities) {
+	if (!sap.initialized) {
+		sap_init();
+	}
+
+	++sap.frame;
+	u32 num_added_proxies = 0;
+
+	// Sync the proxies with the non-fixed entities. Entities that became fixed are removed as stale proxies.
+	for (u32 k = 0; k < array_length(broad_dynamic_entities); ++k) {
+		u32 i = broad_dynamic_entities[k];
+		Entity* e = entities[i];
+		u32 proxy_idx;
+		if (hash_map_get(&sap.entity_to_proxy_map, &e->id, &proxy_idx)) {
+			proxy_idx = sap_proxy_add(e);
+			++num_added_proxies;
+		}
+
+		Sap_Proxy* proxy = &sap.proxies[proxy_idx];
+		Collider_AABB aabb = get_swept_sphere_aabb(e, &broad_motions[i]);
+		proxy->entity = e;
+		proxy->entity_idx = i;
+		proxy->frame = sap.frame;
+		proxy->min = aabb.min;
+		proxy->max = aabb.max;
+	}
+
+	sap_remove_stale_proxies();
+
+	u32 sweep_axis = sap_get_sweep_axis();
+	boolean full_sort = num_added_proxies > SAP_MAX_ADDED_PROXIES_FOR_INSERTION_SORT || sweep_axis != sap.sweep_axis;
+	sap.sweep_axis = sweep_axis;
+	sap_sort_axis(sweep_axis, full_sort);
+
+	Broad_Collision_Pair* collision_pairs = array_new_len(Broad_Collision_Pair, 32);
+
+	Sap_Endpoint* endpoints = sap.endpoints;
+	array_clear(sap.active_proxies);
+	for (u32 i = 0; i < array_length(endpoints); ++i) {
+		Sap_Endpoint* endpoint = &endpoints[i];
+
+		if (endpoint->is_max) {
+			// The order of the active proxies doesn't matter, so the last one takes the place of the removed one
+			u32 num_active_proxies = array_length(sap.active_proxies);
+			for (u32 j = 0; j < num_active_proxies; ++j) {
+				if (sap.active_proxies[j] == endpoint->proxy_idx) {
+					sap.active_proxies[j] = sap.active_proxies[num_active_proxies - 1];
+					array_length(sap.active_proxies)--;
+					break;
+				}
+			}
+			continue;
+		}
+
+		const Sap_Proxy* p1 = &sap.proxies[endpoint->proxy_idx];
+		for (u32 j = 0; j < array_length(sap.active_proxies); ++j) {
+			const Sap_Proxy* p2 = &sap.proxies[sap.active_proxies[j]];
+			if (sap_proxies_overlap(p1, p2)) {
+				test_candidate_pair(entities, p1->entity_idx, p2->entity_idx, &collision_pairs);
 			}
 		}
+
+		array_push(sap.active_proxies, endpoint->proxy_idx);
 	}
 
 	return collision_pairs;
 }
 
-static eid uf_find(Hash_Map* entity_to_parent_map, eid x) {
-	eid p;
-	assert(!hash_map_get(entity_to_parent_map, &x, &p));
-	if (p == x) {
-		return x;
+// Dynamic AABB Tree
+// Each non-fixed entity owns a leaf holding a fat AABB built from its colliders. Leaves are only reinserted when the
+// entity leaves its fat AABB. Pairs are found by querying the tree with the AABB of each entity.
+
+// How much the leaves' AABBs are enlarged
+#define BVH_FAT_AABB_MARGIN 0.2
+
+typedef struct {
+	eid id;
+	Entity* entity;       // only valid during the current frame
+	u32 entity_idx;       // index of the entity in the entities array of the current frame
+	s32 leaf;
+	Collider_AABB aabb;   // the swept AABB of the entity in the current frame
+	u32 frame;            // last frame in which the entity was seen
+	boolean in_use;
+} Bvh_Proxy;
+
+typedef struct {
+	boolean initialized;
+	u32 frame;
+	Bvh tree;
+	Bvh_Proxy* proxies;
+	u32* free_proxies;
+	Hash_Map entity_to_proxy_map;
+} Bvh_Broad;
+
+static Bvh_Broad bvh_broad;
+
+typedef struct {
+	const Bvh_Proxy* proxy;
+	Entity** entities;
+	Broad_Collision_Pair** collision_pairs;
+} Bvh_Broad_Query_Context;
+
+static void bvh_broad_init() {
+	bvh_broad.frame = 0;
+	bvh_create(&bvh_broad.tree);
+	bvh_broad.proxies = array_new_len(Bvh_Proxy, 256);
+	bvh_broad.free_proxies = array_new_len(u32, 16);
+	assert(!hash_map_create(&bvh_broad.entity_to_proxy_map, 1024, sizeof(eid), sizeof(u32), util_eid_compare, util_eid_hash));
+	bvh_broad.initialized = true;
+}
+
+static u32 bvh_broad_proxy_add(Entity* e, Collider_AABB aabb) {
+	u32 proxy_idx;
+	if (array_length(bvh_broad.free_proxies) > 0) {
+		proxy_idx = bvh_broad.free_proxies[array_length(bvh_broad.free_proxies) - 1];
+		array_length(bvh_broad.free_proxies)--;
+	} else {
+		Bvh_Proxy new_proxy = {0};
+		proxy_idx = array_length(bvh_broad.proxies);
+		array_push(bvh_broad.proxies, new_proxy);
+	}
+
+	Bvh_Proxy* proxy = &bvh_broad.proxies[proxy_idx];
+	proxy->id = e->id;
+	proxy->in_use = true;
+	proxy->leaf = bvh_insert(&bvh_broad.tree, aabb, BVH_FAT_AABB_MARGIN, proxy_idx);
+
+	int r = hash_map_put(&bvh_broad.entity_to_proxy_map, &e->id, &proxy_idx);
+	assert(r == 0);
+	return proxy_idx;
+}
+
+static void bvh_broad_remove_stale_proxies() {
+	for (u32 i = 0; i < array_length(bvh_broad.proxies); ++i) {
+		Bvh_Proxy* proxy = &bvh_broad.proxies[i];
+		if (proxy->in_use && proxy->frame != bvh_broad.frame) {
+			hash_map_delete(&bvh_broad.entity_to_proxy_map, &proxy->id);
+			bvh_remove(&bvh_broad.tree, proxy->leaf);
+			proxy->in_use = false;
+			array_push(bvh_broad.free_proxies, i);
+		}
+	}
+}
+
+static boolean bvh_broad_query_callback(s32 leaf, u64 user_data, void* ctx) {
+	Bvh_Broad_Query_Context* query_context = (Bvh_Broad_Query_Context*)ctx;
+	const Bvh_Proxy* p1 = query_context->proxy;
+	const Bvh_Proxy* p2 = &bvh_broad.proxies[user_data];
+
+	if (p1 == p2) {
+		return true;
+	}
+
+	// Every pair is found twice, we only keep one of them
+	if (p2->entity_idx < p1->entity_idx) {
+		return true;
+	}
+
+	if (collider_aabb_overlaps(&p1->aabb, &p2->aabb)) {
+		test_candidate_pair(query_context->entities, p1->entity_idx, p2->entity_idx, query_context->collision_pairs);
+	}
+
+	return true;
+}
+
+static Broad_Collision_Pair* bvh_broad_get_collision_pairs(Entity** entities) {
+	if (!bvh_broad.initialized) {
+		bvh_broad_init();
+	}
+
+	++bvh_broad.frame;
+
+	// Sync the leaves with the non-fixed entities
+	for (u32 k = 0; k < array_length(broad_dynamic_entities); ++k) {
+		u32 i = broad_dynamic_entities[k];
+		Entity* e = entities[i];
+		Collider_AABB aabb = get_swept_colliders_aabb(e, &broad_motions[i]);
+
+		u32 proxy_idx;
+		if (hash_map_get(&bvh_broad.entity_to_proxy_map, &e->id, &proxy_idx)) {
+			proxy_idx = bvh_broad_proxy_add(e, aabb);
+		} else {
+			bvh_move(&bvh_broad.tree, bvh_broad.proxies[proxy_idx].leaf, aabb, BVH_FAT_AABB_MARGIN);
+		}
+
+		Bvh_Proxy* proxy = &bvh_broad.proxies[proxy_idx];
+		proxy->entity = e;
+		proxy->entity_idx = i;
+		proxy->aabb = aabb;
+		proxy->frame = bvh_broad.frame;
+	}
+
+	bvh_broad_remove_stale_proxies();
+
+	Broad_Collision_Pair* collision_pairs = array_new_len(Broad_Collision_Pair, 32);
+	Bvh_Broad_Query_Context query_context;
+	query_context.entities = entities;
+	query_context.collision_pairs = &collision_pairs;
+
+	for (u32 i = 0; i < array_length(bvh_broad.proxies); ++i) {
+		const Bvh_Proxy* proxy = &bvh_broad.proxies[i];
+		if (!proxy->in_use) {
+			continue;
+		}
+
+		query_context.proxy = proxy;
+		bvh_query_aabb(&bvh_broad.tree, proxy->aabb, bvh_broad_query_callback, &query_context);
+	}
+
+	return collision_pairs;
+}
+
+// Gives access to the tree used by the BVH broad-phase, so it can be reused for scene queries (e.g. raycasts).
+// The user data of each leaf can be converted to the entity id via 'broad_bvh_get_entity_id'.
+// Note that the tree is only updated when the BVH broad-phase method is selected, and that it only holds the non-fixed
+// entities: fixed entities are in the tree returned by 'broad_get_static_tree'.
+const Bvh* broad_bvh_get_tree() {
+	if (!bvh_broad.initialized) {
+		bvh_broad_init();
+	}
+
+	return &bvh_broad.tree;
+}
+
+eid broad_bvh_get_entity_id(u64 leaf_user_data) {
+	return bvh_broad.proxies[leaf_user_data].id;
+}
+
+// Uniform Grid
+// The space is divided into cubic cells, whose size is derived from the typical bounding sphere radius of the entities.
+// Cells are not stored explicitly: each (cell, entity) entry is hashed into a table that is rebuilt every frame with a
+// counting sort, so building the grid and finding the pairs is ~O(n) when the entities have similar sizes.
+// Entities that are much bigger than the cells would be inserted in too many cells, so they are kept in a separate list
+// and tested against all other entities. Fixed entities (e.g. the floor) are not in the grid, they are in the static scene.
+
+// Entities whose bounding sphere radius is bigger than this factor times the typical radius are considered oversized
+#define GRID_OVERSIZED_RADIUS_FACTOR 4.0
+
+typedef struct {
+	s32 x, y, z;
+} Grid_Cell;
+
+typedef struct {
+	Grid_Cell cell;
+	u32 entity_idx;
+} Grid_Entry;
+
+typedef struct {
+	Collider_AABB aabb;
+	Grid_Cell min_cell;
+	Grid_Cell max_cell;
+	boolean oversized;
+} Grid_Proxy;
+
+typedef struct {
+	boolean initialized;
+	r64 forced_cell_size;  // if 0, the cell size is calculated automatically
+	r64 cell_size;
+	Grid_Proxy* proxies;
+	Grid_Entry* entries;
+	Grid_Entry* sorted_entries;
+	u32* bucket_offsets;
+	u32* oversized;
+	r64* radii;
+} Grid;
+
+static Grid grid;
+
+static void grid_init() {
+	grid.proxies = array_new_len(Grid_Proxy, 256);
+	grid.entries = array_new_len(Grid_Entry, 512);
+	grid.sorted_entries = array_new_len(Grid_Entry, 512);
+	grid.bucket_offsets = array_new_len(u32, 1024);
+	grid.oversized = array_new_len(u32, 16);
+	grid.radii = array_new_len(r64, 256);
+	grid.initialized = true;
+}
+
+// Returns the k-th smallest element of the array (quickselect). The array is reordered.
+static r64 select_kth(r64* values, u32 n, u32 k) {
+	u32 left = 0, right = n - 1;
+	while (left < right) {
+		r64 pivot = values[(left + right) / 2];
+		u32 i = left, j = right;
+		while (i <= j) {
+			while (values[i] < pivot) ++i;
+			while (values[j] > pivot) --j;
+			if (i <= j) {
+				r64 tmp = values[i];
+				values[i] = values[j];
+				values[j] = tmp;
+				++i;
+				if (j == 0) break;
+				--j;
+			}
+		}
+		if (k <= j) {
+			right = j;
+		} else if (k >= i) {
+			left = i;
+		} else {
+			break;
+		}
+	}
+
+	return values[k];
+}
+
+// The cell size is the diameter of the median non-fixed entity (including the margin)
+static r64 grid_calculate_cell_size(Entity** entities) {
+	array_clear(grid.radii);
+	for (u32 i = 0; i < array_length(broad_dynamic_entities); ++i) {
+		array_push(grid.radii, entities[broad_dynamic_entities[i]]->bounding_sphere_radius);
+	}
+
+	if (array_length(grid.radii) == 0) {
+		return 1.0;
+	}
+
+	u32 n = array_length(grid.radii);
+	r64 median_radius = select_kth(grid.radii, n, n / 2);
+	return MAX(2.0 * median_radius + BROAD_BASE_MARGIN, 0.01);
+}
+
+static Grid_Cell grid_get_cell(vec3 position) {
+	Grid_Cell cell;
+	cell.x = (s32)floor(position.x / grid.cell_size);
+	cell.y = (s32)floor(position.y / grid.cell_size);
+	cell.z = (s32)floor(position.z / grid.cell_size);
+	return cell;
+}
+
+static u32 grid_cell_hash(Grid_Cell cell) {
+	// Large primes, as in 'Optimized Spatial Hashing for Collision Detection of Deformable Objects' (Teschner et al.)
+	return ((u32)cell.x * 73856093u) ^ ((u32)cell.y * 19349663u) ^ ((u32)cell.z * 83492791u);
+}
+
+static boolean grid_cell_equal(Grid_Cell c1, Grid_Cell c2) {
+	return c1.x == c2.x && c1.y == c2.y && c1.z == c2.z;
+}
+
+void broad_set_grid_cell_size(r64 cell_size) {
+	grid.forced_cell_size = cell_size;
+}
+
+static Broad_Collision_Pair* grid_get_collision_pairs(Entity** entities) {
+	if (!grid.initialized) {
+		grid_init();
+	}
+
+	grid.cell_size = grid.forced_cell_size > 0.0 ? grid.forced_cell_size : grid_calculate_cell_size(entities);
+	r64 typical_radius = (grid.cell_size - BROAD_BASE_MARGIN) / 2.0;
+
+	// Proxies are indexed by entity index, the ones of fixed entities are left unused
+	array_clear(grid.proxies);
+	array_allocate(grid.proxies, array_length(entities));
+	array_length(grid.proxies) = array_length(entities);
+	array_clear(grid.entries);
+	array_clear(grid.oversized);
+
+	// Build the proxies and the (cell, entity) entries
+	for (u32 k = 0; k < array_length(broad_dynamic_entities); ++k) {
+		u32 i = broad_dynamic_entities[k];
+		Entity* e = entities[i];
+		Grid_Proxy* proxy = &grid.proxies[i];
+		proxy->oversized = e->bounding_sphere_radius > GRID_OVERSIZED_RADIUS_FACTOR * typical_radius;
+
+		if (proxy->oversized) {
+			// There are only a few oversized entities, so it is worth to have tighter bounds for them
+			proxy->aabb = get_swept_colliders_aabb(e, &broad_motions[i]);
+			array_push(grid.oversized, i);
+			continue;
+		}
+
+		proxy->aabb = get_swept_sphere_aabb(e, &broad_motions[i]);
+		proxy->min_cell = grid_get_cell(proxy->aabb.min);
+		proxy->max_cell = grid_get_cell(proxy->aabb.max);
+
+		for (s32 x = proxy->min_cell.x; x <= proxy->max_cell.x; ++x) {
+			for (s32 y = proxy->min_cell.y; y <= proxy->max_cell.y; ++y) {
+				for (s32 z = proxy->min_cell.z; z <= proxy->max_cell.z; ++z) {
+					Grid_Entry entry;
+					entry.cell = (Grid_Cell){x, y, z};
+					entry.entity_idx = i;
+					array_push(grid.entries, entry);
+				}
+			}
+		}
+	}
+
+	// Counting sort of the entries by hash bucket
+	u32 num_entries = array_length(grid.entries);
+	u32 num_buckets = 1;
+	while (num_buckets < 2 * num_entries) {
+		num_buckets <<= 1;
+	}
+
+	array_clear(grid.bucket_offsets);
+	array_allocate(grid.bucket_offsets, num_buckets + 1);
+	array_length(grid.bucket_offsets) = num_buckets + 1;
+	memset(grid.bucket_offsets, 0, (num_buckets + 1) * sizeof(u32));
+	for (u32 i = 0; i < num_entries; ++i) {
+		++grid.bucket_offsets[(grid_cell_hash(grid.entries[i].cell) & (num_buckets - 1)) + 1];
+	}
+	for (u32 i = 0; i < num_buckets; ++i) {
+		grid.bucket_offsets[i + 1] += grid.bucket_offsets[i];
+	}
+
+	array_clear(grid.sorted_entries);
+	array_allocate(grid.sorted_entries, num_entries);
+	array_length(grid.sorted_entries) = num_entries;
+	for (u32 i = 0; i < num_entries; ++i) {
+		u32 bucket = grid_cell_hash(grid.entries[i].cell) & (num_buckets - 1);
+		// 'bucket_offsets[bucket]' is used as the insertion cursor and ends up holding the end of the bucket
+		grid.sorted_entries[grid.bucket_offsets[bucket]++] = grid.entries[i];
+	}
+
+	Broad_Collision_Pair* collision_pairs = array_new_len(Broad_Collision_Pair, 32);
+
+	// Test all entries that share a bucket. Since the buckets were used as cursors, bucket 'i' is now in the range
+	// [bucket_offsets[i - 1], bucket_offsets[i]).
+	u32 bucket_start = 0;
+	for (u32 b = 0; b < num_buckets; ++b) {
+		u32 bucket_end = grid.bucket_offsets[b];
+		for (u32 i = bucket_start; i < bucket_end; ++i) {
+			const Grid_Entry* entry1 = &grid.sorted_entries[i];
+			const Grid_Proxy* p1 = &grid.proxies[entry1->entity_idx];
+			for (u32 j = i + 1; j < bucket_end; ++j) {
+				const Grid_Entry* entry2 = &grid.sorted_entries[j];
+
+				// Different cells can be hashed to the same bucket
+				if (!grid_cell_equal(entry1->cell, entry2->cell)) {
+					continue;
+				}
+
+				const Grid_Proxy* p2 = &grid.proxies[entry2->entity_idx];
+				if (!collider_aabb_overlaps(&p1->aabb, &p2->aabb)) {
+					continue;
+				}
+
+				// Two entities can share more than one cell. To avoid duplicates, the pair is only reported
+				// in the cell that contains the min corner of the intersection of both AABBs.
+				vec3 intersection_min = (vec3){MAX(p1->aabb.min.x, p2->aabb.min.x), MAX(p1->aabb.min.y, p2->aabb.min.y),
+					MAX(p1->aabb.min.z, p2->aabb.min.z)};
+				if (!grid_cell_equal(grid_get_cell(intersection_min), entry1->cell)) {
+					continue;
+				}
+
+				test_candidate_pair(entities, entry1->entity_idx, entry2->entity_idx, &collision_pairs);
+			}
+		}
+		bucket_start = bucket_end;
+	}
+
+	// Finally, test the oversized entities against everything else
+	for (u32 i = 0; i < array_length(grid.oversized); ++i) {
+		u32 idx1 = grid.oversized[i];
+		const Grid_Proxy* p1 = &grid.proxies[idx1];
+		for (u32 k = 0; k < array_length(broad_dynamic_entities); ++k) {
+			u32 idx2 = broad_dynamic_entities[k];
+			const Grid_Proxy* p2 = &grid.proxies[idx2];
+
+			// Pairs of oversized entities would be found twice
+			if (idx1 == idx2 || (p2->oversized && idx2 < idx1)) {
+				continue;
+			}
+
+			if (collider_aabb_overlaps(&p1->aabb, &p2->aabb)) {
+				test_candidate_pair(entities, idx1, idx2, &collision_pairs);
+			}
+		}
 	}
 
-	return uf_find(entity_to_parent_map, p);
+	return collision_pairs;
 }
 
-static void uf_union(Hash_Map* entity_to_parent_map, eid x, eid y) {
-	eid key = uf_find(entity_to_parent_map, y);
-	eid value = uf_find(entity_to_parent_map, x);
-	assert(hash_map_put(entity_to_parent_map, &key, &value) == 0);
+// Static Scene
+// Fixed entities never move during the simulation, so they are kept out of the structures of the broad-phase methods
+// (which then never test two fixed entities against each other). They live in their own tree, which is built once and
+// only rebuilt when a fixed entity is added, removed or moved. Pairs against fixed entities are found by querying it
+// with the bounds of each non-fixed entity.
+
+typedef struct {
+	eid id;
+	u32 entity_idx;       // index of the entity in the entities array of the current frame
+	vec3 position;        // pose of the entity when the tree was built
+	Quaternion rotation;
+} Static_Proxy;
+
+typedef struct {
+	boolean initialized;
+	boolean rebuilt;      // whether the tree was rebuilt in the current frame
+	Bvh tree;
+	Static_Proxy* proxies;
+} Static_Scene;
+
+static Static_Scene static_scene;
+
+typedef struct {
+	u32 entity_idx;
+	Entity** entities;
+	Broad_Collision_Pair** collision_pairs;
+} Static_Scene_Query_Context;
+
+static void static_scene_init() {
+	bvh_create(&static_scene.tree);
+	static_scene.proxies = array_new_len(Static_Proxy, 16);
+	static_scene.initialized = true;
 }
 
-static Hash_Map uf_collect_all(Entity** entities, Broad_Collision_Pair* collision_pairs) {
-	Hash_Map entity_to_parent_map;
-	assert(!hash_map_create(&entity_to_parent_map, 1024, sizeof(eid), sizeof(eid), util_eid_compare, util_eid_hash));
+// Checks whether the fixed entities are the same (and in the same place) as when the tree was built
+static boolean static_scene_is_outdated(Entity** entities) {
+	u32 num_fixed_entities = 0;
+	for (u32 i = 0; i < array_length(entities); ++i) {
+		Entity* e = entities[i];
+		if (!e->fixed) {
+			continue;
+		}
 
+		if (num_fixed_entities == array_length(static_scene.proxies)) {
+			return true;
+		}
+
+		const Static_Proxy* proxy = &static_scene.proxies[num_fixed_entities++];
+		if (proxy->id != e->id || !gm_vec3_equal(proxy->position, e->world_position) ||
+			proxy->rotation.x != e->world_rotation.x || proxy->rotation.y != e->world_rotation.y ||
+			proxy->rotation.z != e->world_rotation.z || proxy->rotation.w != e->world_rotation.w) {
+			return true;
+		}
+	}
+
+	return num_fixed_entities != array_length(static_scene.proxies);
+}
+
+static void static_scene_update(Entity** entities) {
+	if (!static_scene.initialized) {
+		static_scene_init();
+	}
+
+	static_scene.rebuilt = static_scene_is_outdated(entities);
+	if (!static_scene.rebuilt) {
+		// The entities array may have been reordered, so the indexes are refreshed. The order of the fixed entities
+		// didn't change, otherwise the tree would be outdated.
+		u32 num_fixed_entities = 0;
+		for (u32 i = 0; i < array_length(entities); ++i) {
+			if (entities[i]->fixed) {
+				static_scene.proxies[num_fixed_entities++].entity_idx = i;
+			}
+		}
+		return;
+	}
+
+	bvh_clear(&static_scene.tree);
+	array_clear(static_scene.proxies);
 	for (u32 i = 0; i < array_length(entities); ++i) {
-		eid id = entities[i]->id;
-		assert(!hash_map_put(&entity_to_parent_map, &id, &id));
+		Entity* e = entities[i];
+		if (!e->fixed) {
+			continue;
+		}
+
+		Static_Proxy proxy;
+		proxy.id = e->id;
+		proxy.entity_idx = i;
+		proxy.position = e->world_position;
+		proxy.rotation = e->world_rotation;
+		array_push(static_scene.proxies, proxy);
+
+		// Fixed entities don't move, so the leaves don't need any extra margin
+		Collider_AABB aabb = get_swept_colliders_aabb(e, &broad_motions[i]);
+		bvh_insert(&static_scene.tree, aabb, 0.0, array_length(static_scene.proxies) - 1);
 	}
+}
 
-	for (u32 i = 0; i < array_length(collision_pairs); ++i) {
-		Broad_Collision_Pair collision_pair = collision_pairs[i];
-		eid id1 = collision_pair.e1_id;
-		eid id2 = collision_pair.e2_id;
-		Entity* e1 = entity_get_by_id(id1);
-		Entity* e2 = entity_get_by_id(id2);
-		if (!e1->fixed && !e2->fixed) {
-			uf_union(&entity_to_parent_map, id1, id2);
+static boolean static_scene_query_callback(s32 leaf, u64 user_data, void* ctx) {
+	Static_Scene_Query_Context* query_context = (Static_Scene_Query_Context*)ctx;
+	test_candidate_pair(query_context->entities, query_context->entity_idx, static_scene.proxies[user_data].entity_idx,
+		query_context->collision_pairs);
+	return true;
+}
+
+static void static_scene_get_collision_pairs(Entity** entities, Broad_Collision_Pair** collision_pairs) {
+	if (array_length(static_scene.proxies) == 0) {
+		return;
+	}
+
+	Static_Scene_Query_Context query_context;
+	query_context.entities = entities;
+	query_context.collision_pairs = collision_pairs;
+	for (u32 i = 0; i < array_length(broad_dynamic_entities); ++i) {
+		u32 entity_idx = broad_dynamic_entities[i];
+		query_context.entity_idx = entity_idx;
+		bvh_query_aabb(&static_scene.tree, get_swept_sphere_aabb(entities[entity_idx], &broad_motions[entity_idx]),
+			static_scene_query_callback, &query_context);
+	}
+}
+
+// Whether a fixed entity was added, removed or moved since the previous call to 'broad_get_collision_pairs'
+boolean broad_static_scene_was_rebuilt() {
+	return static_scene.rebuilt;
+}
+
+// Gives access to the tree holding the fixed entities, so it can be reused for scene queries (e.g. raycasts).
+// The user data of each leaf can be converted to the entity id via 'broad_static_get_entity_id'.
+const Bvh* broad_get_static_tree() {
+	if (!static_scene.initialized) {
+		static_scene_init();
+	}
+
+	return &static_scene.tree;
+}
+
+eid broad_static_get_entity_id(u64 leaf_user_data) {
+	return static_scene.proxies[leaf_user_data].id;
+}
+
+// Collects all pairs of entities that might collide in the next 'dt' seconds.
+// The bounds of each entity are swept according to its velocities and external forces.
+// Pairs filtered by the collision category/mask of the entities, or formed by the entities of a constraint in
+// 'constraints' (can be NULL) with 'disable_collision' set, are never reported.
+Broad_Collision_Pair* broad_get_collision_pairs(Entity** entities, const Constraint* constraints, r64 dt) {
+	r64 start_time = util_get_time();
+	broad_statistics.num_candidate_pairs = 0;
+	broad_statistics.num_culled_pairs = 0;
+	broad_statistics.num_filtered_pairs = 0;
+
+	collect_disabled_pairs(constraints);
+	calculate_motions(entities, dt);
+	static_scene_update(entities);
+
+	Broad_Collision_Pair* collision_pairs;
+	switch (broad_method) {
+		case BROAD_PHASE_METHOD_ALL_PAIRS: {
+			collision_pairs = all_pairs_get_collision_pairs(entities);
+		} break;
+		case BROAD_PHASE_METHOD_SWEEP_AND_PRUNE: {
+			collision_pairs = sap_get_collision_pairs(entities);
+		} break;
+		case BROAD_PHASE_METHOD_BVH: {
+			collision_pairs = bvh_broad_get_collision_pairs(entities);
+		} break;
+		case BROAD_PHASE_METHOD_GRID: {
+			collision_pairs = grid_get_collision_pairs(entities);
+		} break;
+		default: {
+			assert(0);
+			collision_pairs = array_new(Broad_Collision_Pair);
+		} break;
+	}
+
+	// Pairs between non-fixed and fixed entities
+	static_scene_get_collision_pairs(entities, &collision_pairs);
+
+	broad_statistics.method = broad_method;
+	broad_statistics.num_entities = array_length(entities);
+	broad_statistics.num_static_entities = array_length(static_scene.proxies);
+	broad_statistics.num_pairs = array_length(collision_pairs);
+	broad_statistics.elapsed_time = util_get_time() - start_time;
+	return collision_pairs;
+}
+
+// Simulation islands are persistent: they are kept across frames and updated incrementally.
+// - When two entities of different islands start touching (or get a constraint), their islands are merged.
+// - When a pair or constraint between two entities of the same island goes away, the island *might* have split. The
+//   island is only flagged, and flagged islands are split lazily: in each frame, at most the largest flagged awake
+//   island and the largest flagged sleeping island are split.
+// - A whole island goes to sleep at once. Sleeping islands are left out of the output, so they cost nothing until
+//   an awake entity starts touching them or one of their entities is activated with 'entity_activate'.
+typedef struct {
+	eid* entities;              // members of the island, may include entities that were destroyed
+	u32 num_removed_edges;      // pairs/constraints removed since the island was built, if > 0 the island might be split
+	u32 num_seen_entities;      // members found in the current frame
+	u32 output_idx;             // index of the island in the output of the current frame
+	boolean sleeping;
+	boolean in_use;
+} Simulation_Island;
+
+typedef struct {
+	Simulation_Island* islands;
+	u32* free_islands;
+	eid* constraint_entities;   // pairs of entities of the constraints of the previous frame
+} Simulation_Island_Manager;
+
+static Simulation_Island_Manager island_manager;
+
+// Scratch memory of the union-find, reused across frames
+static u32* uf_parent;
+static u32* uf_rank;
+// Maps the ids of the entities of the island being split to their indexes, emptied after each split
+static Hash_Map island_entity_to_idx_map;
+static boolean island_entity_to_idx_map_created;
+
+static u32 uf_find(u32 x) {
+	// Path halving: every visited node is linked to its grandparent
+	while (uf_parent[x] != x) {
+		uf_parent[x] = uf_parent[uf_parent[x]];
+		x = uf_parent[x];
+	}
+	return x;
+}
+
+static void uf_union(u32 x, u32 y) {
+	u32 root_x = uf_find(x);
+	u32 root_y = uf_find(y);
+	if (root_x == root_y) {
+		return;
+	}
+
+	// Union by rank: the shallower tree is linked under the deeper one
+	if (uf_rank[root_x] < uf_rank[root_y]) {
+		uf_parent[root_x] = root_y;
+	} else if (uf_rank[root_x] > uf_rank[root_y]) {
+		uf_parent[root_y] = root_x;
+	} else {
+		uf_parent[root_y] = root_x;
+		++uf_rank[root_x];
+	}
+}
+
+static void uf_reset(u32 num_entities) {
+	if (!uf_parent) {
+		uf_parent = array_new_len(u32, 256);
+		uf_rank = array_new_len(u32, 256);
+	}
+
+	array_clear(uf_parent);
+	array_clear(uf_rank);
+	array_allocate(uf_parent, num_entities);
+	array_allocate(uf_rank, num_entities);
+	array_length(uf_parent) = num_entities;
+	array_length(uf_rank) = num_entities;
+	for (u32 i = 0; i < num_entities; ++i) {
+		uf_parent[i] = i;
+		uf_rank[i] = 0;
+	}
+}
+
+static u32 island_create() {
+	u32 island_id;
+	if (array_length(island_manager.free_islands) > 0) {
+		island_id = island_manager.free_islands[--array_length(island_manager.free_islands)];
+	} else {
+		Simulation_Island empty = {0};
+		empty.entities = array_new_len(eid, 8);
+		island_id = array_length(island_manager.islands);
+		array_push(island_manager.islands, empty);
+	}
+
+	Simulation_Island* island = &island_manager.islands[island_id];
+	array_clear(island->entities);
+	island->num_removed_edges = 0;
+	island->num_seen_entities = 0;
+	island->sleeping = false;
+	island->in_use = true;
+	return island_id;
+}
+
+static void island_destroy(u32 island_id) {
+	island_manager.islands[island_id].in_use = false;
+	array_push(island_manager.free_islands, island_id);
+}
+
+static void island_wake_up(u32 island_id) {
+	Simulation_Island* island = &island_manager.islands[island_id];
+	if (!island->sleeping) {
+		return;
+	}
+
+	island->sleeping = false;
+	for (u32 i = 0; i < array_length(island->entities); ++i) {
+		Entity* e = entity_get_by_id(island->entities[i]);
+		if (e && e->island_id == island_id) {
+			e->active = true;
+		}
+	}
+}
+
+// Merges the islands of both entities (the smallest island is moved into the biggest one)
+static void island_merge(Entity* e1, Entity* e2) {
+	u32 island1_id = e1->island_id;
+	u32 island2_id = e2->island_id;
+	if (island1_id == island2_id) {
+		return;
+	}
+
+	// If any of the islands was sleeping, it's woken up by the other one
+	island_wake_up(island1_id);
+	island_wake_up(island2_id);
+
+	if (array_length(island_manager.islands[island1_id].entities) < array_length(island_manager.islands[island2_id].entities)) {
+		u32 aux = island1_id;
+		island1_id = island2_id;
+		island2_id = aux;
+	}
+
+	Simulation_Island* island1 = &island_manager.islands[island1_id];
+	Simulation_Island* island2 = &island_manager.islands[island2_id];
+	for (u32 i = 0; i < array_length(island2->entities); ++i) {
+		Entity* e = entity_get_by_id(island2->entities[i]);
+		if (e && e->island_id == island2_id) {
+			e->island_id = island1_id;
+			array_push(island1->entities, e->id);
 		}
 	}
 
-	return entity_to_parent_map;
+	island1->num_removed_edges += island2->num_removed_edges;
+	island1->num_seen_entities += island2->num_seen_entities;
+	island_destroy(island2_id);
 }
 
-eid** broad_collect_simulation_islands(Entity** entities, Broad_Collision_Pair* collision_pairs, const Constraint* constraints) {
-	eid** simulation_islands = array_new_len(eid*, 32);
+static void island_flag_removed_edge(eid e1_id, eid e2_id) {
+	Entity* e1 = entity_get_by_id(e1_id);
+	Entity* e2 = entity_get_by_id(e2_id);
+	if (e1 && e2 && !e1->fixed && !e2->fixed && e1->island_id == e2->island_id && e1->island_id != ENTITY_NO_ISLAND) {
+		++island_manager.islands[e1->island_id].num_removed_edges;
+	}
+}
 
-	// Collect the simulation islands into an entity->parent map
-	Hash_Map entity_to_parent_map = uf_collect_all(entities, collision_pairs);
+// Rebuilds an island from the current contacts and constraints of its entities. The first group keeps the island,
+// the other groups become new islands. The groups of a sleeping island keep sleeping.
+static void island_split(u32 island_id, Entity** entities, Broad_Collision_Pair* collision_pairs, const Constraint* constraints) {
+	u32 num_entities = array_length(entities);
+	uf_reset(num_entities);
+
+	for (u32 i = 0; i < array_length(collision_pairs); ++i) {
+		Entity* e1 = entities[collision_pairs[i].e1_idx];
+		Entity* e2 = entities[collision_pairs[i].e2_idx];
+		if (!e1->fixed && !e2->fixed && e1->island_id == island_id && e2->island_id == island_id) {
+			uf_union(collision_pairs[i].e1_idx, collision_pairs[i].e2_idx);
+		}
+	}
+
+	// Constraints only know the ids of the entities, so an id->index map is filled for the entities of the island
+	if (constraints != NULL && array_length(constraints) > 0) {
+		if (!island_entity_to_idx_map_created) {
+			assert(!hash_map_create(&island_entity_to_idx_map, 1024, sizeof(eid), sizeof(u32), util_eid_compare, util_eid_hash));
+			island_entity_to_idx_map_created = true;
+		}
+
+		for (u32 i = 0; i < num_entities; ++i) {
+			if (!entities[i]->fixed && entities[i]->island_id == island_id) {
+				assert(!hash_map_put(&island_entity_to_idx_map, &entities[i]->id, &i));
+			}
+		}
 
-	// Extra step: To avoid bugs, we need to make sure that entities that are part of a same constraint are also part of the same island!
-	if (constraints != NULL) {
 		for (u32 i = 0; i < array_length(constraints); ++i) {
-			const Constraint* c = &constraints[i];
-
-			eid id1 = c->e1_id;
-			eid id2 = c->e2_id;
-			Entity* e1 = entity_get_by_id(id1);
-			Entity* e2 = entity_get_by_id(id2);
-			if (!e1->fixed && !e2->fixed) {
-				uf_union(&entity_to_parent_map, id1, id2);
+			u32 idx1, idx2;
+			if (!hash_map_get(&island_entity_to_idx_map, &constraints[i].e1_id, &idx1) &&
+				!hash_map_get(&island_entity_to_idx_map, &constraints[i].e2_id, &idx2)) {
+				uf_union(idx1, idx2);
 			}
 		}
+
+		for (u32 i = 0; i < num_entities; ++i) {
+			if (!entities[i]->fixed && entities[i]->island_id == island_id) {
+				hash_map_delete(&island_entity_to_idx_map, &entities[i]->id);
+			}
+		}
+	}
+
+	// 'uf_rank' is no longer needed, so it's reused to map each root to its island
+	u32* root_to_island = uf_rank;
+	for (u32 i = 0; i < num_entities; ++i) {
+		root_to_island[i] = ENTITY_NO_ISLAND;
 	}
 
-	// As a last step, transform the simulation islands into a nice structure
-	Hash_Map simulation_islands_map;
-	assert(!hash_map_create(&simulation_islands_map, 2 * array_length(entities), sizeof(eid), sizeof(u32), util_eid_compare, util_eid_hash));
+	array_clear(island_manager.islands[island_id].entities);
+	island_manager.islands[island_id].num_seen_entities = 0;
+	boolean sleeping = island_manager.islands[island_id].sleeping;
+	boolean first_group = true;
+	for (u32 i = 0; i < num_entities; ++i) {
+		Entity* e = entities[i];
+		if (e->fixed || e->island_id != island_id) {
+			continue;
+		}
 
-	for (u32 i = 0; i < array_length(entities); ++i) {
+		u32 root = uf_find(i);
+		if (root_to_island[root] == ENTITY_NO_ISLAND) {
+			root_to_island[root] = first_group ? island_id : island_create();
+			island_manager.islands[root_to_island[root]].sleeping = sleeping;
+			first_group = false;
+		}
+
+		// 'island_create' may reallocate the islands, so the pointer is fetched every time
+		Simulation_Island* group = &island_manager.islands[root_to_island[root]];
+		e->island_id = root_to_island[root];
+		array_push(group->entities, e->id);
+		++group->num_seen_entities;
+	}
+
+	island_manager.islands[island_id].num_removed_edges = 0;
+	++broad_statistics.num_island_splits;
+}
+
+// Sorts the items by island (keeping their relative order), in CSR form. Items whose island is
+// BROAD_NO_SIMULATION_ISLAND are left out. 'cursor' is scratch memory with room for 'num_islands' elements.
+static void csr_partition(const u32* item_to_island, u32 num_items, u32 num_islands, u32* cursor, u32** offsets, u32** items) {
+	array_clear(*offsets);
+	array_allocate(*offsets, num_islands + 1);
+	array_length(*offsets) = num_islands + 1;
+	for (u32 i = 0; i <= num_islands; ++i) {
+		(*offsets)[i] = 0;
+	}
+
+	for (u32 i = 0; i < num_items; ++i) {
+		if (item_to_island[i] != BROAD_NO_SIMULATION_ISLAND) {
+			++(*offsets)[item_to_island[i] + 1];
+		}
+	}
+
+	for (u32 i = 0; i < num_islands; ++i) {
+		(*offsets)[i + 1] += (*offsets)[i];
+		cursor[i] = (*offsets)[i];
+	}
+
+	array_clear(*items);
+	array_allocate(*items, (*offsets)[num_islands]);
+	array_length(*items) = (*offsets)[num_islands];
+	for (u32 i = 0; i < num_items; ++i) {
+		u32 island = item_to_island[i];
+		if (island != BROAD_NO_SIMULATION_ISLAND) {
+			(*items)[cursor[island]++] = i;
+		}
+	}
+}
+
+static u32 get_output_island(const Entity* e) {
+	if (e->fixed || e->island_id == ENTITY_NO_ISLAND) {
+		return BROAD_NO_SIMULATION_ISLAND;
+	}
+	return island_manager.islands[e->island_id].output_idx;
+}
+
+static u32 get_output_island_of_pair(const Entity* e1, const Entity* e2) {
+	// Fixed entities don't belong to any island, so the pair goes to the island of the other entity
+	u32 island = get_output_island(e1);
+	return island != BROAD_NO_SIMULATION_ISLAND ? island : get_output_island(e2);
+}
+
+// Updates the simulation islands with the contacts and constraints of the current frame and outputs the islands that
+// are awake: entities that touch (directly or through other non-fixed entities) or that share a constraint end up in
+// the same island. Fixed entities don't belong to any island.
+// The collision pairs and constraints are partitioned by island as well, so each island can be simulated on its own.
+// 'collision_pairs' must be the pairs returned by 'broad_get_collision_pairs' for the same 'entities' array, and the
+// pair cache must already be updated with them.
+// The arrays of 'simulation_islands' are reused across calls, so no memory is allocated in the steady state.
+void broad_collect_simulation_islands(Entity** entities, Broad_Collision_Pair* collision_pairs, const Constraint* constraints,
+	Broad_Simulation_Islands* simulation_islands) {
+	u32 num_entities = array_length(entities);
+	u32 num_collision_pairs = array_length(collision_pairs);
+	u32 num_constraints = constraints ? array_length(constraints) : 0;
+	broad_statistics.num_island_splits = 0;
+
+	if (!island_manager.islands) {
+		island_manager.islands = array_new_len(Simulation_Island, 64);
+		island_manager.free_islands = array_new_len(u32, 64);
+		island_manager.constraint_entities = array_new_len(eid, 64);
+		uf_reset(0);
+	}
+
+	if (!simulation_islands->offsets) {
+		simulation_islands->offsets = array_new_len(u32, 64);
+		simulation_islands->entities = array_new_len(u32, 256);
+		simulation_islands->entity_to_island = array_new_len(u32, 256);
+		simulation_islands->island_ids = array_new_len(u32, 64);
+		simulation_islands->collision_pair_offsets = array_new_len(u32, 64);
+		simulation_islands->collision_pairs = array_new_len(u32, 256);
+		simulation_islands->constraint_offsets = array_new_len(u32, 64);
+		simulation_islands->constraints = array_new_len(u32, 64);
+		simulation_islands->constraint_entities = array_new_len(Entity*, 64);
+	}
+
+	for (u32 i = 0; i < array_length(island_manager.islands); ++i) {
+		island_manager.islands[i].num_seen_entities = 0;
+	}
+
+	// New entities get their own island, and entities of sleeping islands that were activated wake their island up
+	for (u32 i = 0; i < num_entities; ++i) {
 		Entity* e = entities[i];
 		if (e->fixed) {
+			if (e->island_id != ENTITY_NO_ISLAND) {
+				// The entity became fixed, so its island might be split
+				++island_manager.islands[e->island_id].num_removed_edges;
+				e->island_id = ENTITY_NO_ISLAND;
+			}
 			continue;
 		}
-		eid parent = uf_find(&entity_to_parent_map, e->id);
-		u32 simulation_island_idx;
-		if (hash_map_get(&simulation_islands_map, &parent, &simulation_island_idx)) {
-			// Simulation Island not created yet.
-			eid* new_simulation_island = array_new_len(eid, 32);
-			simulation_island_idx = array_length(simulation_islands);
-			array_push(simulation_islands, new_simulation_island);
-			assert(!hash_map_put(&simulation_islands_map, &parent, &simulation_island_idx));
+
+		if (e->island_id == ENTITY_NO_ISLAND) {
+			e->island_id = island_create();
+			array_push(island_manager.islands[e->island_id].entities, e->id);
 		}
 
-		array_push(simulation_islands[simulation_island_idx], e->id);
+		Simulation_Island* island = &island_manager.islands[e->island_id];
+		++island->num_seen_entities;
+		if (island->sleeping && e->active) {
+			island_wake_up(e->island_id);
+		}
+	}
+
+	// Islands whose entities were all destroyed are released. If only some of them were destroyed, the island might be split.
+	for (u32 i = 0; i < array_length(island_manager.islands); ++i) {
+		Simulation_Island* island = &island_manager.islands[i];
+		if (!island->in_use) {
+			continue;
+		}
+
+		if (island->num_seen_entities == 0) {
+			island_destroy(i);
+		} else if (island->num_seen_entities != array_length(island->entities)) {
+			++island->num_removed_edges;
+		}
 	}
 
-	hash_map_destroy(&entity_to_parent_map);
-	hash_map_destroy(&simulation_islands_map);
-	return simulation_islands;
+	// Pairs that ended in this frame might split their island
+	const u32* ended_slots = pair_cache_get_ended_slots();
+	for (u32 i = 0; i < array_length(ended_slots); ++i) {
+		const Cached_Pair* pair = pair_cache_get_pair(ended_slots[i]);
+		island_flag_removed_edge(pair->e1_id, pair->e2_id);
+	}
+
+	// Touching entities are merged into the same island
+	for (u32 i = 0; i < num_collision_pairs; ++i) {
+		Entity* e1 = entities[collision_pairs[i].e1_idx];
+		Entity* e2 = entities[collision_pairs[i].e2_idx];
+		if (!e1->fixed && !e2->fixed) {
+			island_merge(e1, e2);
+		}
+	}
+
+	// Extra step: To avoid bugs, we need to make sure that entities that are part of a same constraint are also part of the same island!
+	// Constraints don't have an identity, so if the constraints changed since the last frame, all previous constraints
+	// are considered removed.
+	boolean constraints_changed = array_length(island_manager.constraint_entities) != 2 * num_constraints;
+	for (u32 i = 0; !constraints_changed && i < num_constraints; ++i) {
+		constraints_changed = island_manager.constraint_entities[2 * i] != constraints[i].e1_id ||
+			island_manager.constraint_entities[2 * i + 1] != constraints[i].e2_id;
+	}
+
+	if (constraints_changed) {
+		for (u32 i = 0; i < array_length(island_manager.constraint_entities); i += 2) {
+			island_flag_removed_edge(island_manager.constraint_entities[i], island_manager.constraint_entities[i + 1]);
+		}
+
+		array_clear(island_manager.constraint_entities);
+		for (u32 i = 0; i < num_constraints; ++i) {
+			array_push(island_manager.constraint_entities, constraints[i].e1_id);
+			array_push(island_manager.constraint_entities, constraints[i].e2_id);
+		}
+	}
+
+	// The entities of the constraints are also needed to partition the constraints later
+	Entity** constraint_entities = simulation_islands->constraint_entities;
+	array_clear(constraint_entities);
+	for (u32 i = 0; i < num_constraints; ++i) {
+		Entity* e1 = entity_get_by_id(constraints[i].e1_id);
+		Entity* e2 = entity_get_by_id(constraints[i].e2_id);
+		array_push(constraint_entities, e1);
+		array_push(constraint_entities, e2);
+		if (!e1->fixed && !e2->fixed) {
+			island_merge(e1, e2);
+		}
+	}
+	simulation_islands->constraint_entities = constraint_entities;
+
+	// Lazy split: only the biggest awake island and the biggest sleeping island that might be split are rebuilt in each
+	// frame. Sleeping islands are split too, otherwise piles that got apart before falling asleep would still wake
+	// each other up.
+	u32 island_to_split = ENTITY_NO_ISLAND;
+	u32 sleeping_island_to_split = ENTITY_NO_ISLAND;
+	for (u32 i = 0; i < array_length(island_manager.islands); ++i) {
+		Simulation_Island* island = &island_manager.islands[i];
+		if (!island->in_use || island->num_removed_edges == 0) {
+			continue;
+		}
+
+		u32* candidate = island->sleeping ? &sleeping_island_to_split : &island_to_split;
+		if (*candidate == ENTITY_NO_ISLAND || island->num_seen_entities > island_manager.islands[*candidate].num_seen_entities) {
+			*candidate = i;
+		}
+	}
+
+	if (island_to_split != ENTITY_NO_ISLAND) {
+		island_split(island_to_split, entities, collision_pairs, constraints);
+	}
+	if (sleeping_island_to_split != ENTITY_NO_ISLAND) {
+		island_split(sleeping_island_to_split, entities, collision_pairs, constraints);
+	}
+
+	// Output the awake islands in CSR form. Islands are numbered in the order of their first entity and keep the
+	// entities in the same order as 'entities'.
+	u32 num_islands = 0;
+	u32 num_sleeping_islands = 0;
+	for (u32 i = 0; i < array_length(island_manager.islands); ++i) {
+		Simulation_Island* island = &island_manager.islands[i];
+		island->output_idx = BROAD_NO_SIMULATION_ISLAND;
+		if (island->in_use) {
+			++num_islands;
+			if (island->sleeping) {
+				++num_sleeping_islands;
+			}
+		}
+	}
+
+	u32 num_output_islands = 0;
+	u32* entity_to_island = simulation_islands->entity_to_island;
+	array_clear(entity_to_island);
+	array_allocate(entity_to_island, num_entities);
+	array_length(entity_to_island) = num_entities;
+	array_clear(simulation_islands->island_ids);
+	for (u32 i = 0; i < num_entities; ++i) {
+		Entity* e = entities[i];
+		if (e->fixed || island_manager.islands[e->island_id].sleeping) {
+			entity_to_island[i] = BROAD_NO_SIMULATION_ISLAND;
+			continue;
+		}
+
+		Simulation_Island* island = &island_manager.islands[e->island_id];
+		if (island->output_idx == BROAD_NO_SIMULATION_ISLAND) {
+			island->output_idx = num_output_islands++;
+			array_push(simulation_islands->island_ids, e->island_id);
+		}
+		entity_to_island[i] = island->output_idx;
+	}
+	simulation_islands->entity_to_island = entity_to_island;
+
+	// The union-find is not needed anymore, so its arrays are reused: 'uf_parent' as the write cursor of each island
+	// and 'uf_rank' to store the island of each pair/constraint
+	array_allocate(uf_parent, num_output_islands);
+	array_allocate(uf_rank, MAX(num_collision_pairs, num_constraints));
+	u32* cursor = uf_parent;
+	u32* item_to_island = uf_rank;
+
+	csr_partition(entity_to_island, num_entities, num_output_islands, cursor, &simulation_islands->offsets,
+		&simulation_islands->entities);
+
+	for (u32 i = 0; i < num_collision_pairs; ++i) {
+		item_to_island[i] = get_output_island_of_pair(entities[collision_pairs[i].e1_idx], entities[collision_pairs[i].e2_idx]);
+	}
+	csr_partition(item_to_island, num_collision_pairs, num_output_islands, cursor,
+		&simulation_islands->collision_pair_offsets, &simulation_islands->collision_pairs);
+
+	for (u32 i = 0; i < num_constraints; ++i) {
+		item_to_island[i] = get_output_island_of_pair(constraint_entities[2 * i], constraint_entities[2 * i + 1]);
+	}
+	csr_partition(item_to_island, num_constraints, num_output_islands, cursor,
+		&simulation_islands->constraint_offsets, &simulation_islands->constraints);
+
+	broad_statistics.num_islands = num_islands;
+	broad_statistics.num_sleeping_islands = num_sleeping_islands;
 }
 
-void broad_simulation_islands_destroy(eid** simulation_islands) {
-	for (u32 i = 0; i < array_length(simulation_islands); ++i) {
-		eid* simulation_island = simulation_islands[i];
-		array_free(simulation_island);
+// Puts an awake island to sleep: its entities are deactivated, and the island is left out of the output until
+// it's woken up
+void broad_simulation_islands_put_to_sleep(Broad_Simulation_Islands* simulation_islands, Entity** entities, u32 island) {
+	for (u32 i = simulation_islands->offsets[island]; i < simulation_islands->offsets[island + 1]; ++i) {
+		entities[simulation_islands->entities[i]]->active = false;
 	}
+	island_manager.islands[simulation_islands->island_ids[island]].sleeping = true;
+}
+
+u32 broad_simulation_islands_get_count(const Broad_Simulation_Islands* simulation_islands) {
+	return simulation_islands->offsets ? array_length(simulation_islands->offsets) - 1 : 0;
+}
 
-	array_free(simulation_islands);
-}
\ No newline at end of file
+void broad_simulation_islands_destroy(Broad_Simulation_Islands* simulation_islands) {
+	if (simulation_islands->offsets) {
+		array_free(simulation_islands->offsets);
+		array_free(simulation_islands->entities);
+		array_free(simulation_islands->entity_to_island);
+		array_free(simulation_islands->island_ids);
+		array_free(simulation_islands->collision_pair_offsets);
+		array_free(simulation_islands->collision_pairs);
+		array_free(simulation_islands->constraint_offsets);
+		array_free(simulation_islands->constraints);
+		array_free(simulation_islands->constraint_entities);
+	}
+
+	*simulation_islands = (Broad_Simulation_Islands){0};
+}
@@ -2,14 +2,73 @@
 #define RAW_PHYSICS_PHYSICS_BROAD_H
 #include "../render/graphics.h"
 #include "pbd.h"
+#include "bvh.h"
 
 typedef struct {
 	eid e1_id;
 	eid e2_id;
+	u32 e1_idx; // index of e1 in the entities array passed to the broad phase
+	u32 e2_idx;
 } Broad_Collision_Pair;
 
-Broad_Collision_Pair* broad_get_collision_pairs(Entity** entities);
-eid** broad_collect_simulation_islands(Entity** entities, Broad_Collision_Pair* collision_pairs, const Constraint* constraints);
-void broad_simulation_islands_destroy(eid** simulation_islands);
+#define BROAD_NO_SIMULATION_ISLAND ((u32)-1)
 
-#endif
\ No newline at end of file
+// Awake simulation islands in CSR form: the island 'i' is formed by the entities
+// 'entities[offsets[i]]' to 'entities[offsets[i + 1] - 1]'. All values are indexes into the entities array.
+// The collision pairs and constraints of each island are stored in the same way, as indexes into the arrays
+// passed to 'broad_collect_simulation_islands'.
+typedef struct {
+	u32* offsets;
+	u32* entities;
+	u32* entity_to_island; // island of each entity, BROAD_NO_SIMULATION_ISLAND for fixed and sleeping entities
+	u32* island_ids;       // persistent id of each island
+
+	u32* collision_pair_offsets;
+	u32* collision_pairs;
+	u32* constraint_offsets;
+	u32* constraints;      // constraints between two fixed entities don't belong to any island
+
+	Entity** constraint_entities;
+} Broad_Simulation_Islands;
+
+typedef enum {
+	BROAD_PHASE_METHOD_ALL_PAIRS,
+	BROAD_PHASE_METHOD_SWEEP_AND_PRUNE,
+	BROAD_PHASE_METHOD_BVH,
+	BROAD_PHASE_METHOD_GRID,
+	BROAD_PHASE_METHOD_END
+} Broad_Phase_Method;
+
+typedef struct {
+	Broad_Phase_Method method;
+	u32 num_entities;
+	u32 num_static_entities;  // fixed entities, kept in the static scene
+	u32 num_pairs;
+	u32 num_candidate_pairs;  // pairs whose bounds overlapped
+	u32 num_culled_pairs;     // candidate pairs discarded by the swept bounding sphere test
+	u32 num_filtered_pairs;   // candidate pairs discarded by the collision filters
+	r64 elapsed_time; // in seconds
+	u32 num_islands;
+	u32 num_sleeping_islands;
+	u32 num_island_splits;    // islands rebuilt in the last frame
+} Broad_Statistics;
+
+void broad_set_method(Broad_Phase_Method method);
+Broad_Phase_Method broad_get_method();
+const char* broad_get_method_name(Broad_Phase_Method method);
+Broad_Statistics broad_get_statistics();
+void broad_set_grid_cell_size(r64 cell_size);
+const Bvh* broad_bvh_get_tree();
+eid broad_bvh_get_entity_id(u64 leaf_user_data);
+const Bvh* broad_get_static_tree();
+eid broad_static_get_entity_id(u64 leaf_user_data);
+boolean broad_static_scene_was_rebuilt();
+
+Broad_Collision_Pair* broad_get_collision_pairs(Entity** entities, const Constraint* constraints, r64 dt);
+void broad_collect_simulation_islands(Entity** entities, Broad_Collision_Pair* collision_pairs, const Constraint* constraints,
+	Broad_Simulation_Islands* simulation_islands);
+void broad_simulation_islands_put_to_sleep(Broad_Simulation_Islands* simulation_islands, Entity** entities, u32 island);
+u32 broad_simulation_islands_get_count(const Broad_Simulation_Islands* simulation_islands);
+void broad_simulation_islands_destroy(Broad_Simulation_Islands* simulation_islands);
+
+#endif
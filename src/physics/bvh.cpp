@@ -0,0 +1,419 @@
+#include "bvh.h"
+#include <light_array.h>
+#include <float.h>
+#include <math.h>
+
+#define BVH_QUERY_STACK_SIZE 256
+
+void bvh_create(Bvh* bvh) {
+	bvh->nodes = array_new_len(Bvh_Node, 64);
+	bvh->root = BVH_NULL_NODE;
+	bvh->free_list = BVH_NULL_NODE;
+	bvh->num_leaves = 0;
+}
+
+void bvh_destroy(Bvh* bvh) {
+	array_free(bvh->nodes);
+}
+
+void bvh_clear(Bvh* bvh) {
+	array_clear(bvh->nodes);
+	bvh->root = BVH_NULL_NODE;
+	bvh->free_list = BVH_NULL_NODE;
+	bvh->num_leaves = 0;
+}
+
+static s32 node_allocate(Bvh* bvh) {
+	s32 node_idx;
+	if (bvh->free_list != BVH_NULL_NODE) {
+		node_idx = bvh->free_list;
+		bvh->free_list = bvh->nodes[node_idx].parent;
+	} else {
+		Bvh_Node new_node = {0};
+		node_idx = array_length(bvh->nodes);
+		array_push(bvh->nodes, new_node);
+	}
+
+	Bvh_Node* node = &bvh->nodes[node_idx];
+	node->parent = BVH_NULL_NODE;
+	node->left = BVH_NULL_NODE;
+	node->right = BVH_NULL_NODE;
+	node->height = 0;
+	node->user_data = 0;
+	return node_idx;
+}
+
+static void node_free(Bvh* bvh, s32 node_idx) {
+	Bvh_Node* node = &bvh->nodes[node_idx];
+	node->parent = bvh->free_list;
+	node->height = -1;
+	bvh->free_list = node_idx;
+}
+
+static boolean node_is_leaf(const Bvh_Node* node) {
+	return node->left == BVH_NULL_NODE;
+}
+
+// Performs a left or right rotation if the subtree rooted at 'a' is imbalanced.
+// Returns the new root of the subtree.
+// Based on Box2D's b2DynamicTree
+static s32 balance(Bvh* bvh, s32 a_idx) {
+	Bvh_Node* a = &bvh->nodes[a_idx];
+	if (node_is_leaf(a) || a->height < 2) {
+		return a_idx;
+	}
+
+	s32 b_idx = a->left;
+	s32 c_idx = a->right;
+	Bvh_Node* b = &bvh->nodes[b_idx];
+	Bvh_Node* c = &bvh->nodes[c_idx];
+
+	s32 balance_factor = c->height - b->height;
+
+	// Rotate C up
+	if (balance_factor > 1) {
+		s32 f_idx = c->left;
+		s32 g_idx = c->right;
+		Bvh_Node* f = &bvh->nodes[f_idx];
+		Bvh_Node* g = &bvh->nodes[g_idx];
+
+		// Swap A and C
+		c->left = a_idx;
+		c->parent = a->parent;
+		a->parent = c_idx;
+
+		// A's old parent should point to C
+		if (c->parent != BVH_NULL_NODE) {
+			if (bvh->nodes[c->parent].left == a_idx) {
+				bvh->nodes[c->parent].left = c_idx;
+			} else {
+				bvh->nodes[c->parent].right = c_idx;
+			}
+		} else {
+			bvh->root = c_idx;
+		}
+
+		// Rotate
+		if (f->height > g->height) {
+			c->right = f_idx;
+			a->right = g_idx;
+			g->parent = a_idx;
+			a->aabb = collider_aabb_merge(&b->aabb, &g->aabb);
+			c->aabb = collider_aabb_merge(&a->aabb, &f->aabb);
+			a->height = 1 + MAX(b->height, g->height);
+			c->height = 1 + MAX(a->height, f->height);
+		} else {
+			c->right = g_idx;
+			a->right = f_idx;
+			f->parent = a_idx;
+			a->aabb = collider_aabb_merge(&b->aabb, &f->aabb);
+			c->aabb = collider_aabb_merge(&a->aabb, &g->aabb);
+			a->height = 1 + MAX(b->height, f->height);
+			c->height = 1 + MAX(a->height, g->height);
+		}
+
+		return c_idx;
+	}
+
+	// Rotate B up
+	if (balance_factor < -1) {
+		s32 d_idx = b->left;
+		s32 e_idx = b->right;
+		Bvh_Node* d = &bvh->nodes[d_idx];
+		Bvh_Node* e = &bvh->nodes[e_idx];
+
+		// Swap A and B
+		b->left = a_idx;
+		b->parent = a->parent;
+		a->parent = b_idx;
+
+		// A's old parent should point to B
+		if (b->parent != BVH_NULL_NODE) {
+			if (bvh->nodes[b->parent].left == a_idx) {
+				bvh->nodes[b->parent].left = b_idx;
+			} else {
+				bvh->nodes[b->parent].right = b_idx;
+			}
+		} else {
+			bvh->root = b_idx;
+		}
+
+		// Rotate
+		if (d->height > e->height) {
+			b->right = d_idx;
+			a->left = e_idx;
+			e->parent = a_idx;
+			a->aabb = collider_aabb_merge(&c->aabb, &e->aabb);
+			b->aabb = collider_aabb_merge(&a->aabb, &d->aabb);
+			a->height = 1 + MAX(c->height, e->height);
+			b->height = 1 + MAX(a->height, d->height);
+		} else {
+			b->right = e_idx;
+			a->left = d_idx;
+			d->parent = a_idx;
+			a->aabb = collider_aabb_merge(&c->aabb, &d->aabb);
+			b->aabb = collider_aabb_merge(&a->aabb, &e->aabb);
+			a->height = 1 + MAX(c->height, d->height);
+			b->height = 1 + MAX(a->height, e->height);
+		}
+
+		return b_idx;
+	}
+
+	return a_idx;
+}
+
+// Walk back up the tree fixing heights and AABBs, balancing the tree on the way
+static void refit_ancestors(Bvh* bvh, s32 node_idx) {
+	while (node_idx != BVH_NULL_NODE) {
+		node_idx = balance(bvh, node_idx);
+
+		Bvh_Node* node = &bvh->nodes[node_idx];
+		const Bvh_Node* left = &bvh->nodes[node->left];
+		const Bvh_Node* right = &bvh->nodes[node->right];
+		node->height = 1 + MAX(left->height, right->height);
+		node->aabb = collider_aabb_merge(&left->aabb, &right->aabb);
+
+		node_idx = node->parent;
+	}
+}
+
+static void insert_leaf(Bvh* bvh, s32 leaf_idx) {
+	if (bvh->root == BVH_NULL_NODE) {
+		bvh->root = leaf_idx;
+		bvh->nodes[leaf_idx].parent = BVH_NULL_NODE;
+		return;
+	}
+
+	// Find the best sibling for the new leaf, using the surface area heuristic
+	Collider_AABB leaf_aabb = bvh->nodes[leaf_idx].aabb;
+	s32 sibling_idx = bvh->root;
+	while (!node_is_leaf(&bvh->nodes[sibling_idx])) {
+		const Bvh_Node* node = &bvh->nodes[sibling_idx];
+		const Bvh_Node* left = &bvh->nodes[node->left];
+		const Bvh_Node* right = &bvh->nodes[node->right];
+
+		r64 area = collider_aabb_get_surface_area(&node->aabb);
+		Collider_AABB combined_aabb = collider_aabb_merge(&node->aabb, &leaf_aabb);
+		r64 combined_area = collider_aabb_get_surface_area(&combined_aabb);
+
+		// Cost of creating a new parent for this node and the new leaf
+		r64 cost = 2.0 * combined_area;
+
+		// Minimum cost of pushing the leaf further down the tree
+		r64 inheritance_cost = 2.0 * (combined_area - area);
+
+		Collider_AABB left_combined_aabb = collider_aabb_merge(&left->aabb, &leaf_aabb);
+		r64 left_cost = collider_aabb_get_surface_area(&left_combined_aabb) + inheritance_cost;
+		if (!node_is_leaf(left)) {
+			left_cost -= collider_aabb_get_surface_area(&left->aabb);
+		}
+
+		Collider_AABB right_combined_aabb = collider_aabb_merge(&right->aabb, &leaf_aabb);
+		r64 right_cost = collider_aabb_get_surface_area(&right_combined_aabb) + inheritance_cost;
+		if (!node_is_leaf(right)) {
+			right_cost -= collider_aabb_get_surface_area(&right->aabb);
+		}
+
+		if (cost < left_cost && cost < right_cost) {
+			break;
+		}
+
+		sibling_idx = left_cost < right_cost ? node->left : node->right;
+	}
+
+	// Create a new parent for the sibling and the new leaf
+	s32 old_parent_idx = bvh->nodes[sibling_idx].parent;
+	s32 new_parent_idx = node_allocate(bvh);
+	Bvh_Node* new_parent = &bvh->nodes[new_parent_idx];
+	new_parent->parent = old_parent_idx;
+	new_parent->aabb = collider_aabb_merge(&leaf_aabb, &bvh->nodes[sibling_idx].aabb);
+	new_parent->height = bvh->nodes[sibling_idx].height + 1;
+	new_parent->left = sibling_idx;
+	new_parent->right = leaf_idx;
+	bvh->nodes[sibling_idx].parent = new_parent_idx;
+	bvh->nodes[leaf_idx].parent = new_parent_idx;
+
+	if (old_parent_idx != BVH_NULL_NODE) {
+		if (bvh->nodes[old_parent_idx].left == sibling_idx) {
+			bvh->nodes[old_parent_idx].left = new_parent_idx;
+		} else {
+			bvh->nodes[old_parent_idx].right = new_parent_idx;
+		}
+	} else {
+		bvh->root = new_parent_idx;
+	}
+
+	refit_ancestors(bvh, old_parent_idx);
+}
+
+static void remove_leaf(Bvh* bvh, s32 leaf_idx) {
+	if (leaf_idx == bvh->root) {
+		bvh->root = BVH_NULL_NODE;
+		return;
+	}
+
+	s32 parent_idx = bvh->nodes[leaf_idx].parent;
+	s32 grand_parent_idx = bvh->nodes[parent_idx].parent;
+	s32 sibling_idx = bvh->nodes[parent_idx].left == leaf_idx ? bvh->nodes[parent_idx].right : bvh->nodes[parent_idx].left;
+
+	// The sibling takes the place of the parent
+	if (grand_parent_idx != BVH_NULL_NODE) {
+		if (bvh->nodes[grand_parent_idx].left == parent_idx) {
+			bvh->nodes[grand_parent_idx].left = sibling_idx;
+		} else {
+			bvh->nodes[grand_parent_idx].right = sibling_idx;
+		}
+		bvh->nodes[sibling_idx].parent = grand_parent_idx;
+		node_free(bvh, parent_idx);
+		refit_ancestors(bvh, grand_parent_idx);
+	} else {
+		bvh->root = sibling_idx;
+		bvh->nodes[sibling_idx].parent = BVH_NULL_NODE;
+		node_free(bvh, parent_idx);
+	}
+}
+
+// Inserts a new leaf in the tree. The stored AABB is 'aabb' enlarged by 'margin'.
+// Returns the leaf id, which must be used to move/remove the leaf later.
+s32 bvh_insert(Bvh* bvh, Collider_AABB aabb, r64 margin, u64 user_data) {
+	s32 leaf_idx = node_allocate(bvh);
+	bvh->nodes[leaf_idx].aabb = collider_aabb_expand(&aabb, margin);
+	bvh->nodes[leaf_idx].user_data = user_data;
+	insert_leaf(bvh, leaf_idx);
+	++bvh->num_leaves;
+	return leaf_idx;
+}
+
+void bvh_remove(Bvh* bvh, s32 leaf) {
+	assert(node_is_leaf(&bvh->nodes[leaf]));
+	remove_leaf(bvh, leaf);
+	node_free(bvh, leaf);
+	--bvh->num_leaves;
+}
+
+// Updates the AABB of a leaf. The leaf is only reinserted if 'aabb' is not contained in its fat AABB anymore.
+// Returns true if the leaf was reinserted.
+boolean bvh_move(Bvh* bvh, s32 leaf, Collider_AABB aabb, r64 margin) {
+	assert(node_is_leaf(&bvh->nodes[leaf]));
+	if (collider_aabb_contains(&bvh->nodes[leaf].aabb, &aabb)) {
+		return false;
+	}
+
+	remove_leaf(bvh, leaf);
+	bvh->nodes[leaf].aabb = collider_aabb_expand(&aabb, margin);
+	insert_leaf(bvh, leaf);
+	return true;
+}
+
+Collider_AABB bvh_get_fat_aabb(const Bvh* bvh, s32 leaf) {
+	return bvh->nodes[leaf].aabb;
+}
+
+u64 bvh_get_user_data(const Bvh* bvh, s32 leaf) {
+	return bvh->nodes[leaf].user_data;
+}
+
+s32 bvh_get_height(const Bvh* bvh) {
+	if (bvh->root == BVH_NULL_NODE) {
+		return 0;
+	}
+
+	return bvh->nodes[bvh->root].height;
+}
+
+// Calls 'callback' for every leaf whose fat AABB overlaps 'aabb'
+void bvh_query_aabb(const Bvh* bvh, Collider_AABB aabb, Bvh_Query_Callback callback, void* ctx) {
+	s32 stack[BVH_QUERY_STACK_SIZE];
+	u32 stack_size = 0;
+
+	if (bvh->root == BVH_NULL_NODE) {
+		return;
+	}
+
+	stack[stack_size++] = bvh->root;
+	while (stack_size > 0) {
+		s32 node_idx = stack[--stack_size];
+		const Bvh_Node* node = &bvh->nodes[node_idx];
+
+		if (!collider_aabb_overlaps(&node->aabb, &aabb)) {
+			continue;
+		}
+
+		if (node_is_leaf(node)) {
+			if (!callback(node_idx, node->user_data, ctx)) {
+				return;
+			}
+		} else {
+			assert(stack_size + 2 <= BVH_QUERY_STACK_SIZE);
+			stack[stack_size++] = node->left;
+			stack[stack_size++] = node->right;
+		}
+	}
+}
+
+// Slab test. Returns true if the ray hits the AABB in the interval [0, max_t]
+// Axes in which the ray doesn't move have a zero 'inverse_direction', they only check that the origin is in the slab.
+static boolean ray_hits_aabb(vec3 origin, vec3 direction, vec3 inverse_direction, r64 max_t, const Collider_AABB* aabb) {
+	r64 t_min = 0.0;
+	r64 t_max = max_t;
+
+	r64 o[3] = {origin.x, origin.y, origin.z};
+	r64 d[3] = {direction.x, direction.y, direction.z};
+	r64 inv_d[3] = {inverse_direction.x, inverse_direction.y, inverse_direction.z};
+	r64 mins[3] = {aabb->min.x, aabb->min.y, aabb->min.z};
+	r64 maxs[3] = {aabb->max.x, aabb->max.y, aabb->max.z};
+
+	for (u32 i = 0; i < 3; ++i) {
+		if (d[i] == 0.0) {
+			if (o[i] < mins[i] || o[i] > maxs[i]) {
+				return false;
+			}
+			continue;
+		}
+
+		r64 t1 = (mins[i] - o[i]) * inv_d[i];
+		r64 t2 = (maxs[i] - o[i]) * inv_d[i];
+		t_min = MAX(t_min, MIN(t1, t2));
+		t_max = MIN(t_max, MAX(t1, t2));
+	}
+
+	return t_min <= t_max;
+}
+
+// Calls 'callback' for every leaf whose fat AABB is hit by the ray 'origin + t * direction', t in [0, max_t]
+void bvh_query_ray(const Bvh* bvh, vec3 origin, vec3 direction, r64 max_t, Bvh_Query_Callback callback, void* ctx) {
+	s32 stack[BVH_QUERY_STACK_SIZE];
+	u32 stack_size = 0;
+
+	if (bvh->root == BVH_NULL_NODE) {
+		return;
+	}
+
+	// With -ffast-math, infinities can't be relied upon in the slab test, so parallel axes are handled separately
+	vec3 inverse_direction = (vec3){
+		direction.x != 0.0 ? 1.0 / direction.x : 0.0,
+		direction.y != 0.0 ? 1.0 / direction.y : 0.0,
+		direction.z != 0.0 ? 1.0 / direction.z : 0.0
+	};
+
+	stack[stack_size++] = bvh->root;
+	while (stack_size > 0) {
+		s32 node_idx = stack[--stack_size];
+		const Bvh_Node* node = &bvh->nodes[node_idx];
+
+		if (!ray_hits_aabb(origin, direction, inverse_direction, max_t, &node->aabb)) {
+			continue;
+		}
+
+		if (node_is_leaf(node)) {
+			if (!callback(node_idx, node->user_data, ctx)) {
+				return;
+			}
+		} else {
+			assert(stack_size + 2 <= BVH_QUERY_STACK_SIZE);
+			stack[stack_size++] = node->left;
+			stack[stack_size++] = node->right;
+		}
+	}
+}
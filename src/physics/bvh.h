@@ -0,0 +1,44 @@
+#ifndef RAW_PHYSICS_PHYSICS_BVH_H
+#define RAW_PHYSICS_PHYSICS_BVH_H
+#include <common.h>
+#include <gm.h>
+#include "collider.h"
+
+#define BVH_NULL_NODE (-1)
+
+typedef struct {
+	Collider_AABB aabb;
+	u64 user_data;
+	s32 parent;      // when the node is free, this is the next node of the free list
+	s32 left;        // BVH_NULL_NODE if the node is a leaf
+	s32 right;
+	s32 height;      // 0 for leaves, -1 for free nodes
+} Bvh_Node;
+
+// Dynamic AABB tree.
+// Leaves hold "fat" AABBs, i.e. AABBs that are a bit larger than the objects they represent. This way, leaves only
+// need to be reinserted when the object leaves its fat AABB, instead of every time it moves.
+// The tree is kept balanced using rotations whenever a node is inserted or removed.
+typedef struct {
+	Bvh_Node* nodes;
+	s32 root;
+	s32 free_list;
+	u32 num_leaves;
+} Bvh;
+
+// Return false to stop the query
+typedef boolean (*Bvh_Query_Callback)(s32 leaf, u64 user_data, void* ctx);
+
+void bvh_create(Bvh* bvh);
+void bvh_destroy(Bvh* bvh);
+void bvh_clear(Bvh* bvh);
+s32 bvh_insert(Bvh* bvh, Collider_AABB aabb, r64 margin, u64 user_data);
+void bvh_remove(Bvh* bvh, s32 leaf);
+boolean bvh_move(Bvh* bvh, s32 leaf, Collider_AABB aabb, r64 margin);
+Collider_AABB bvh_get_fat_aabb(const Bvh* bvh, s32 leaf);
+u64 bvh_get_user_data(const Bvh* bvh, s32 leaf);
+s32 bvh_get_height(const Bvh* bvh);
+void bvh_query_aabb(const Bvh* bvh, Collider_AABB aabb, Bvh_Query_Callback callback, void* ctx);
+void bvh_query_ray(const Bvh* bvh, vec3 origin, vec3 direction, r64 max_t, Bvh_Query_Callback callback, void* ctx);
+
+#endif
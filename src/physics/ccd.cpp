@@ -0,0 +1,198 @@
+#include "ccd.h"
+#include <light_array.h>
+#include <float.h>
+#include <math.h>
+#include "gjk.h"
+#include "clipping.h"
+#include "physics_util.h"
+#include "../thread_pool.h"
+
+// Continuous collision detection by conservative advancement (Mirtich)
+// The entities are moved along their current velocities by the largest time step that can't make them touch: the
+// distance between them divided by a bound of how fast they can approach each other. The bound is the relative linear
+// velocity along the closest points, plus the speed of the farthest point of each entity due to its rotation. This is
+// repeated until the entities are closer than CCD_DISTANCE_TOLERANCE (the time of impact), or the end of the step is
+// reached. External forces are ignored, they barely change the path of a fast entity within a single step.
+
+// Entities closer than this are in contact
+#define CCD_DISTANCE_TOLERANCE 0.01
+// Points of the contact manifold at the time of impact that are this close are part of the contact
+#define CCD_CLIPPING_MARGIN (2.0 * CCD_DISTANCE_TOLERANCE)
+#define CCD_MAX_ITERATIONS 32
+
+// One slot per worker thread, each in its own cache line, so that the workers never write to the same memory
+static struct {
+	alignas(64) u64 num_calls;
+	u64 num_iterations;
+	u64 num_impacts;
+} ccd_statistics[THREAD_POOL_MAX_THREADS];
+
+// Distance between the colliders of both entities, in their current poses. The closest colliders are also returned.
+static r64 get_entities_distance(Entity* e1, Entity* e2, vec3* closest_point1, vec3* closest_point2, u32* collider1_idx,
+	u32* collider2_idx) {
+	r64 min_distance = DBL_MAX;
+	for (u32 i = 0; i < array_length(e1->colliders); ++i) {
+		for (u32 j = 0; j < array_length(e2->colliders); ++j) {
+			vec3 point1, point2;
+			r64 distance = gjk_get_distance(&e1->colliders[i], &e2->colliders[j], &point1, &point2);
+			if (distance < min_distance) {
+				min_distance = distance;
+				*closest_point1 = point1;
+				*closest_point2 = point2;
+				*collider1_idx = i;
+				*collider2_idx = j;
+			}
+		}
+	}
+	return min_distance;
+}
+
+// Moves the entity to where it will be 't' seconds after 'position' and 'rotation'. Fixed and inactive entities don't
+// move during the step. The colliders of fixed entities are shared by all islands, so they are never touched here.
+static void move_entity(Entity* e, vec3 position, Quaternion rotation, r64 t) {
+	if (e->fixed) {
+		return;
+	}
+
+	e->world_position = position;
+	e->world_rotation = rotation;
+	if (e->active) {
+		predict_entity_pose(e, t);
+	}
+	colliders_update(e->colliders, e->world_position, &e->world_rotation);
+}
+
+static vec3 get_entity_linear_velocity(const Entity* e) {
+	return (e->fixed || !e->active) ? (vec3){0.0, 0.0, 0.0} : e->linear_velocity;
+}
+
+static r64 get_entity_angular_speed(const Entity* e) {
+	return (e->fixed || !e->active) ? 0.0 : gm_vec3_length(e->angular_velocity);
+}
+
+// Looks for the first time within the next 'dt' seconds at which both entities touch (entities that already overlap
+// get the contacts of their current poses). The contacts found at that time are returned with their points moved back
+// to the current poses of the entities, so that they can be handled like any other contact: they only push the entities
+// apart once they reach each other. Returns NULL if there is no impact.
+Collider_Contact* ccd_get_contacts(Entity* e1, Entity* e2, r64 dt) {
+	u32 worker = thread_pool_get_current_worker();
+	++ccd_statistics[worker].num_calls;
+
+	vec3 position1 = e1->world_position;
+	vec3 position2 = e2->world_position;
+	Quaternion rotation1 = e1->world_rotation;
+	Quaternion rotation2 = e2->world_rotation;
+	move_entity(e1, position1, rotation1, 0.0);
+	move_entity(e2, position2, rotation2, 0.0);
+
+	vec3 p1, p2;
+	u32 collider1_idx, collider2_idx;
+	r64 distance = get_entities_distance(e1, e2, &p1, &p2, &collider1_idx, &collider2_idx);
+	u32 num_iterations = 1;
+	if (distance == 0.0) {
+		// Already overlapping. The narrow phase of the substeps only sees the entities after they move, when a fast
+		// entity may already be past the middle of the other one, so the contacts are taken from the current poses.
+		ccd_statistics[worker].num_iterations += num_iterations;
+		Collider_Contact* contacts = colliders_get_contacts(e1->colliders, e2->colliders, 0.0);
+		if (contacts && array_length(contacts) == 0) {
+			array_free(contacts);
+			contacts = NULL;
+		}
+		if (contacts) {
+			++ccd_statistics[worker].num_impacts;
+		}
+		return contacts;
+	}
+
+	vec3 relative_velocity = gm_vec3_subtract(get_entity_linear_velocity(e1), get_entity_linear_velocity(e2));
+	r64 angular_bound = get_entity_angular_speed(e1) * e1->bounding_sphere_radius +
+		get_entity_angular_speed(e2) * e2->bounding_sphere_radius;
+
+	// Entities that already touch still get the contacts, since the narrow phase only sees them after the next substep
+	boolean hit = distance <= CCD_DISTANCE_TOLERANCE;
+	r64 t = 0.0;
+	vec3 normal = gm_vec3_normalize(gm_vec3_subtract(p2, p1));
+	while (!hit && num_iterations < CCD_MAX_ITERATIONS) {
+		r64 approach_bound = gm_vec3_dot(relative_velocity, normal) + angular_bound;
+		if (approach_bound <= 0.0) {
+			// The entities move away from each other
+			break;
+		}
+
+		t += distance / approach_bound;
+		if (t >= dt) {
+			break;
+		}
+
+		move_entity(e1, position1, rotation1, t);
+		move_entity(e2, position2, rotation2, t);
+
+		vec3 new_p1, new_p2;
+		u32 new_collider1_idx, new_collider2_idx;
+		distance = get_entities_distance(e1, e2, &new_p1, &new_p2, &new_collider1_idx, &new_collider2_idx);
+		++num_iterations;
+
+		// At zero distance the closest points are not meaningful, the previous ones are kept
+		if (distance > 0.0) {
+			p1 = new_p1;
+			p2 = new_p2;
+			collider1_idx = new_collider1_idx;
+			collider2_idx = new_collider2_idx;
+			normal = gm_vec3_normalize(gm_vec3_subtract(p2, p1));
+		}
+
+		hit = distance <= CCD_DISTANCE_TOLERANCE;
+	}
+
+	Collider_Contact* contacts = NULL;
+	if (hit) {
+		// A single contact at the closest points would let a spinning entity pivot around it and cross the other one,
+		// so the whole manifold is clipped, with speculative contacts since the entities are still apart
+		contacts = array_new(Collider_Contact);
+		clipping_get_contact_manifold(&e1->colliders[collider1_idx], &e2->colliders[collider2_idx], normal, -distance,
+			CCD_CLIPPING_MARGIN, &contacts);
+
+		// Express the contact points relative to the poses at the time of impact, and bring them back to the current poses
+		Quaternion q1_inv = quaternion_inverse(&e1->world_rotation);
+		Quaternion q2_inv = quaternion_inverse(&e2->world_rotation);
+		for (u32 i = 0; i < array_length(contacts); ++i) {
+			Collider_Contact* contact = &contacts[i];
+			vec3 r1_lc = quaternion_apply_to_vec3(&q1_inv, gm_vec3_subtract(contact->collision_point1, e1->world_position));
+			vec3 r2_lc = quaternion_apply_to_vec3(&q2_inv, gm_vec3_subtract(contact->collision_point2, e2->world_position));
+			contact->collision_point1 = gm_vec3_add(position1, quaternion_apply_to_vec3(&rotation1, r1_lc));
+			contact->collision_point2 = gm_vec3_add(position2, quaternion_apply_to_vec3(&rotation2, r2_lc));
+		}
+
+		if (array_length(contacts) == 0) {
+			array_free(contacts);
+			contacts = NULL;
+		} else {
+			++ccd_statistics[worker].num_impacts;
+		}
+	}
+
+	move_entity(e1, position1, rotation1, 0.0);
+	move_entity(e2, position2, rotation2, 0.0);
+
+	ccd_statistics[worker].num_iterations += num_iterations;
+	return contacts;
+}
+
+// Counters since the last reset, added up over the worker threads. Must not be called while the simulation runs.
+CCD_Statistics ccd_get_statistics() {
+	CCD_Statistics statistics = {0};
+	for (u32 i = 0; i < THREAD_POOL_MAX_THREADS; ++i) {
+		statistics.num_calls += ccd_statistics[i].num_calls;
+		statistics.num_iterations += ccd_statistics[i].num_iterations;
+		statistics.num_impacts += ccd_statistics[i].num_impacts;
+	}
+	return statistics;
+}
+
+void ccd_reset_statistics() {
+	for (u32 i = 0; i < THREAD_POOL_MAX_THREADS; ++i) {
+		ccd_statistics[i].num_calls = 0;
+		ccd_statistics[i].num_iterations = 0;
+		ccd_statistics[i].num_impacts = 0;
+	}
+}
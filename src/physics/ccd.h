@@ -0,0 +1,15 @@
+#ifndef RAW_PHYSICS_PHYSICS_CCD_H
+#define RAW_PHYSICS_PHYSICS_CCD_H
+#include "../entity.h"
+
+typedef struct {
+	u64 num_calls;
+	u64 num_iterations; // distance queries, summed over all calls
+	u64 num_impacts;    // calls that found an impact within the step
+} CCD_Statistics;
+
+Collider_Contact* ccd_get_contacts(Entity* e1, Entity* e2, r64 dt);
+CCD_Statistics ccd_get_statistics();
+void ccd_reset_statistics();
+
+#endif
@@ -3,12 +3,47 @@
 #include <float.h>
 #include "gjk.h"
 #include "support.h"
+#include "../thread_pool.h"
 
 typedef struct {
 	vec3 normal;
 	vec3 point;
+	u32 feature_id; // used to tag the points that are created when clipping against this plane
 } Plane;
 
+// A vertex of the polygon being clipped, tagged with the features of the hull that generated it
+typedef struct {
+	vec3 position;
+	u32 feature_id;
+} Clip_Vertex;
+
+// Tags used to build the feature IDs, so that different kinds of features never produce the same ID
+#define FEATURE_TAG_INCIDENT_VERTEX 0x1u
+#define FEATURE_TAG_CLIPPED_EDGE 0x2u
+#define FEATURE_TAG_REFERENCE_FACE1 0x3u
+#define FEATURE_TAG_REFERENCE_FACE2 0x4u
+#define FEATURE_TAG_EDGES 0x5u
+
+// Maximum number of contacts of a face manifold, 0 keeps all of them
+static u32 max_contacts = CLIPPING_DEFAULT_MAX_CONTACTS;
+
+// One slot per worker thread, each in its own cache line, so that the workers never write to the same memory
+static struct {
+	alignas(64) u64 num_contacts;
+	u64 num_removed_contacts;
+	u64 num_speculative_contacts;
+} clipping_statistics[THREAD_POOL_MAX_THREADS];
+
+// Mixes two feature IDs into a new one. The result depends on the order of the arguments.
+u32 clipping_combine_feature_ids(u32 a, u32 b) {
+	u32 h = a * 0x9E3779B1u;
+	h ^= b + 0x7F4A7C15u + (h << 6) + (h >> 2);
+	h ^= h >> 15;
+	h *= 0x2C1B3C6Du;
+	h ^= h >> 12;
+	return h;
+}
+
 static boolean is_point_in_plane(const Plane* plane, vec3 position) {
 	float distance = -gm_vec3_dot(plane->normal, plane->point);
 	if (gm_vec3_dot(position, plane->normal) + distance < 0.0) {
@@ -48,16 +83,17 @@ static boolean plane_edge_intersection(const Plane* plane, const vec3 start, con
 
 // Clips the input polygon to the input clip planes
 // If remove_instead_of_clipping is true, vertices that are lying outside the clipping planes will be removed instead of clipped
+// Points created by cutting an edge are tagged with the features of the edge endpoints and of the clip plane
 // Based on https://research.ncl.ac.uk/game/mastersdegree/gametechnologies/previousinformation/physics5collisionmanifolds/
-static void sutherland_hodgman(vec3* input_polygon, int num_clip_planes, const Plane* clip_planes, vec3** out_polygon,
+static void sutherland_hodgman(Clip_Vertex* input_polygon, int num_clip_planes, const Plane* clip_planes, Clip_Vertex** out_polygon,
 	boolean remove_instead_of_clipping) {
 	assert(out_polygon != NULL);
 	assert(num_clip_planes > 0);
 
 	// Create temporary list of vertices
 	// We will keep ping-pong'ing between the two lists updating them as we go.
-	vec3* input = (vec3*)array_copy(input_polygon);
-	vec3* output = array_new_len(vec3, 4 * array_length(input_polygon));
+	Clip_Vertex* input = (Clip_Vertex*)array_copy(input_polygon);
+	Clip_Vertex* output = array_new_len(Clip_Vertex, 4 * array_length(input_polygon));
 
 	for (int i = 0; i < num_clip_planes; ++i) {
 		// If every single point has already been removed previously, just exit
@@ -68,11 +104,13 @@ static void sutherland_hodgman(vec3* input_polygon, int num_clip_planes, const P
 		const Plane* plane = &clip_planes[i];
 
 		// Loop through each edge of the polygon and clip that edge against the current plane.
-		vec3 temp_point, start_point = input[array_length(input) - 1];
+		Clip_Vertex temp_point, start_point = input[array_length(input) - 1];
 		for (u32 j = 0; j < array_length(input); ++j) {
-			vec3 end_point = input[j];
-			boolean start_in_plane = is_point_in_plane(plane, start_point);
-			boolean end_in_plane = is_point_in_plane(plane, end_point);
+			Clip_Vertex end_point = input[j];
+			boolean start_in_plane = is_point_in_plane(plane, start_point.position);
+			boolean end_in_plane = is_point_in_plane(plane, end_point.position);
+			temp_point.feature_id = clipping_combine_feature_ids(clipping_combine_feature_ids(FEATURE_TAG_CLIPPED_EDGE,
+				plane->feature_id), clipping_combine_feature_ids(start_point.feature_id, end_point.feature_id));
 
 			if (remove_instead_of_clipping) {
 				if (end_in_plane) {
@@ -85,11 +123,11 @@ static void sutherland_hodgman(vec3* input_polygon, int num_clip_planes, const P
 				}
 				// If the edge interesects the clipping plane, cut the edge along clip plane
 				else if (start_in_plane && !end_in_plane) {
-					if (plane_edge_intersection(plane, start_point, end_point, &temp_point)) {
+					if (plane_edge_intersection(plane, start_point.position, end_point.position, &temp_point.position)) {
 						array_push(output, temp_point);
 					}
 				} else if (!start_in_plane && end_in_plane) {
-					if (plane_edge_intersection(plane, start_point, end_point, &temp_point)) {
+					if (plane_edge_intersection(plane, start_point.position, end_point.position, &temp_point.position)) {
 						array_push(output, temp_point);
 					}
 
@@ -102,7 +140,7 @@ static void sutherland_hodgman(vec3* input_polygon, int num_clip_planes, const P
 		}
 
 		// Swap input/output polygons, and clear output list for us to generate afresh
-		vec3* tmp = input;
+		Clip_Vertex* tmp = input;
 		input = output;
 		output = tmp;
 		array_clear(output);
@@ -118,30 +156,30 @@ static vec3 get_closest_point_polygon(vec3 position, Plane* reference_plane) {
 		gm_vec3_scalar_product(gm_vec3_dot(reference_plane->normal, position) + d, reference_plane->normal));
 }
 
-static Plane* build_boundary_planes(Collider_Convex_Hull* convex_hull, u32 target_face_idx) {
+static Plane* build_boundary_planes(const Collider* collider, u32 target_face_idx) {
 	Plane* result = array_new_len(Plane, 16);
-	u32* face_neighbors = convex_hull->face_to_neighbors[target_face_idx];
+	u32* face_neighbors = collider->convex_hull.face_to_neighbors[target_face_idx];
 
 	for (u32 i = 0; i < array_length(face_neighbors); ++i) {
-		Collider_Convex_Hull_Face neighbor_face = convex_hull->transformed_faces[face_neighbors[i]];
+		Collider_Convex_Hull_Face neighbor_face = collider->convex_hull.faces[face_neighbors[i]];
 		Plane p;
-		p.point = convex_hull->transformed_vertices[neighbor_face.elements[0]];
-		p.normal = gm_vec3_invert(neighbor_face.normal);
+		p.point = collider_convex_hull_get_world_vertex(collider, neighbor_face.elements[0]);
+		p.normal = gm_vec3_invert(collider_convex_hull_get_world_normal(collider, face_neighbors[i]));
+		p.feature_id = face_neighbors[i];
 		array_push(result, p);
 	}
 
 	return result;
 }
 
-static u32 get_face_with_most_fitting_normal(u32 support_idx, const Collider_Convex_Hull* convex_hull, vec3 normal) {
+static u32 get_face_with_most_fitting_normal(u32 support_idx, const Collider* collider, vec3 normal) {
 	const r64 EPSILON = 0.000001;
-	u32* support_faces = convex_hull->vertex_to_faces[support_idx];
+	u32* support_faces = collider->convex_hull.vertex_to_faces[support_idx];
 
 	r64 max_proj = -DBL_MAX;
 	u32 selected_face_idx;
 	for (u32 i = 0; i < array_length(support_faces); ++i) {
-		Collider_Convex_Hull_Face face = convex_hull->transformed_faces[support_faces[i]];
-		r64 proj = gm_vec3_dot(face.normal, normal);
+		r64 proj = gm_vec3_dot(collider_convex_hull_get_world_normal(collider, support_faces[i]), normal);
 		if (proj > max_proj) {
 			max_proj = proj;
 			selected_face_idx = support_faces[i];
@@ -151,24 +189,24 @@ static u32 get_face_with_most_fitting_normal(u32 support_idx, const Collider_Con
 	return selected_face_idx;
 }
 
-static dvec4 get_edge_with_most_fitting_normal(u32 support1_idx, u32 support2_idx, const Collider_Convex_Hull* convex_hull1,
-	const Collider_Convex_Hull* convex_hull2, vec3 normal, vec3* edge_normal) {
+static dvec4 get_edge_with_most_fitting_normal(u32 support1_idx, u32 support2_idx, const Collider* collider1,
+	const Collider* collider2, vec3 normal, vec3* edge_normal) {
 	vec3 inverted_normal = gm_vec3_invert(normal);
 
-	vec3 support1 = convex_hull1->transformed_vertices[support1_idx];
-	vec3 support2 = convex_hull2->transformed_vertices[support2_idx];
+	vec3 support1 = collider_convex_hull_get_world_vertex(collider1, support1_idx);
+	vec3 support2 = collider_convex_hull_get_world_vertex(collider2, support2_idx);
 
-	u32* support1_neighbors = convex_hull1->vertex_to_neighbors[support1_idx];
-	u32* support2_neighbors = convex_hull2->vertex_to_neighbors[support2_idx];
+	u32* support1_neighbors = collider1->convex_hull.vertex_to_neighbors[support1_idx];
+	u32* support2_neighbors = collider2->convex_hull.vertex_to_neighbors[support2_idx];
 
 	r64 max_dot = -DBL_MAX;
 	dvec4 selected_edges;
 
 	for (u32 i = 0; i < array_length(support1_neighbors); ++i) {
-		vec3 neighbor1 = convex_hull1->transformed_vertices[support1_neighbors[i]];
+		vec3 neighbor1 = collider_convex_hull_get_world_vertex(collider1, support1_neighbors[i]);
 		vec3 edge1 = gm_vec3_subtract(support1, neighbor1);
 		for (u32 j = 0; j < array_length(support2_neighbors); ++j) {
-			vec3 neighbor2 = convex_hull2->transformed_vertices[support2_neighbors[j]];
+			vec3 neighbor2 = collider_convex_hull_get_world_vertex(collider2, support2_neighbors[j]);
 			vec3 edge2 = gm_vec3_subtract(support2, neighbor2);
 
 			vec3 current_normal = gm_vec3_normalize(gm_vec3_cross(edge1, edge2));
@@ -238,15 +276,131 @@ static boolean collision_distance_between_skew_lines(vec3 p1, vec3 d1, vec3 p2,
 	return true;
 }
 
-static vec3* get_vertices_of_faces(Collider_Convex_Hull* hull, Collider_Convex_Hull_Face face) {
-	vec3* vertices = array_new_len(vec3, 16);
+static Clip_Vertex* get_vertices_of_faces(const Collider* collider, Collider_Convex_Hull_Face face) {
+	Clip_Vertex* vertices = array_new_len(Clip_Vertex, 16);
 	for (u32 i = 0; i < array_length(face.elements); ++i) {
-		array_push(vertices, hull->transformed_vertices[face.elements[i]]);
+		Clip_Vertex vertex;
+		vertex.position = collider_convex_hull_get_world_vertex(collider, face.elements[i]);
+		vertex.feature_id = clipping_combine_feature_ids(FEATURE_TAG_INCIDENT_VERTEX, face.elements[i]);
+		array_push(vertices, vertex);
 	}
 	return vertices;
 }
 
-void convex_convex_contact_manifold(Collider* collider1, Collider* collider2, vec3 normal, Collider_Contact** contacts) {
+static void swap_contacts(Collider_Contact* contacts, r64* depths, u32 i, u32 j) {
+	Collider_Contact contact = contacts[i];
+	contacts[i] = contacts[j];
+	contacts[j] = contact;
+	r64 depth = depths[i];
+	depths[i] = depths[j];
+	depths[j] = depth;
+}
+
+// Area of the triangle (a, b, c) projected onto the plane of the normal, positive if it is counter-clockwise
+static r64 get_signed_area(vec3 a, vec3 b, vec3 c, vec3 normal) {
+	return gm_vec3_dot(gm_vec3_cross(gm_vec3_subtract(b, a), gm_vec3_subtract(c, a)), normal);
+}
+
+// Moves the contacts that are kept to the front of the array and returns how many of them there are.
+// The deepest contact is kept first. The next ones maximize the area covered by the manifold: the contact farthest
+// from the first one, then the one that forms the biggest triangle, then the one that adds the most area outside of
+// that triangle. Contacts beyond the fourth one are the farthest from the contacts that were already kept.
+static u32 reduce_contacts(Collider_Contact* contacts, r64* depths, u32 num_contacts, vec3 normal, u32 max_contacts) {
+	if (max_contacts == 0 || num_contacts <= max_contacts) {
+		return num_contacts;
+	}
+
+	u32 deepest = 0;
+	for (u32 i = 1; i < num_contacts; ++i) {
+		if (depths[i] > depths[deepest]) {
+			deepest = i;
+		}
+	}
+	swap_contacts(contacts, depths, 0, deepest);
+	u32 num_kept = 1;
+
+	if (max_contacts >= 2) {
+		vec3 p0 = contacts[0].collision_point1;
+		u32 farthest = 1;
+		r64 max_distance = -1.0;
+		for (u32 i = 1; i < num_contacts; ++i) {
+			vec3 d = gm_vec3_subtract(contacts[i].collision_point1, p0);
+			r64 distance = gm_vec3_dot(d, d);
+			if (distance > max_distance) {
+				max_distance = distance;
+				farthest = i;
+			}
+		}
+		swap_contacts(contacts, depths, 1, farthest);
+		num_kept = 2;
+	}
+
+	if (max_contacts >= 3) {
+		vec3 p0 = contacts[0].collision_point1;
+		vec3 p1 = contacts[1].collision_point1;
+		u32 biggest = 2;
+		r64 max_area = -1.0;
+		for (u32 i = 2; i < num_contacts; ++i) {
+			r64 area = fabs(get_signed_area(p0, p1, contacts[i].collision_point1, normal));
+			if (area > max_area) {
+				max_area = area;
+				biggest = i;
+			}
+		}
+		swap_contacts(contacts, depths, 2, biggest);
+		num_kept = 3;
+	}
+
+	if (max_contacts >= 4) {
+		vec3 p0 = contacts[0].collision_point1;
+		vec3 p1 = contacts[1].collision_point1;
+		vec3 p2 = contacts[2].collision_point1;
+		r64 orientation = get_signed_area(p0, p1, p2, normal) >= 0.0 ? 1.0 : -1.0;
+
+		// A point outside of the triangle forms a negative area with the edge that it is beyond
+		u32 best = 3;
+		r64 min_area = DBL_MAX;
+		for (u32 i = 3; i < num_contacts; ++i) {
+			vec3 q = contacts[i].collision_point1;
+			r64 area = MIN(MIN(orientation * get_signed_area(p0, p1, q, normal), orientation * get_signed_area(p1, p2, q, normal)),
+				orientation * get_signed_area(p2, p0, q, normal));
+			if (area < min_area) {
+				min_area = area;
+				best = i;
+			}
+		}
+
+		// If all the other contacts are inside of the triangle, they don't add any area
+		if (min_area < 0.0) {
+			swap_contacts(contacts, depths, 3, best);
+			num_kept = 4;
+		}
+	}
+
+	// Past the fourth contact, keep adding the contacts that are farthest from the ones already kept. This also
+	// starts from the triangle when the fourth contact was skipped because all the others are inside of it.
+	while (num_kept >= 3 && max_contacts > 4 && num_kept < max_contacts && num_kept < num_contacts) {
+		u32 farthest = num_kept;
+		r64 max_distance = -1.0;
+		for (u32 i = num_kept; i < num_contacts; ++i) {
+			r64 min_distance = DBL_MAX;
+			for (u32 j = 0; j < num_kept; ++j) {
+				vec3 d = gm_vec3_subtract(contacts[i].collision_point1, contacts[j].collision_point1);
+				min_distance = MIN(min_distance, gm_vec3_dot(d, d));
+			}
+			if (min_distance > max_distance) {
+				max_distance = min_distance;
+				farthest = i;
+			}
+		}
+		swap_contacts(contacts, depths, num_kept, farthest);
+		++num_kept;
+	}
+
+	return num_kept;
+}
+
+void convex_convex_contact_manifold(Collider* collider1, Collider* collider2, vec3 normal, r64 margin, Collider_Contact** contacts) {
 	assert(collider1->type == COLLIDER_TYPE_CONVEX_HULL);
 	assert(collider2->type == COLLIDER_TYPE_CONVEX_HULL);
 	Collider_Convex_Hull* convex_hull1 = &collider1->convex_hull;
@@ -257,52 +411,77 @@ void convex_convex_contact_manifold(Collider* collider1, Collider* collider2, ve
 	vec3 inverted_normal = gm_vec3_invert(normal);
 
 	vec3 edge_normal;
-	u32 support1_idx = support_point_get_index(convex_hull1, normal);
-	u32 support2_idx = support_point_get_index(convex_hull2, inverted_normal);
-	u32 face1_idx = get_face_with_most_fitting_normal(support1_idx, convex_hull1, normal);
-	u32 face2_idx = get_face_with_most_fitting_normal(support2_idx, convex_hull2, inverted_normal);
-	Collider_Convex_Hull_Face face1 = convex_hull1->transformed_faces[face1_idx];
-	Collider_Convex_Hull_Face face2 = convex_hull2->transformed_faces[face2_idx];
-	dvec4 edges = get_edge_with_most_fitting_normal(support1_idx, support2_idx, convex_hull1, convex_hull2, normal, &edge_normal);
-
-	r64 chosen_normal1_dot = gm_vec3_dot(face1.normal, normal);
-	r64 chosen_normal2_dot = gm_vec3_dot(face2.normal, inverted_normal);
+	u32 support1_idx = support_point_get_index(collider1, normal);
+	u32 support2_idx = support_point_get_index(collider2, inverted_normal);
+	u32 face1_idx = get_face_with_most_fitting_normal(support1_idx, collider1, normal);
+	u32 face2_idx = get_face_with_most_fitting_normal(support2_idx, collider2, inverted_normal);
+	Collider_Convex_Hull_Face face1 = convex_hull1->faces[face1_idx];
+	Collider_Convex_Hull_Face face2 = convex_hull2->faces[face2_idx];
+	vec3 face1_normal = collider_convex_hull_get_world_normal(collider1, face1_idx);
+	vec3 face2_normal = collider_convex_hull_get_world_normal(collider2, face2_idx);
+	dvec4 edges = get_edge_with_most_fitting_normal(support1_idx, support2_idx, collider1, collider2, normal, &edge_normal);
+
+	r64 chosen_normal1_dot = gm_vec3_dot(face1_normal, normal);
+	r64 chosen_normal2_dot = gm_vec3_dot(face2_normal, inverted_normal);
 	r64 edge_normal_dot = gm_vec3_dot(edge_normal, normal);
 
+	// Parallel edges have no single closest pair of points, they are handled by the face case. This happens with the
+	// normals of speculative contacts, which come from the closest points instead of a separating axis.
+	boolean use_edges = false;
+	vec3 l1, l2;
 	if (edge_normal_dot > chosen_normal1_dot + EPSILON && edge_normal_dot > chosen_normal2_dot + EPSILON) {
+		vec3 p1 = collider_convex_hull_get_world_vertex(collider1, (u32)edges.x);
+		vec3 d1 = gm_vec3_subtract(collider_convex_hull_get_world_vertex(collider1, (u32)edges.y), p1);
+		vec3 p2 = collider_convex_hull_get_world_vertex(collider2, (u32)edges.z);
+		vec3 d2 = gm_vec3_subtract(collider_convex_hull_get_world_vertex(collider2, (u32)edges.w), p2);
+		use_edges = collision_distance_between_skew_lines(p1, d1, p2, d2, &l1, &l2, 0, 0);
+	}
+
+	if (use_edges) {
 		//printf("EDGE\n");
-		vec3 l1, l2;
-		vec3 p1 = convex_hull1->transformed_vertices[edges.x];
-		vec3 d1 = gm_vec3_subtract(convex_hull1->transformed_vertices[edges.y], p1);
-		vec3 p2 = convex_hull2->transformed_vertices[edges.z];
-		vec3 d2 = gm_vec3_subtract(convex_hull2->transformed_vertices[edges.w], p2);
-		assert(collision_distance_between_skew_lines(p1, d1, p2, d2, &l1, &l2, 0, 0));
 		Collider_Contact contact = (Collider_Contact){l1, l2, normal};
+		// The same pair of edges is found from either endpoint of each edge
+		u32 edge1_id = clipping_combine_feature_ids(MIN((u32)edges.x, (u32)edges.y), MAX((u32)edges.x, (u32)edges.y));
+		u32 edge2_id = clipping_combine_feature_ids(MIN((u32)edges.z, (u32)edges.w), MAX((u32)edges.z, (u32)edges.w));
+		contact.feature_id = clipping_combine_feature_ids(FEATURE_TAG_EDGES, clipping_combine_feature_ids(edge1_id, edge2_id));
 		array_push(*contacts, contact);
 	} else {
 		//printf("FACE\n");
 		boolean is_face1_the_reference_face = chosen_normal1_dot > chosen_normal2_dot;
-		vec3* reference_face_support_points = is_face1_the_reference_face ?
-			get_vertices_of_faces(convex_hull1, face1) : get_vertices_of_faces(convex_hull2, face2);
-		vec3* incident_face_support_points = is_face1_the_reference_face ?
-			get_vertices_of_faces(convex_hull2, face2) : get_vertices_of_faces(convex_hull1, face1);
+		Clip_Vertex* reference_face_support_points = is_face1_the_reference_face ?
+			get_vertices_of_faces(collider1, face1) : get_vertices_of_faces(collider2, face2);
+		Clip_Vertex* incident_face_support_points = is_face1_the_reference_face ?
+			get_vertices_of_faces(collider2, face2) : get_vertices_of_faces(collider1, face1);
 
-		Plane* boundary_planes = is_face1_the_reference_face ? build_boundary_planes(convex_hull1, face1_idx) :
-			build_boundary_planes(convex_hull2, face2_idx);
+		Plane* boundary_planes = is_face1_the_reference_face ? build_boundary_planes(collider1, face1_idx) :
+			build_boundary_planes(collider2, face2_idx);
 
-		vec3* clipped_points;
+		Clip_Vertex* clipped_points;
 		sutherland_hodgman(incident_face_support_points, array_length(boundary_planes), boundary_planes, &clipped_points, false);
 
+		// The plane points into the reference collider. Clipping uses a copy moved out by the margin, so that incident
+		// points that are up to 'margin' in front of the reference face are kept as speculative contacts.
 		Plane reference_plane;
-		reference_plane.normal = is_face1_the_reference_face ? gm_vec3_invert(face1.normal) :
-			gm_vec3_invert(face2.normal);
-		reference_plane.point = reference_face_support_points[0];
+		reference_plane.normal = is_face1_the_reference_face ? gm_vec3_invert(face1_normal) :
+			gm_vec3_invert(face2_normal);
+		reference_plane.point = reference_face_support_points[0].position;
+		reference_plane.feature_id = 0;
+
+		Plane margin_plane = reference_plane;
+		margin_plane.point = gm_vec3_subtract(reference_plane.point, gm_vec3_scalar_product(margin, reference_plane.normal));
+
+		Clip_Vertex* final_clipped_points;
+		sutherland_hodgman(clipped_points, 1, &margin_plane, &final_clipped_points, true);
 
-		vec3* final_clipped_points;
-		sutherland_hodgman(clipped_points, 1, &reference_plane, &final_clipped_points, true);
+		// Contacts are identified by the reference face and by the incident vertex or the clipped edge they come from
+		u32 reference_face_id = is_face1_the_reference_face ? clipping_combine_feature_ids(FEATURE_TAG_REFERENCE_FACE1, face1_idx) :
+			clipping_combine_feature_ids(FEATURE_TAG_REFERENCE_FACE2, face2_idx);
+
+		u32 first_contact = array_length(*contacts);
+		r64* depths = array_new_len(r64, array_length(final_clipped_points));
 
 		for (u32 i = 0; i < array_length(final_clipped_points); ++i) {
-			vec3 point = final_clipped_points[i];
+			vec3 point = final_clipped_points[i].position;
 			//vec3 closest_point = get_closest_pointPolygon(point, reference_face_support_points);
 			vec3 closest_point = get_closest_point_polygon(point, &reference_plane);
 			vec3 point_diff = gm_vec3_subtract(point, closest_point);
@@ -322,12 +501,21 @@ void convex_convex_contact_manifold(Collider* collider1, Collider* collider2, ve
 			}
 
 			contact.normal = normal;
+			contact.feature_id = clipping_combine_feature_ids(reference_face_id, final_clipped_points[i].feature_id);
 
-			if (contact_penetration < 0.0) {
+			if (contact_penetration < margin) {
 				array_push(*contacts, contact);
+				array_push(depths, -contact_penetration);
 			}
 		}
 
+		// Complex faces clip into many close contacts, and every one of them becomes a constraint
+		u32 num_contacts = array_length(*contacts) - first_contact;
+		u32 num_kept = reduce_contacts(*contacts + first_contact, depths, num_contacts, normal, max_contacts);
+		array_length(*contacts) = first_contact + num_kept;
+		clipping_statistics[thread_pool_get_current_worker()].num_removed_contacts += num_contacts - num_kept;
+		array_free(depths);
+
 		array_free(reference_face_support_points);
 		array_free(incident_face_support_points);
 		array_free(boundary_planes);
@@ -340,10 +528,13 @@ void convex_convex_contact_manifold(Collider* collider1, Collider* collider2, ve
 	}
 }
 
-void clipping_get_contact_manifold(Collider* collider1, Collider* collider2, vec3 normal, r64 penetration,
+// 'penetration' is negative for colliders that are still apart (speculative contacts), and face contacts are kept for
+// points that are up to 'margin' apart along the normal.
+void clipping_get_contact_manifold(Collider* collider1, Collider* collider2, vec3 normal, r64 penetration, r64 margin,
 	Collider_Contact** contacts) {
 	// TODO: For now, we only consider CONVEX and SPHERE colliders.
 	// If new colliders are added, we can think about making this more generic.
+	u32 first_contact = array_length(*contacts);
 
 	if (collider1->type == COLLIDER_TYPE_SPHERE) {
 		vec3 sphere_collision_point = support_point(collider1, normal);
@@ -352,6 +543,7 @@ void clipping_get_contact_manifold(Collider* collider1, Collider* collider2, vec
 		contact.collision_point1 = sphere_collision_point;
 		contact.collision_point2 = gm_vec3_subtract(sphere_collision_point, gm_vec3_scalar_product(penetration, normal));
 		contact.normal = normal;
+		contact.feature_id = 0;
 		array_push(*contacts, contact);
 	} else if (collider2->type == COLLIDER_TYPE_SPHERE) {
 		vec3 inverse_normal = gm_vec3_invert(normal);
@@ -361,11 +553,51 @@ void clipping_get_contact_manifold(Collider* collider1, Collider* collider2, vec
 		contact.collision_point1 = gm_vec3_add(sphere_collision_point, gm_vec3_scalar_product(penetration, normal));
 		contact.collision_point2 = sphere_collision_point;
 		contact.normal = normal;
+		contact.feature_id = 0;
 		array_push(*contacts, contact);
 	} else {
 		// For now, this case must be convex-convex
 		assert(collider1->type == COLLIDER_TYPE_CONVEX_HULL);
 		assert(collider2->type == COLLIDER_TYPE_CONVEX_HULL);
-		convex_convex_contact_manifold(collider1, collider2, normal, contacts);
+		convex_convex_contact_manifold(collider1, collider2, normal, margin, contacts);
+	}
+
+	u32 worker = thread_pool_get_current_worker();
+	clipping_statistics[worker].num_contacts += array_length(*contacts) - first_contact;
+	u32 num_speculative_contacts = 0;
+	for (u32 i = first_contact; i < array_length(*contacts); ++i) {
+		const Collider_Contact* contact = &(*contacts)[i];
+		if (gm_vec3_dot(gm_vec3_subtract(contact->collision_point1, contact->collision_point2), normal) < 0.0) {
+			++num_speculative_contacts;
+		}
+	}
+	clipping_statistics[worker].num_speculative_contacts += num_speculative_contacts;
+}
+
+// Sets the maximum number of contacts of a face manifold. 0 keeps all the contacts found by the clipping.
+void clipping_set_max_contacts(u32 num_contacts) {
+	max_contacts = num_contacts;
+}
+
+u32 clipping_get_max_contacts() {
+	return max_contacts;
+}
+
+// Counters since the last reset, added up over the worker threads. Must not be called while the simulation runs.
+Clipping_Statistics clipping_get_statistics() {
+	Clipping_Statistics statistics = {0};
+	for (u32 i = 0; i < THREAD_POOL_MAX_THREADS; ++i) {
+		statistics.num_contacts += clipping_statistics[i].num_contacts;
+		statistics.num_removed_contacts += clipping_statistics[i].num_removed_contacts;
+		statistics.num_speculative_contacts += clipping_statistics[i].num_speculative_contacts;
+	}
+	return statistics;
+}
+
+void clipping_reset_statistics() {
+	for (u32 i = 0; i < THREAD_POOL_MAX_THREADS; ++i) {
+		clipping_statistics[i].num_contacts = 0;
+		clipping_statistics[i].num_removed_contacts = 0;
+		clipping_statistics[i].num_speculative_contacts = 0;
 	}
 }
\ No newline at end of file
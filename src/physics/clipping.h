@@ -3,6 +3,21 @@
 #include <gm.h>
 #include "collider.h"
 
-void clipping_get_contact_manifold(Collider* collider1, Collider* collider2, vec3 normal, r64 penetration, Collider_Contact** contacts);
+// Face contacts are reduced to this many points by default. Four points are enough to keep a box from rotating.
+#define CLIPPING_DEFAULT_MAX_CONTACTS 4
+
+typedef struct {
+	u64 num_contacts;         // contacts returned by all manifolds
+	u64 num_removed_contacts; // contacts discarded by the manifold reduction
+	u64 num_speculative_contacts; // returned contacts whose points are still apart
+} Clipping_Statistics;
+
+u32 clipping_combine_feature_ids(u32 a, u32 b);
+void clipping_get_contact_manifold(Collider* collider1, Collider* collider2, vec3 normal, r64 penetration, r64 margin,
+	Collider_Contact** contacts);
+void clipping_set_max_contacts(u32 num_contacts);
+u32 clipping_get_max_contacts();
+Clipping_Statistics clipping_get_statistics();
+void clipping_reset_statistics();
 
 #endif
\ No newline at end of file
@@ -3,17 +3,36 @@
 #include <memory.h>
 #include <light_array.h>
 #include "../util.h"
+#include "../thread_pool.h"
 #include "gjk.h"
 #include "clipping.h"
 #include "epa.h"
+#include "sat.h"
 #include "../util.h"
 #include <float.h>
+#include <stdint.h>
+
+// Distance that a vertex can be above the plane of a neighbor triangle before the mesh is considered not convex
+#define CONVEX_HULL_CONCAVITY_TOLERANCE 1e-6
+// How much closer than the distance of two colliders a point of their speculative manifold can be
+#define SPECULATIVE_CONTACT_TOLERANCE 1e-3
+
+// One slot per worker thread, each in its own cache line, so that the workers never write to the same memory
+static struct {
+	alignas(64) u64 num_updates;
+	u64 num_skipped_updates;
+} update_statistics[THREAD_POOL_MAX_THREADS];
 
 Collider collider_sphere_create(const r32 radius) {
 	Collider collider;
 	collider.type = COLLIDER_TYPE_SPHERE;
 	collider.sphere.radius = radius;
 	collider.sphere.center = (vec3){0.0, 0.0, 0.0};
+	collider.local_aabb.min = (vec3){-radius, -radius, -radius};
+	collider.local_aabb.max = (vec3){radius, radius, radius};
+	collider.world_position = (vec3){0.0, 0.0, 0.0};
+	collider.world_rotation = (Quaternion){0.0, 0.0, 0.0, 1.0};
+	collider.world_rotation_matrix = gm_mat3_identity();
 	return collider;
 }
 
@@ -175,6 +194,44 @@ static boolean is_neighbor_already_in_vertex_to_neighbors_map(u32* vertex_to_nei
 	return false;
 }
 
+static boolean does_vertex_belong_to_face(u32* vertex_faces, u32 face_idx) {
+	for (u32 i = 0; i < array_length(vertex_faces); ++i) {
+		if (vertex_faces[i] == face_idx) {
+			return true;
+		}
+	}
+
+	return false;
+}
+
+// Collects the edges of the (merged) faces. Consecutive elements of a face form an edge, and the other face of the edge
+// is the one that also contains both vertices. Each edge is added only by the face with the lowest index.
+static Collider_Convex_Hull_Edge* create_convex_hull_edges(Collider_Convex_Hull_Face* faces, u32** vertex_to_faces_map) {
+	Collider_Convex_Hull_Edge* edges = array_new(Collider_Convex_Hull_Edge);
+	for (u32 i = 0; i < array_length(faces); ++i) {
+		u32* elements = faces[i].elements;
+		for (u32 j = 0; j < array_length(elements); ++j) {
+			u32 v1 = elements[j];
+			u32 v2 = elements[(j + 1) % array_length(elements)];
+			u32* v1_faces = vertex_to_faces_map[v1];
+			for (u32 k = 0; k < array_length(v1_faces); ++k) {
+				u32 candidate_face = v1_faces[k];
+				if (candidate_face > i && does_vertex_belong_to_face(vertex_to_faces_map[v2], candidate_face)) {
+					Collider_Convex_Hull_Edge edge;
+					edge.v1 = v1;
+					edge.v2 = v2;
+					edge.face1 = i;
+					edge.face2 = candidate_face;
+					array_push(edges, edge);
+					break;
+				}
+			}
+		}
+	}
+
+	return edges;
+}
+
 static r64 get_convex_hull_collider_bounding_sphere_radius(const Collider* collider) {
 	r64 max_distance = 0.0;
 	for (u32 i = 0; i < array_length(collider->convex_hull.vertices); ++i) {
@@ -188,6 +245,29 @@ static r64 get_convex_hull_collider_bounding_sphere_radius(const Collider* colli
 	return max_distance;
 }
 
+// Fills the single precision structure-of-arrays copy of the vertices, used by the vectorized support scan
+static void create_soa_vertices(Collider_Convex_Hull* convex_hull) {
+	const u32 alignment = 32;
+	u32 num_vertices = array_length(convex_hull->vertices);
+	u32 soa_length = ((num_vertices + COLLIDER_SOA_PADDING - 1) / COLLIDER_SOA_PADDING) * COLLIDER_SOA_PADDING;
+
+	// 'soa_length' is a multiple of 8 floats, so the three arrays stay 32-byte aligned if the first one is
+	convex_hull->soa_memory = malloc(3 * soa_length * sizeof(r32) + alignment);
+	r32* base = (r32*)(((uintptr_t)convex_hull->soa_memory + alignment - 1) & ~(uintptr_t)(alignment - 1));
+	convex_hull->soa_x = base;
+	convex_hull->soa_y = base + soa_length;
+	convex_hull->soa_z = base + 2 * soa_length;
+	convex_hull->soa_length = soa_length;
+
+	// Padding repeats the first vertex, which can never win a scan against it, since ties keep the lowest index
+	for (u32 i = 0; i < soa_length; ++i) {
+		vec3 v = convex_hull->vertices[i < num_vertices ? i : 0];
+		convex_hull->soa_x[i] = (r32)v.x;
+		convex_hull->soa_y[i] = (r32)v.y;
+		convex_hull->soa_z[i] = (r32)v.z;
+	}
+}
+
 // Create a convex hull from the vertices+indices
 // For now, we assume that the mesh is already a convex hull
 // This function only makes sure that vertices are unique - duplicated vertices will be merged.
@@ -281,6 +361,29 @@ Collider collider_convex_hull_create(const vec3* vertices, const u32* indices) {
 		}
 	}
 
+	// Check whether the mesh is really convex: no neighbor of a triangle's vertices can be above the triangle
+	boolean has_concave_edges = false;
+	for (u32 i = 0; i < array_length(hull_triangle_faces) && !has_concave_edges; ++i) {
+		dvec3 triangle_face = hull_triangle_faces[i];
+		vec3 v1 = hull[triangle_face.x];
+		vec3 normal = gm_vec3_cross(gm_vec3_subtract(hull[triangle_face.y], v1), gm_vec3_subtract(hull[triangle_face.z], v1));
+		if (gm_vec3_length(normal) == 0.0) {
+			continue;
+		}
+		normal = gm_vec3_normalize(normal);
+
+		s32 triangle_vertices[3] = {triangle_face.x, triangle_face.y, triangle_face.z};
+		for (u32 j = 0; j < 3 && !has_concave_edges; ++j) {
+			u32* neighbors = vertex_to_neighbors_map[triangle_vertices[j]];
+			for (u32 k = 0; k < array_length(neighbors); ++k) {
+				if (gm_vec3_dot(gm_vec3_subtract(hull[neighbors[k]], v1), normal) > CONVEX_HULL_CONCAVITY_TOLERANCE) {
+					has_concave_edges = true;
+					break;
+				}
+			}
+		}
+	}
+
 	// Collect all 'de facto' faces of the convex hull
 	Collider_Convex_Hull_Face* faces = array_new(Collider_Convex_Hull_Face);
 	boolean* is_triangle_face_already_processed_arr = (boolean*)calloc(array_length(hull_triangle_faces), sizeof(boolean));
@@ -350,16 +453,27 @@ Collider collider_convex_hull_create(const vec3* vertices, const u32* indices) {
 
 	Collider_Convex_Hull convex_hull;
 	convex_hull.faces = faces;
-	convex_hull.transformed_faces = (Collider_Convex_Hull_Face*)array_copy(faces);
+	convex_hull.edges = create_convex_hull_edges(faces, vertex_to_faces_map);
 	convex_hull.vertices = hull;
-	convex_hull.transformed_vertices = (vec3*)array_copy(hull);
 	convex_hull.vertex_to_faces = vertex_to_faces_map;
 	convex_hull.vertex_to_neighbors = vertex_to_neighbors_map;
 	convex_hull.face_to_neighbors = face_to_neighbor_faces_map;
+	convex_hull.has_concave_edges = has_concave_edges;
+	create_soa_vertices(&convex_hull);
 
 	Collider collider;
 	collider.type = COLLIDER_TYPE_CONVEX_HULL;
 	collider.convex_hull = convex_hull;
+	collider.world_position = (vec3){0.0, 0.0, 0.0};
+	collider.world_rotation = (Quaternion){0.0, 0.0, 0.0, 1.0};
+	collider.world_rotation_matrix = gm_mat3_identity();
+	collider.local_aabb.min = (vec3){DBL_MAX, DBL_MAX, DBL_MAX};
+	collider.local_aabb.max = (vec3){-DBL_MAX, -DBL_MAX, -DBL_MAX};
+	for (u32 i = 0; i < array_length(convex_hull.vertices); ++i) {
+		vec3 v = convex_hull.vertices[i];
+		collider.local_aabb.min = (vec3){MIN(collider.local_aabb.min.x, v.x), MIN(collider.local_aabb.min.y, v.y), MIN(collider.local_aabb.min.z, v.z)};
+		collider.local_aabb.max = (vec3){MAX(collider.local_aabb.max.x, v.x), MAX(collider.local_aabb.max.y, v.y), MAX(collider.local_aabb.max.z, v.z)};
+	}
 	return collider;
 }
 
@@ -378,14 +492,12 @@ static void collider_convex_hull_destroy(Collider* collider) {
 	free(collider->convex_hull.face_to_neighbors);
 
 	array_free(collider->convex_hull.vertices);
-	array_free(collider->convex_hull.transformed_vertices);
+	free(collider->convex_hull.soa_memory);
 	for (u32 i = 0; i < array_length(collider->convex_hull.faces); ++i) {
 		array_free(collider->convex_hull.faces[i].elements);
 	}
 	array_free(collider->convex_hull.faces);
-
-	// The 'elements' array of the transformed faces is the same as the one stored in 'faces', so we don't need to release it again.
-	array_free(collider->convex_hull.transformed_faces);
+	array_free(collider->convex_hull.edges);
 }
 
 static void collider_destroy(Collider* collider) {
@@ -406,44 +518,74 @@ void colliders_destroy(Collider* colliders) {
 	}
 }
 
-static void collider_update(Collider* collider, vec3 translation, const Quaternion* rotation) {
-	switch (collider->type) {
-		case COLLIDER_TYPE_CONVEX_HULL: {
-			mat4 model_matrix_no_scale = util_get_model_matrix_no_scale(rotation, translation);
-			for (u32 i = 0; i < array_length(collider->convex_hull.transformed_vertices); ++i) {
-				vec4 vertex = (vec4) {
-					collider->convex_hull.vertices[i].x,
-					collider->convex_hull.vertices[i].y,
-					collider->convex_hull.vertices[i].z,
-					1.0
-				};
-				vec4 transformed_vertex = gm_mat4_multiply_vec4(&model_matrix_no_scale, vertex);
-				transformed_vertex = gm_vec4_scalar_product(1.0 / transformed_vertex.w, transformed_vertex);
-				collider->convex_hull.transformed_vertices[i] = gm_vec4_to_vec3(transformed_vertex);
-			}
+static void collider_update(Collider* collider, vec3 translation, const Quaternion* rotation, const mat3* rotation_matrix) {
+	collider->world_position = translation;
+	collider->world_rotation = *rotation;
+	collider->world_rotation_matrix = *rotation_matrix;
 
-			for (u32 i = 0; i < array_length(collider->convex_hull.transformed_faces); ++i) {
-				vec3 normal = collider->convex_hull.faces[i].normal;
-				vec3 transformed_normal = gm_mat4_multiply_vec3(&model_matrix_no_scale, normal, false);
-				collider->convex_hull.transformed_faces[i].normal = gm_vec3_normalize(transformed_normal);
-			}
-		} break;
-		case COLLIDER_TYPE_SPHERE: {
-			collider->sphere.center = translation;
-		} break;
-		default: {
-			assert(0);
-		} break;
+	// For now, spheres are always centered at the entity position
+	if (collider->type == COLLIDER_TYPE_SPHERE) {
+		collider->sphere.center = translation;
 	}
 }
 
-void colliders_update(Collider* colliders, vec3 translation, const Quaternion* rotation) {
+static boolean collider_pose_equals(const Collider* collider, vec3 translation, const Quaternion* rotation) {
+	return collider->world_position.x == translation.x && collider->world_position.y == translation.y &&
+		collider->world_position.z == translation.z && collider->world_rotation.x == rotation->x &&
+		collider->world_rotation.y == rotation->y && collider->world_rotation.z == rotation->z &&
+		collider->world_rotation.w == rotation->w;
+}
+
+// Only stores the new pose, the hull vertices are transformed on demand (see 'collider_convex_hull_get_world_vertex').
+// Fixed and sleeping entities, and entities that are part of several pairs in the same substep, are updated many times
+// with the same pose, so the update is skipped when the pose didn't change. Returns whether the colliders were updated.
+boolean colliders_update(Collider* colliders, vec3 translation, const Quaternion* rotation) {
+	u32 worker = thread_pool_get_current_worker();
+	++update_statistics[worker].num_updates;
+
+	// All colliders of an entity share its pose, so the first one tells whether the pose changed
+	if (array_length(colliders) > 0 && collider_pose_equals(&colliders[0], translation, rotation)) {
+		++update_statistics[worker].num_skipped_updates;
+		return false;
+	}
+
+	mat3 rotation_matrix = quaternion_get_matrix3(rotation);
 	for (u32 i = 0; i < array_length(colliders); ++i) {
 		Collider* collider = &colliders[i];
-		collider_update(collider, translation, rotation);
+		collider_update(collider, translation, rotation, &rotation_matrix);
+	}
+
+	return true;
+}
+
+// Counters since the last reset, added up over the worker threads. Must not be called while the simulation runs.
+Collider_Update_Statistics colliders_get_update_statistics() {
+	Collider_Update_Statistics statistics = {0};
+	for (u32 i = 0; i < THREAD_POOL_MAX_THREADS; ++i) {
+		statistics.num_updates += update_statistics[i].num_updates;
+		statistics.num_skipped_updates += update_statistics[i].num_skipped_updates;
+	}
+	return statistics;
+}
+
+void colliders_reset_update_statistics() {
+	for (u32 i = 0; i < THREAD_POOL_MAX_THREADS; ++i) {
+		update_statistics[i].num_updates = 0;
+		update_statistics[i].num_skipped_updates = 0;
 	}
 }
 
+vec3 collider_convex_hull_get_world_vertex(const Collider* collider, u32 vertex_idx) {
+	assert(collider->type == COLLIDER_TYPE_CONVEX_HULL);
+	vec3 v = gm_mat3_multiply_vec3(&collider->world_rotation_matrix, collider->convex_hull.vertices[vertex_idx]);
+	return gm_vec3_add(v, collider->world_position);
+}
+
+vec3 collider_convex_hull_get_world_normal(const Collider* collider, u32 face_idx) {
+	assert(collider->type == COLLIDER_TYPE_CONVEX_HULL);
+	return gm_mat3_multiply_vec3(&collider->world_rotation_matrix, collider->convex_hull.faces[face_idx].normal);
+}
+
 // @TODO: We need to rewrite this function
 mat3 colliders_get_default_inertia_tensor(Collider* colliders, r64 mass) {
 	// For now, the center of mass is always assumed to be at 0,0,0
@@ -520,7 +662,44 @@ r64 colliders_get_bounding_sphere_radius(const Collider* colliders) {
 	return max_bounding_sphere_radius;
 }
 
-static void collider_get_contacts(Collider* collider1, Collider* collider2, Collider_Contact** contacts) {
+// Speculative contacts of two colliders that don't overlap, if they are at most 'margin' apart
+static void get_speculative_contacts(Collider* collider1, Collider* collider2, r64 margin, Collider_Contact** contacts) {
+	vec3 closest_point1, closest_point2;
+	r64 distance = gjk_get_distance(collider1, collider2, &closest_point1, &closest_point2);
+
+	// Colliders that touch without overlapping have no direction to separate them along
+	if (distance <= 0.0 || distance > margin) {
+		return;
+	}
+
+	vec3 normal = gm_vec3_normalize(gm_vec3_subtract(closest_point2, closest_point1));
+	u32 first_contact = array_length(*contacts);
+	clipping_get_contact_manifold(collider1, collider2, normal, -distance, margin, contacts);
+
+	// No two points of the colliders are closer than their distance. When the closest features are not faces that
+	// face each other (e.g. two edges or a vertex), the clipped manifold can claim otherwise, and only the closest points
+	// are kept as contact.
+	for (u32 i = first_contact; i < array_length(*contacts); ++i) {
+		const Collider_Contact* contact = &(*contacts)[i];
+		r64 separation = gm_vec3_dot(gm_vec3_subtract(contact->collision_point2, contact->collision_point1), normal);
+		if (separation < distance - SPECULATIVE_CONTACT_TOLERANCE) {
+			array_length(*contacts) = first_contact;
+			Collider_Contact closest_contact;
+			closest_contact.collision_point1 = closest_point1;
+			closest_contact.collision_point2 = closest_point2;
+			closest_contact.normal = normal;
+			closest_contact.feature_id = 0;
+			array_push(*contacts, closest_contact);
+			break;
+		}
+	}
+}
+
+// Adds the contacts between two single colliders to 'contacts'. 'cache' is optional, if given it must always be the same
+// for the same pair of colliders.
+// With a positive 'margin', colliders that are up to 'margin' apart also get speculative contacts, with negative
+// penetration. Overlapping colliders then also keep the points of their manifold that are up to 'margin' apart.
+void collider_get_contacts(Collider* collider1, Collider* collider2, Collider_Pair_Cache* cache, r64 margin, Collider_Contact** contacts) {
 	GJK_Simplex simplex;
 	r64 penetration;
 	vec3 normal;
@@ -531,18 +710,30 @@ static void collider_get_contacts(Collider* collider1, Collider* collider2, Coll
 		vec3 distance_vector = gm_vec3_subtract(collider1->sphere.center, collider2->sphere.center);
 		r32 distance_sqd = gm_vec3_dot(distance_vector, distance_vector);
 		r32 min_distance = collider1->sphere.radius + collider2->sphere.radius;
-		if (distance_sqd < (min_distance * min_distance)) {
-			// Spheres are colliding
+		r32 max_distance = min_distance + margin;
+		if (distance_sqd < (max_distance * max_distance)) {
+			// Spheres are colliding, or close enough for a speculative contact
 			normal = gm_vec3_normalize(gm_vec3_subtract(collider2->sphere.center, collider1->sphere.center));
 			penetration = min_distance - sqrt(distance_sqd);
-			clipping_get_contact_manifold(collider1, collider2, normal, penetration, contacts);
+			clipping_get_contact_manifold(collider1, collider2, normal, penetration, margin, contacts);
+		}
+
+		return;
+	}
+
+	// Low-poly hulls (boxes, ramps, ...) are cheaper with SAT, and it can't fail to converge like EPA
+	if (sat_is_suited(collider1, collider2)) {
+		if (sat_collides(collider1, collider2, cache ? &cache->sat : NULL, &normal, &penetration)) {
+			clipping_get_contact_manifold(collider1, collider2, normal, penetration, margin, contacts);
+		} else if (margin > 0.0) {
+			get_speculative_contacts(collider1, collider2, margin, contacts);
 		}
 
 		return;
 	}
 
 	// Call GJK to check if there is a collision
-	if (gjk_collides(collider1, collider2, &simplex)) {
+	if (gjk_collides(collider1, collider2, &simplex, cache ? &cache->gjk_direction : NULL)) {
 		// There is a collision.
 
 		// Get the collision normal using EPA
@@ -551,22 +742,106 @@ static void collider_get_contacts(Collider* collider1, Collider* collider2, Coll
 		}
 
 		// Finally, clip the results to get the result manifold
-		clipping_get_contact_manifold(collider1, collider2, normal, penetration, contacts);
+		clipping_get_contact_manifold(collider1, collider2, normal, penetration, margin, contacts);
+	} else if (margin > 0.0) {
+		get_speculative_contacts(collider1, collider2, margin, contacts);
 	}
 
 	return;
 }
 
-Collider_Contact* colliders_get_contacts(Collider* colliders1, Collider* colliders2) {
+Collider_Contact* colliders_get_contacts(Collider* colliders1, Collider* colliders2, r64 margin) {
 	Collider_Contact* contacts = array_new_len(Collider_Contact, 16);
 
 	for (u32 i = 0; i < array_length(colliders1); ++i) {
 		Collider* collider1 = &colliders1[i];
 		for (u32 j = 0; j < array_length(colliders2); ++j) {
 			Collider* collider2 = &colliders2[j];
-			collider_get_contacts(collider1, collider2, &contacts);
+			u32 first_contact = array_length(contacts);
+			collider_get_contacts(collider1, collider2, NULL, margin, &contacts);
+
+			// Feature IDs are only unique within a pair of colliders, so the pair is mixed into the IDs of its contacts
+			for (u32 k = first_contact; k < array_length(contacts); ++k) {
+				contacts[k].feature_id = clipping_combine_feature_ids(contacts[k].feature_id, clipping_combine_feature_ids(i, j));
+			}
 		}
 	}
 
 	return contacts;
+}
+
+static Collider_AABB collider_get_aabb(const Collider* collider, vec3 translation, const Quaternion* rotation) {
+	Collider_AABB aabb;
+
+	switch (collider->type) {
+		case COLLIDER_TYPE_CONVEX_HULL: {
+			aabb.min = (vec3){DBL_MAX, DBL_MAX, DBL_MAX};
+			aabb.max = (vec3){-DBL_MAX, -DBL_MAX, -DBL_MAX};
+			for (u32 i = 0; i < array_length(collider->convex_hull.vertices); ++i) {
+				vec3 v = quaternion_apply_to_vec3(rotation, collider->convex_hull.vertices[i]);
+				aabb.min.x = MIN(aabb.min.x, v.x);
+				aabb.min.y = MIN(aabb.min.y, v.y);
+				aabb.min.z = MIN(aabb.min.z, v.z);
+				aabb.max.x = MAX(aabb.max.x, v.x);
+				aabb.max.y = MAX(aabb.max.y, v.y);
+				aabb.max.z = MAX(aabb.max.z, v.z);
+			}
+			aabb.min = gm_vec3_add(aabb.min, translation);
+			aabb.max = gm_vec3_add(aabb.max, translation);
+		} break;
+		case COLLIDER_TYPE_SPHERE: {
+			// For now, spheres are always centered at the entity position (check 'collider_update')
+			r64 r = collider->sphere.radius;
+			aabb.min = gm_vec3_subtract(translation, (vec3){r, r, r});
+			aabb.max = gm_vec3_add(translation, (vec3){r, r, r});
+		} break;
+		default: {
+			assert(0);
+		} break;
+	}
+
+	return aabb;
+}
+
+// Calculates the world AABB of all colliders, given the entity's translation and rotation.
+// This does not rely on the pose stored in the colliders, so it is valid even if the colliders were not updated.
+Collider_AABB colliders_get_aabb(const Collider* colliders, vec3 translation, const Quaternion* rotation) {
+	assert(array_length(colliders) > 0);
+	Collider_AABB aabb = collider_get_aabb(&colliders[0], translation, rotation);
+	for (u32 i = 1; i < array_length(colliders); ++i) {
+		Collider_AABB collider_aabb = collider_get_aabb(&colliders[i], translation, rotation);
+		aabb = collider_aabb_merge(&aabb, &collider_aabb);
+	}
+
+	return aabb;
+}
+
+boolean collider_aabb_overlaps(const Collider_AABB* a, const Collider_AABB* b) {
+	return a->min.x <= b->max.x && b->min.x <= a->max.x &&
+		a->min.y <= b->max.y && b->min.y <= a->max.y &&
+		a->min.z <= b->max.z && b->min.z <= a->max.z;
+}
+
+boolean collider_aabb_contains(const Collider_AABB* container, const Collider_AABB* aabb) {
+	return container->min.x <= aabb->min.x && container->min.y <= aabb->min.y && container->min.z <= aabb->min.z &&
+		aabb->max.x <= container->max.x && aabb->max.y <= container->max.y && aabb->max.z <= container->max.z;
+}
+
+Collider_AABB collider_aabb_merge(const Collider_AABB* a, const Collider_AABB* b) {
+	Collider_AABB result;
+	result.min = (vec3){MIN(a->min.x, b->min.x), MIN(a->min.y, b->min.y), MIN(a->min.z, b->min.z)};
+	result.max = (vec3){MAX(a->max.x, b->max.x), MAX(a->max.y, b->max.y), MAX(a->max.z, b->max.z)};
+	return result;
+}
+
+Collider_AABB collider_aabb_expand(const Collider_AABB* aabb, r64 margin) {
+	Collider_AABB result;
+	result.min = gm_vec3_subtract(aabb->min, (vec3){margin, margin, margin});
+	result.max = gm_vec3_add(aabb->max, (vec3){margin, margin, margin});
+	return result;
+}
+
+r64 collider_aabb_get_surface_area(const Collider_AABB* aabb) {
+	vec3 d = gm_vec3_subtract(aabb->max, aabb->min);
+	return 2.0 * (d.x * d.y + d.y * d.z + d.z * d.x);
 }
\ No newline at end of file
@@ -3,26 +3,50 @@
 #include <gm.h>
 #include "../quaternion.h"
 
+#define COLLIDER_SOA_PADDING 8
+
+// The normal points from the first collider towards the second one, and (collision_point1 - collision_point2) . normal is
+// the signed penetration of the contact: speculative contacts, between colliders that are still apart, have it negative.
 typedef struct {
 	vec3 collision_point1;
 	vec3 collision_point2;
 	vec3 normal;
+	u32 feature_id; // identifies the features of both colliders that generated the contact, stable across frames
 } Collider_Contact;
 
+typedef struct {
+	vec3 min;
+	vec3 max;
+} Collider_AABB;
+
 typedef struct {
 	u32* elements;
 	vec3 normal;
 } Collider_Convex_Hull_Face;
 
+typedef struct {
+	u32 v1, v2;
+	u32 face1, face2; // the two faces that share the edge
+} Collider_Convex_Hull_Edge;
+
 typedef struct {
 	vec3* vertices;
-	vec3* transformed_vertices;
 	Collider_Convex_Hull_Face* faces;
-	Collider_Convex_Hull_Face* transformed_faces;
+	Collider_Convex_Hull_Edge* edges; // each edge is stored once, used by SAT
 
 	u32** vertex_to_faces;
 	u32** vertex_to_neighbors;
 	u32** face_to_neighbors;
+
+	boolean has_concave_edges; // the mesh is only approximately convex (see 'support_point_get_index')
+
+	// Single precision structure-of-arrays copy of 'vertices', used by the vectorized support scan. Each array is
+	// 32-byte aligned and padded with copies of the first vertex up to a multiple of COLLIDER_SOA_PADDING vertices.
+	void* soa_memory;
+	r32* soa_x;
+	r32* soa_y;
+	r32* soa_z;
+	u32 soa_length;
 } Collider_Convex_Hull;
 
 typedef struct {
@@ -30,6 +54,35 @@ typedef struct {
 	vec3 center;
 } Collider_Sphere;
 
+typedef enum {
+	COLLIDER_SAT_AXIS_NONE,
+	COLLIDER_SAT_AXIS_FACE1, // normal of a face of the first collider
+	COLLIDER_SAT_AXIS_FACE2, // normal of a face of the second collider
+	COLLIDER_SAT_AXIS_EDGES  // cross product of an edge of each collider
+} Collider_SAT_Axis_Type;
+
+// Last axis found by SAT for a pair of colliders, see 'sat_collides'
+typedef struct {
+	Collider_SAT_Axis_Type axis_type;
+	u32 axis_index1;        // face or edge of the first collider
+	u32 axis_index2;        // face or edge of the second collider
+	boolean penetrating;    // the axis was the axis of minimum penetration, not a separating axis
+	// Pose of the second collider in the local space of the first one when the axis was found by a full search
+	mat3 relative_rotation;
+	vec3 relative_position;
+} Collider_SAT_Cache;
+
+// Data kept between calls for the same pair of colliders, so the narrow phase can start close to its previous result
+typedef struct {
+	vec3 gjk_direction; // last search direction of GJK, zero if there is none
+	Collider_SAT_Cache sat;
+} Collider_Pair_Cache;
+
+typedef struct {
+	u64 num_updates;          // calls to 'colliders_update'
+	u64 num_skipped_updates;  // calls that found the pose unchanged since the previous one, so nothing was recalculated
+} Collider_Update_Statistics;
+
 typedef enum {
 	COLLIDER_TYPE_SPHERE,
 	COLLIDER_TYPE_CONVEX_HULL
@@ -37,6 +90,12 @@ typedef enum {
 
 typedef struct {
 	Collider_Type type;
+	Collider_AABB local_aabb; // bounds in the local space of the entity, calculated when the collider is created
+	// Pose set by 'colliders_update'. Hull data stays in local space: support queries rotate the direction into local
+	// space and only transform the selected vertex, and clipping transforms the few vertices and normals it touches.
+	vec3 world_position;
+	Quaternion world_rotation;
+	mat3 world_rotation_matrix;
 	union {
 		Collider_Convex_Hull convex_hull;
 		Collider_Sphere sphere;
@@ -48,10 +107,22 @@ typedef struct {
 Collider collider_convex_hull_create(const vec3* vertices, const u32* indices);
 Collider collider_sphere_create(const r32 radius);
 
-void colliders_update(Collider* colliders, vec3 translation, const Quaternion* rotation);
+boolean colliders_update(Collider* colliders, vec3 translation, const Quaternion* rotation);
+Collider_Update_Statistics colliders_get_update_statistics();
+void colliders_reset_update_statistics();
+vec3 collider_convex_hull_get_world_vertex(const Collider* collider, u32 vertex_idx);
+vec3 collider_convex_hull_get_world_normal(const Collider* collider, u32 face_idx);
 void colliders_destroy(Collider* collider);
 mat3 colliders_get_default_inertia_tensor(Collider* colliders, r64 mass);
 r64 colliders_get_bounding_sphere_radius(const Collider* colliders);
-Collider_Contact* colliders_get_contacts(Collider* colliders1, Collider* colliders2);
+void collider_get_contacts(Collider* collider1, Collider* collider2, Collider_Pair_Cache* cache, r64 margin, Collider_Contact** contacts);
+Collider_Contact* colliders_get_contacts(Collider* colliders1, Collider* colliders2, r64 margin);
+Collider_AABB colliders_get_aabb(const Collider* colliders, vec3 translation, const Quaternion* rotation);
+
+boolean collider_aabb_overlaps(const Collider_AABB* a, const Collider_AABB* b);
+boolean collider_aabb_contains(const Collider_AABB* container, const Collider_AABB* aabb);
+Collider_AABB collider_aabb_merge(const Collider_AABB* a, const Collider_AABB* b);
+Collider_AABB collider_aabb_expand(const Collider_AABB* aabb, r64 margin);
+r64 collider_aabb_get_surface_area(const Collider_AABB* aabb);
 
 #endif
\ No newline at end of file
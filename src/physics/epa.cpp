@@ -2,31 +2,75 @@
 #include <light_array.h>
 #include <float.h>
 #include "support.h"
+#include "../thread_pool.h"
 
-static const r64 EPSILON = 0.0001;
-
-void polytope_from_gjk_simplex(const GJK_Simplex* s, vec3** _polytope, dvec3** _faces) {
-	assert(s->num == 4);
-	vec3* polytope = array_new_len(vec3, 4);
-	dvec3* faces = array_new_len(dvec3, 4);
+// Expanding Polytope Algorithm
+// The faces that are still part of the polytope are kept in a min-heap ordered by their distance to the origin, so the
+// closest face is found without scanning all of them. Faces removed while expanding the polytope are only marked, and
+// are discarded once they reach the top of the heap. The horizon is built with a small open-addressing hash set of
+// edges. All buffers live in a per-thread scratch arena that is reused between calls, so EPA doesn't allocate once the
+// buffers are big enough.
 
-	array_push(polytope, s->a);
-	array_push(polytope, s->b);
-	array_push(polytope, s->c);
-	array_push(polytope, s->d);
-
-	dvec3 i1 = (dvec3){0, 1, 2}; // ABC
-	dvec3 i2 = (dvec3){0, 2, 3}; // ACD
-	dvec3 i3 = (dvec3){0, 3, 1}; // ADB
-	dvec3 i4 = (dvec3){1, 2, 3}; // BCD
-
-	array_push(faces, i1);
-	array_push(faces, i2);
-	array_push(faces, i3);
-	array_push(faces, i4);
+static const r64 EPSILON = 0.0001;
+#define EPA_MAX_ITERATIONS 100
+#define EPA_EDGE_SET_EMPTY ((u32)-1)
+
+typedef struct {
+	dvec3 vertices;
+	vec3 normal;
+	r64 distance;
+	boolean removed;
+} EPA_Face;
+
+typedef struct {
+	s32 v1, v2;
+	boolean is_horizon; // an edge shared by two removed faces is not part of the horizon
+} EPA_Edge;
+
+struct EPA_Scratch {
+	vec3* polytope;
+	EPA_Face* faces;
+	u32* heap;          // indices of faces, the closest one to the origin first
+	u32* visible_faces;
+	EPA_Edge* edges;
+	u32* edge_set;      // indices of edges, the length is always a power of two
+
+	~EPA_Scratch() {
+		if (polytope) {
+			array_free(polytope);
+			array_free(faces);
+			array_free(heap);
+			array_free(visible_faces);
+			array_free(edges);
+			array_free(edge_set);
+		}
+	}
+};
+
+// EPA runs in parallel for pairs of different simulation islands
+static thread_local EPA_Scratch scratch;
+
+// One slot per worker thread, each in its own cache line, so that the workers never write to the same memory
+static struct {
+	alignas(64) u64 num_calls;
+	u64 num_iterations;
+	u64 num_failures;
+	u32 max_iterations;
+} epa_statistics[THREAD_POOL_MAX_THREADS];
+
+static void scratch_prepare() {
+	if (!scratch.polytope) {
+		scratch.polytope = array_new_len(vec3, 128);
+		scratch.faces = array_new_len(EPA_Face, 256);
+		scratch.heap = array_new_len(u32, 256);
+		scratch.visible_faces = array_new_len(u32, 64);
+		scratch.edges = array_new_len(EPA_Edge, 128);
+		scratch.edge_set = array_new_len(u32, 256);
+	}
 
-	*_polytope = polytope;
-	*_faces = faces;
+	array_clear(scratch.polytope);
+	array_clear(scratch.faces);
+	array_clear(scratch.heap);
 }
 
 void get_face_normal_and_distance_to_origin(dvec3 face, vec3* polytope, vec3* _normal, r64* _distance) {
@@ -76,37 +120,140 @@ void get_face_normal_and_distance_to_origin(dvec3 face, vec3* polytope, vec3* _n
 	*_distance = distance;
 }
 
-void add_edge(dvec2** edges, dvec2 edge, vec3* polytope) {
-	// @TODO: we can use a hash table here
-	for (u32 i = 0; i < array_length(*edges); ++i) {
-		dvec2 current = (*edges)[i];
-		if (edge.x == current.x && edge.y == current.y) {
-			array_remove(*edges, i);
-			return;
+// Ties are broken by index, so the result doesn't depend on the layout of the heap
+static boolean is_face_closer(u32 face1_idx, u32 face2_idx) {
+	const EPA_Face* f1 = &scratch.faces[face1_idx];
+	const EPA_Face* f2 = &scratch.faces[face2_idx];
+	return f1->distance < f2->distance || (f1->distance == f2->distance && face1_idx < face2_idx);
+}
+
+static void heap_push(u32 face_idx) {
+	u32 i = array_length(scratch.heap);
+	array_push(scratch.heap, face_idx);
+	while (i > 0) {
+		u32 parent = (i - 1) / 2;
+		if (!is_face_closer(scratch.heap[i], scratch.heap[parent])) {
+			break;
 		}
-		if (edge.x == current.y && edge.y == current.x) {
-			array_remove(*edges, i);
-			return;
+		u32 tmp = scratch.heap[i];
+		scratch.heap[i] = scratch.heap[parent];
+		scratch.heap[parent] = tmp;
+		i = parent;
+	}
+}
+
+static void heap_pop() {
+	u32 length = --array_length(scratch.heap);
+	if (length == 0) {
+		return;
+	}
+
+	scratch.heap[0] = scratch.heap[length];
+	u32 i = 0;
+	for (;;) {
+		u32 left = 2 * i + 1;
+		u32 right = left + 1;
+		u32 closest = i;
+		if (left < length && is_face_closer(scratch.heap[left], scratch.heap[closest])) {
+			closest = left;
+		}
+		if (right < length && is_face_closer(scratch.heap[right], scratch.heap[closest])) {
+			closest = right;
 		}
+		if (closest == i) {
+			break;
+		}
+		u32 tmp = scratch.heap[i];
+		scratch.heap[i] = scratch.heap[closest];
+		scratch.heap[closest] = tmp;
+		i = closest;
+	}
+}
+
+// Returns the closest face that is still part of the polytope, or -1 if there is none
+static s32 heap_get_closest_face() {
+	while (array_length(scratch.heap) > 0) {
+		u32 face_idx = scratch.heap[0];
+		if (!scratch.faces[face_idx].removed) {
+			return (s32)face_idx;
+		}
+		heap_pop();
+	}
+
+	return -1;
+}
+
+static void add_face(dvec3 vertices) {
+	EPA_Face face;
+	face.vertices = vertices;
+	face.removed = false;
+	get_face_normal_and_distance_to_origin(vertices, scratch.polytope, &face.normal, &face.distance);
 
-		// @TEMPORARY: Once indexes point to unique vertices, this won't be needed.
-		vec3 current_v1 = polytope[current.x];
-		vec3 current_v2 = polytope[current.y];
-		vec3 edge_v1 = polytope[edge.x];
-		vec3 edge_v2 = polytope[edge.y];
+	u32 face_idx = array_length(scratch.faces);
+	array_push(scratch.faces, face);
+	heap_push(face_idx);
+}
+
+static void polytope_from_gjk_simplex(const GJK_Simplex* s) {
+	assert(s->num == 4);
+
+	array_push(scratch.polytope, s->a);
+	array_push(scratch.polytope, s->b);
+	array_push(scratch.polytope, s->c);
+	array_push(scratch.polytope, s->d);
+
+	add_face((dvec3){0, 1, 2}); // ABC
+	add_face((dvec3){0, 2, 3}); // ACD
+	add_face((dvec3){0, 3, 1}); // ADB
+	add_face((dvec3){1, 2, 3}); // BCD
+}
 
-		if (gm_vec3_equal(current_v1, edge_v1) && gm_vec3_equal(current_v2, edge_v2)) {
-			array_remove(*edges, i);
+// Support points that were already found (e.g., a hull vertex found again) keep their index, so edges can be compared
+// by index when building the horizon
+static s32 add_polytope_vertex(vec3 point) {
+	for (u32 i = 0; i < array_length(scratch.polytope); ++i) {
+		if (gm_vec3_equal(scratch.polytope[i], point)) {
+			return (s32)i;
+		}
+	}
+
+	array_push(scratch.polytope, point);
+	return (s32)array_length(scratch.polytope) - 1;
+}
+
+static void edge_set_reset(u32 max_edges) {
+	u32 capacity = 16;
+	while (capacity < 2 * max_edges) {
+		capacity *= 2;
+	}
+
+	array_clear(scratch.edge_set);
+	for (u32 i = 0; i < capacity; ++i) {
+		array_push(scratch.edge_set, EPA_EDGE_SET_EMPTY);
+	}
+	array_clear(scratch.edges);
+}
+
+// Adds the edge to the horizon. If it was already there, it is shared by two removed faces and leaves the horizon.
+static void edge_set_toggle(s32 v1, s32 v2) {
+	u32 a = (u32)MIN(v1, v2);
+	u32 b = (u32)MAX(v1, v2);
+	u32 mask = array_length(scratch.edge_set) - 1;
+	for (u32 h = ((a * 0x9E3779B1u) ^ (b * 0x85EBCA77u)) & mask;; h = (h + 1) & mask) {
+		u32 edge_idx = scratch.edge_set[h];
+		if (edge_idx == EPA_EDGE_SET_EMPTY) {
+			EPA_Edge edge = (EPA_Edge){v1, v2, true};
+			scratch.edge_set[h] = array_length(scratch.edges);
+			array_push(scratch.edges, edge);
 			return;
 		}
 
-		if (gm_vec3_equal(current_v1, edge_v2) && gm_vec3_equal(current_v2, edge_v1)) {
-			array_remove(*edges, i);
+		EPA_Edge* edge = &scratch.edges[edge_idx];
+		if ((u32)MIN(edge->v1, edge->v2) == a && (u32)MAX(edge->v1, edge->v2) == b) {
+			edge->is_horizon = !edge->is_horizon;
 			return;
 		}
 	}
-
-	array_push(*edges, edge);
 }
 
 static vec3 triangle_centroid(vec3 p1, vec3 p2, vec3 p3) {
@@ -115,38 +262,33 @@ static vec3 triangle_centroid(vec3 p1, vec3 p2, vec3 p3) {
 	return centroid;
 }
 
+static void update_statistics(u32 num_iterations, boolean converged) {
+	u32 worker = thread_pool_get_current_worker();
+	++epa_statistics[worker].num_calls;
+	epa_statistics[worker].num_iterations += num_iterations;
+	if (!converged) {
+		++epa_statistics[worker].num_failures;
+	}
+	epa_statistics[worker].max_iterations = MAX(epa_statistics[worker].max_iterations, num_iterations);
+}
+
 boolean epa(Collider* collider1, Collider* collider2, GJK_Simplex* simplex, vec3* _normal, r64* _penetration) {
-	vec3* polytope;
-	dvec3* faces;
+	scratch_prepare();
 
 	// build initial polytope from GJK simplex
-	polytope_from_gjk_simplex(simplex, &polytope, &faces);
-
-	vec3* normals = array_new_len(vec3, 128);
-	r64* faces_distance_to_origin = array_new_len(r64, 128);
-
-	vec3 min_normal;
-	r64 min_distance = DBL_MAX;
-
-	for (u32 i = 0; i < array_length(faces); ++i) {
-		vec3 normal;
-		r64 distance;
-		dvec3 face = faces[i];
+	polytope_from_gjk_simplex(simplex);
 
-		get_face_normal_and_distance_to_origin(face, polytope, &normal, &distance);
-
-		array_push(normals, normal);
-		array_push(faces_distance_to_origin, distance);
-
-		if (distance < min_distance) {
-			min_distance = distance;
-			min_normal = normal;
+	boolean converged = false;
+	u32 num_iterations = 0;
+	for (u32 it = 0; it < EPA_MAX_ITERATIONS; ++it) {
+		s32 min_face_idx = heap_get_closest_face();
+		if (min_face_idx < 0) {
+			break;
 		}
-	}
+		vec3 min_normal = scratch.faces[min_face_idx].normal;
+		r64 min_distance = scratch.faces[min_face_idx].distance;
 
-	dvec2* edges = array_new_len(dvec2, 1024);
-	boolean converged = false;
-	for (u32 it = 0; it < 100; ++it) {
+		++num_iterations;
 		vec3 support_point = support_point_of_minkowski_difference(collider1, collider2, min_normal);
 
 		// If the support time lies on the face currently set as the closest to the origin, we are done.
@@ -155,84 +297,78 @@ boolean epa(Collider* collider1, Collider* collider2, GJK_Simplex* simplex, vec3
 			*_normal = min_normal;
 			*_penetration = min_distance;
 			converged = true;
-			//printf("epa: took %d iterations to converge\n", it);
 			break;
 		}
 
 		// add new point to polytope
-		u32 new_point_index = array_length(polytope);
-		array_push(polytope, support_point);
-
-		// Expand Polytope
-		for (u32 i = 0; i < array_length(normals); ++i) {
-			vec3 normal = normals[i];
-			dvec3 face = faces[i];
+		s32 new_point_index = add_polytope_vertex(support_point);
+
+		// Remove all faces that can see the new point
+		array_clear(scratch.visible_faces);
+		u32 num_faces = array_length(scratch.faces);
+		for (u32 i = 0; i < num_faces; ++i) {
+			EPA_Face* face = &scratch.faces[i];
+			if (face->removed) {
+				continue;
+			}
 
-			// If the face normal points towards the support point, we need to reconstruct it.
 			vec3 centroid = triangle_centroid(
-				polytope[face.x],
-				polytope[face.y],
-				polytope[face.z]
+				scratch.polytope[face->vertices.x],
+				scratch.polytope[face->vertices.y],
+				scratch.polytope[face->vertices.z]
 			);
 
 			// If the face normal points towards the support point, we need to reconstruct it.
-			if (gm_vec3_dot(normal, gm_vec3_subtract(support_point, centroid)) > 0.0) {
-				dvec3 face = faces[i];
-
-				dvec2 edge1 = (dvec2){face.x, face.y};
-				dvec2 edge2 = (dvec2){face.y, face.z};
-				dvec2 edge3 = (dvec2){face.z, face.x};
-
-				add_edge(&edges, edge1, polytope);
-				add_edge(&edges, edge2, polytope);
-				add_edge(&edges, edge3, polytope);
-
-				// Relative order between the two arrays should be kept.
-				array_remove(faces, i);
-				array_remove(faces_distance_to_origin, i);
-				array_remove(normals, i);
-
-				--i;
+			if (gm_vec3_dot(face->normal, gm_vec3_subtract(support_point, centroid)) > 0.0) {
+				face->removed = true;
+				array_push(scratch.visible_faces, i);
 			}
 		}
 
-		for (u32 i = 0; i < array_length(edges); ++i) {
-			dvec2 edge = edges[i];
-			dvec3 new_face;
-			new_face.x = edge.x;
-			new_face.y = edge.y;
-			new_face.z = new_point_index;
-			array_push(faces, new_face);
-
-			vec3 new_face_normal;
-			r64 new_face_distance;
-			get_face_normal_and_distance_to_origin(new_face, polytope, &new_face_normal, &new_face_distance);
-
-			array_push(normals, new_face_normal);
-			array_push(faces_distance_to_origin, new_face_distance);
+		// The horizon is made of the edges that belong to a single removed face
+		edge_set_reset(3 * array_length(scratch.visible_faces));
+		for (u32 i = 0; i < array_length(scratch.visible_faces); ++i) {
+			dvec3 vertices = scratch.faces[scratch.visible_faces[i]].vertices;
+			edge_set_toggle(vertices.x, vertices.y);
+			edge_set_toggle(vertices.y, vertices.z);
+			edge_set_toggle(vertices.z, vertices.x);
 		}
 
-		min_distance = DBL_MAX;
-		for (u32 i = 0; i < array_length(faces_distance_to_origin); ++i) {
-			r64 distance = faces_distance_to_origin[i];
-			if (distance < min_distance) {
-				min_distance = distance;
-				min_normal = normals[i];
+		// Expand Polytope
+		for (u32 i = 0; i < array_length(scratch.edges); ++i) {
+			EPA_Edge edge = scratch.edges[i];
+			if (edge.is_horizon) {
+				add_face((dvec3){edge.v1, edge.v2, new_point_index});
 			}
 		}
-
-		array_clear(edges);
 	}
 
-	array_free(faces);
-	array_free(polytope);
-	array_free(normals);
-	array_free(faces_distance_to_origin);
-	array_free(edges);
+	update_statistics(num_iterations, converged);
 
 	if (!converged) {
 		printf("EPA did not converge.\n");
 	}
 
 	return converged;
-}
\ No newline at end of file
+}
+
+// Counters since the last reset, added up over the worker threads. Must not be called while the simulation runs.
+EPA_Statistics epa_get_statistics() {
+	EPA_Statistics statistics = {0};
+	for (u32 i = 0; i < THREAD_POOL_MAX_THREADS; ++i) {
+		statistics.num_calls += epa_statistics[i].num_calls;
+		statistics.num_iterations += epa_statistics[i].num_iterations;
+		statistics.num_failures += epa_statistics[i].num_failures;
+		statistics.max_iterations = MAX(statistics.max_iterations, epa_statistics[i].max_iterations);
+	}
+	return statistics;
+}
+
+void epa_reset_statistics() {
+	for (u32 i = 0; i < THREAD_POOL_MAX_THREADS; ++i) {
+		epa_statistics[i].num_calls = 0;
+		epa_statistics[i].num_iterations = 0;
+		epa_statistics[i].num_failures = 0;
+		epa_statistics[i].max_iterations = 0;
+	}
+}
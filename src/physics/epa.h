@@ -5,6 +5,15 @@
 #include <gm.h>
 #include "gjk.h"
 
+typedef struct {
+	u64 num_calls;
+	u64 num_iterations;   // support evaluations, summed over all calls
+	u64 num_failures;     // calls that did not converge
+	u32 max_iterations;   // most iterations needed by a single call
+} EPA_Statistics;
+
 boolean epa(Collider* collider1, Collider* collider2, GJK_Simplex* simplex, vec3* normal, r64* penetration);
+EPA_Statistics epa_get_statistics();
+void epa_reset_statistics();
 
 #endif
\ No newline at end of file
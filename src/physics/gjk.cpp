@@ -347,19 +347,38 @@ static boolean do_simplex(GJK_Simplex* simplex, vec3* direction) {
 	return false;
 }
 
-boolean gjk_collides(Collider* collider1, Collider* collider2, GJK_Simplex* _simplex) {
+// If 'warm_start_direction' is given, the search starts from it and the last search direction is stored back in it.
+// Colliders barely move between calls, so the previous direction usually still separates them (and then a single
+// support evaluation is enough), or is close to the direction that leads to the origin.
+boolean gjk_collides(Collider* collider1, Collider* collider2, GJK_Simplex* _simplex, vec3* warm_start_direction) {
 	GJK_Simplex simplex;
 
-	simplex.a = support_point_of_minkowski_difference(collider1, collider2, (vec3){0.0, 0.0, 1.0});
+	vec3 direction = (vec3){0.0, 0.0, 1.0};
+	if (warm_start_direction && !gm_vec3_is_zero(*warm_start_direction)) {
+		direction = *warm_start_direction;
+	}
+
+	simplex.a = support_point_of_minkowski_difference(collider1, collider2, direction);
 	simplex.num = 1; 
 
-	vec3 direction = gm_vec3_scalar_product(-1.0, simplex.a);
+	if (gm_vec3_dot(simplex.a, direction) < 0.0) {
+		// No intersection, the whole Minkowski difference is behind the direction.
+		if (warm_start_direction) {
+			*warm_start_direction = direction;
+		}
+		return false;
+	}
+
+	direction = gm_vec3_scalar_product(-1.0, simplex.a);
 
 	for (u32 i = 0; i < 100; ++i) {
 		vec3 next_point = support_point_of_minkowski_difference(collider1, collider2, direction);
 		
 		if (gm_vec3_dot(next_point, direction) < 0.0) {
 			// No intersection.
+			if (warm_start_direction) {
+				*warm_start_direction = direction;
+			}
 			return false;
 		}
 
@@ -370,6 +389,9 @@ boolean gjk_collides(Collider* collider1, Collider* collider2, GJK_Simplex* _sim
 			if (_simplex) {
 				*_simplex = simplex;
 			}
+			if (warm_start_direction) {
+				*warm_start_direction = direction;
+			}
 			return true;
 		}
 	}
@@ -377,3 +399,225 @@ boolean gjk_collides(Collider* collider1, Collider* collider2, GJK_Simplex* _sim
 	//printf("GJK did not converge.\n");
 	return false;
 }
+
+#define GJK_DISTANCE_MAX_ITERATIONS 64
+#define GJK_DISTANCE_RELATIVE_TOLERANCE 1e-6
+#define GJK_DISTANCE_EPSILON 1e-12
+
+// Vertex of the simplex of the distance query, together with the support points of both colliders that formed it
+typedef struct {
+	vec3 point;
+	vec3 support1;
+	vec3 support2;
+} GJK_Distance_Vertex;
+
+typedef struct {
+	GJK_Distance_Vertex vertices[4];
+	r64 weights[4]; // barycentric coordinates of the point of the simplex closest to the origin
+	u32 num;
+} GJK_Distance_Simplex;
+
+static GJK_Distance_Vertex get_distance_vertex(Collider* collider1, Collider* collider2, vec3 direction) {
+	GJK_Distance_Vertex vertex;
+	vertex.support1 = support_point(collider1, direction);
+	vertex.support2 = support_point(collider2, gm_vec3_invert(direction));
+	vertex.point = gm_vec3_subtract(vertex.support1, vertex.support2);
+	return vertex;
+}
+
+// Barycentric coordinates of the point of the triangle closest to the origin (Ericson, Real-Time Collision Detection, 5.1.5)
+static void get_triangle_closest_point_weights(vec3 a, vec3 b, vec3 c, r64 weights[3]) {
+	vec3 ab = gm_vec3_subtract(b, a);
+	vec3 ac = gm_vec3_subtract(c, a);
+
+	r64 d1 = -gm_vec3_dot(ab, a);
+	r64 d2 = -gm_vec3_dot(ac, a);
+	if (d1 <= 0.0 && d2 <= 0.0) {
+		// A region
+		weights[0] = 1.0; weights[1] = 0.0; weights[2] = 0.0;
+		return;
+	}
+
+	r64 d3 = -gm_vec3_dot(ab, b);
+	r64 d4 = -gm_vec3_dot(ac, b);
+	if (d3 >= 0.0 && d4 <= d3) {
+		// B region
+		weights[0] = 0.0; weights[1] = 1.0; weights[2] = 0.0;
+		return;
+	}
+
+	r64 vc = d1 * d4 - d3 * d2;
+	if (vc <= 0.0 && d1 >= 0.0 && d3 <= 0.0) {
+		// AB region
+		r64 v = d1 / (d1 - d3);
+		weights[0] = 1.0 - v; weights[1] = v; weights[2] = 0.0;
+		return;
+	}
+
+	r64 d5 = -gm_vec3_dot(ab, c);
+	r64 d6 = -gm_vec3_dot(ac, c);
+	if (d6 >= 0.0 && d5 <= d6) {
+		// C region
+		weights[0] = 0.0; weights[1] = 0.0; weights[2] = 1.0;
+		return;
+	}
+
+	r64 vb = d5 * d2 - d1 * d6;
+	if (vb <= 0.0 && d2 >= 0.0 && d6 <= 0.0) {
+		// AC region
+		r64 w = d2 / (d2 - d6);
+		weights[0] = 1.0 - w; weights[1] = 0.0; weights[2] = w;
+		return;
+	}
+
+	r64 va = d3 * d6 - d5 * d4;
+	if (va <= 0.0 && (d4 - d3) >= 0.0 && (d5 - d6) >= 0.0) {
+		// BC region
+		r64 w = (d4 - d3) / ((d4 - d3) + (d5 - d6));
+		weights[0] = 0.0; weights[1] = 1.0 - w; weights[2] = w;
+		return;
+	}
+
+	// ABC region
+	r64 denominator = 1.0 / (va + vb + vc);
+	r64 v = vb * denominator;
+	r64 w = vc * denominator;
+	weights[0] = 1.0 - v - w; weights[1] = v; weights[2] = w;
+}
+
+static vec3 get_simplex_closest_point(const GJK_Distance_Simplex* simplex) {
+	vec3 closest_point = (vec3){0.0, 0.0, 0.0};
+	for (u32 i = 0; i < simplex->num; ++i) {
+		closest_point = gm_vec3_add(closest_point, gm_vec3_scalar_product(simplex->weights[i], simplex->vertices[i].point));
+	}
+	return closest_point;
+}
+
+// Finds the point of the simplex closest to the origin and drops the vertices that don't contribute to it.
+// Returns false if the origin is inside the tetrahedron, that is, if the colliders overlap.
+static boolean update_distance_simplex(GJK_Distance_Simplex* simplex) {
+	GJK_Distance_Vertex* v = simplex->vertices;
+	r64* weights = simplex->weights;
+
+	switch (simplex->num) {
+		case 1: {
+			weights[0] = 1.0;
+		} break;
+		case 2: {
+			vec3 ab = gm_vec3_subtract(v[1].point, v[0].point);
+			r64 ab_length_squared = gm_vec3_dot(ab, ab);
+			r64 t = (ab_length_squared > GJK_DISTANCE_EPSILON) ? -gm_vec3_dot(v[0].point, ab) / ab_length_squared : 0.0;
+			t = MAX(0.0, MIN(1.0, t));
+			weights[0] = 1.0 - t;
+			weights[1] = t;
+		} break;
+		case 3: {
+			get_triangle_closest_point_weights(v[0].point, v[1].point, v[2].point, weights);
+		} break;
+		case 4: {
+			// Each face is given with the vertex opposite to it. The origin can only be closest to the faces that have
+			// it on the other side of their plane; if there is none, the origin is inside.
+			const u32 faces[4][4] = {{0, 1, 2, 3}, {0, 2, 3, 1}, {0, 3, 1, 2}, {1, 3, 2, 0}};
+			r64 min_distance_squared = DBL_MAX;
+			r64 best_weights[4] = {0.0, 0.0, 0.0, 0.0};
+			boolean inside = true;
+			for (u32 i = 0; i < 4; ++i) {
+				vec3 a = v[faces[i][0]].point;
+				vec3 b = v[faces[i][1]].point;
+				vec3 c = v[faces[i][2]].point;
+				vec3 d = v[faces[i][3]].point;
+				vec3 normal = gm_vec3_cross(gm_vec3_subtract(b, a), gm_vec3_subtract(c, a));
+				// Faces of a flat tetrahedron are treated as if the origin were outside of them
+				if (-gm_vec3_dot(a, normal) * gm_vec3_dot(gm_vec3_subtract(d, a), normal) > 0.0) {
+					continue;
+				}
+				inside = false;
+
+				r64 face_weights[3];
+				get_triangle_closest_point_weights(a, b, c, face_weights);
+				vec3 closest_point = gm_vec3_add(gm_vec3_add(gm_vec3_scalar_product(face_weights[0], a),
+					gm_vec3_scalar_product(face_weights[1], b)), gm_vec3_scalar_product(face_weights[2], c));
+				r64 distance_squared = gm_vec3_dot(closest_point, closest_point);
+				if (distance_squared < min_distance_squared) {
+					min_distance_squared = distance_squared;
+					best_weights[faces[i][0]] = face_weights[0];
+					best_weights[faces[i][1]] = face_weights[1];
+					best_weights[faces[i][2]] = face_weights[2];
+					best_weights[faces[i][3]] = 0.0;
+				}
+			}
+
+			if (inside) {
+				return false;
+			}
+
+			for (u32 i = 0; i < 4; ++i) {
+				weights[i] = best_weights[i];
+			}
+		} break;
+		default: {
+			assert(0);
+		} break;
+	}
+
+	// Keep only the vertices that contribute to the closest point
+	u32 num = 0;
+	for (u32 i = 0; i < simplex->num; ++i) {
+		if (weights[i] > 0.0) {
+			v[num] = v[i];
+			weights[num] = weights[i];
+			++num;
+		}
+	}
+	simplex->num = num;
+
+	return true;
+}
+
+// Distance between two colliders, and the closest point of each one of them, in world coords.
+// Returns 0 if the colliders overlap, in which case the closest points are not meaningful.
+r64 gjk_get_distance(Collider* collider1, Collider* collider2, vec3* closest_point1, vec3* closest_point2) {
+	GJK_Distance_Simplex simplex;
+	simplex.vertices[0] = get_distance_vertex(collider1, collider2, (vec3){1.0, 0.0, 0.0});
+	simplex.weights[0] = 1.0;
+	simplex.num = 1;
+
+	vec3 closest_point = simplex.vertices[0].point;
+	for (u32 i = 0; i < GJK_DISTANCE_MAX_ITERATIONS; ++i) {
+		r64 distance_squared = gm_vec3_dot(closest_point, closest_point);
+		if (distance_squared < GJK_DISTANCE_EPSILON) {
+			return 0.0;
+		}
+
+		GJK_Distance_Vertex vertex = get_distance_vertex(collider1, collider2, gm_vec3_invert(closest_point));
+
+		// The new support point doesn't get meaningfully closer to the origin than the current closest point
+		if (distance_squared - gm_vec3_dot(closest_point, vertex.point) <= GJK_DISTANCE_RELATIVE_TOLERANCE * distance_squared) {
+			break;
+		}
+
+		simplex.vertices[simplex.num] = vertex;
+		simplex.weights[simplex.num] = 0.0;
+		++simplex.num;
+		if (!update_distance_simplex(&simplex)) {
+			return 0.0;
+		}
+
+		vec3 new_closest_point = get_simplex_closest_point(&simplex);
+		if (gm_vec3_dot(new_closest_point, new_closest_point) >= distance_squared) {
+			// No progress, due to numerical errors
+			closest_point = new_closest_point;
+			break;
+		}
+		closest_point = new_closest_point;
+	}
+
+	*closest_point1 = (vec3){0.0, 0.0, 0.0};
+	*closest_point2 = (vec3){0.0, 0.0, 0.0};
+	for (u32 i = 0; i < simplex.num; ++i) {
+		*closest_point1 = gm_vec3_add(*closest_point1, gm_vec3_scalar_product(simplex.weights[i], simplex.vertices[i].support1));
+		*closest_point2 = gm_vec3_add(*closest_point2, gm_vec3_scalar_product(simplex.weights[i], simplex.vertices[i].support2));
+	}
+
+	return gm_vec3_length(closest_point);
+}
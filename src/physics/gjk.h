@@ -10,6 +10,7 @@ typedef struct {
 	u32 num;
 } GJK_Simplex;
 
-boolean gjk_collides(Collider* collider1, Collider* collider2, GJK_Simplex* simplex);
+boolean gjk_collides(Collider* collider1, Collider* collider2, GJK_Simplex* simplex, vec3* warm_start_direction);
+r64 gjk_get_distance(Collider* collider1, Collider* collider2, vec3* closest_point1, vec3* closest_point2);
 
 #endif
\ No newline at end of file
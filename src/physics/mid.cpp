@@ -0,0 +1,178 @@
+#include "mid.h"
+#include "pair_cache.h"
+#include "clipping.h"
+#include <light_array.h>
+
+// Mid-phase
+// Entities made of several colliders (e.g. a convex decomposition of a concave mesh) keep a BVH over the local bounds of
+// their colliders, built once when the entity is created. When two entities are close, the colliders of one of them are
+// tested against the tree of the other one, so only the pairs of colliders whose bounds overlap reach GJK.
+//
+// Every pair of colliders also has a cache that the narrow phase reuses in the next substeps and frames. The caches of
+// an entity pair are stored in the slot of the pair in the pair cache. A pair belongs to a single simulation island, so
+// its caches are only touched by one thread at a time.
+
+typedef struct {
+	u32 generation;                     // generation of the pair cache slot when the caches were created
+	eid e1_id;                          // the caches depend on the order of the entities
+	u32 num_colliders1;
+	u32 num_colliders2;
+	Collider_Pair_Cache* collider_pairs; // indexed by i * num_colliders2 + j
+} Mid_Pair_Data;
+
+typedef struct {
+	Collider* query_collider;
+	u32 query_collider_idx;
+	Collider* tree_colliders;
+	boolean query_is_first;    // whether the query collider belongs to the first entity of the pair
+	Mid_Pair_Data* pair_data;
+	r64 margin;
+	Collider_Contact** contacts;
+} Mid_Query_Context;
+
+static Mid_Pair_Data* pair_data_by_slot;
+
+// Makes room for the caches of all pairs in the pair cache. Must be called after 'pair_cache_update' and before the
+// contacts of the pairs are requested.
+void mid_update_pair_caches() {
+	if (!pair_data_by_slot) {
+		pair_data_by_slot = array_new_len(Mid_Pair_Data, 256);
+	}
+
+	Mid_Pair_Data empty = {0};
+	while (array_length(pair_data_by_slot) < pair_cache_get_capacity()) {
+		array_push(pair_data_by_slot, empty);
+	}
+}
+
+static Mid_Pair_Data* get_pair_data(Entity* e1, Entity* e2, u32 slot) {
+	if (slot == PAIR_CACHE_INVALID_SLOT) {
+		return NULL;
+	}
+
+	assert(slot < array_length(pair_data_by_slot));
+	Mid_Pair_Data* pair_data = &pair_data_by_slot[slot];
+	u32 num_colliders1 = array_length(e1->colliders);
+	u32 num_colliders2 = array_length(e2->colliders);
+	u32 generation = pair_cache_get_pair(slot)->generation;
+
+	// The slot was reused by another pair, or the pair changed since the caches were created
+	if (pair_data->generation != generation || pair_data->e1_id != e1->id ||
+		pair_data->num_colliders1 != num_colliders1 || pair_data->num_colliders2 != num_colliders2) {
+		if (!pair_data->collider_pairs) {
+			pair_data->collider_pairs = array_new_len(Collider_Pair_Cache, num_colliders1 * num_colliders2);
+		}
+		array_clear(pair_data->collider_pairs);
+		Collider_Pair_Cache empty = {0};
+		for (u32 i = 0; i < num_colliders1 * num_colliders2; ++i) {
+			array_push(pair_data->collider_pairs, empty);
+		}
+		pair_data->generation = generation;
+		pair_data->e1_id = e1->id;
+		pair_data->num_colliders1 = num_colliders1;
+		pair_data->num_colliders2 = num_colliders2;
+	}
+
+	return pair_data;
+}
+
+static Collider_Pair_Cache* get_collider_pair_cache(Mid_Pair_Data* pair_data, u32 collider1_idx, u32 collider2_idx) {
+	if (!pair_data) {
+		return NULL;
+	}
+	return &pair_data->collider_pairs[collider1_idx * pair_data->num_colliders2 + collider2_idx];
+}
+
+// Builds the tree over the local bounds of the colliders. The user data of each leaf is the index of its collider.
+void mid_create_colliders_bvh(const Collider* colliders, Bvh* bvh) {
+	bvh_create(bvh);
+	for (u32 i = 0; i < array_length(colliders); ++i) {
+		bvh_insert(bvh, colliders[i].local_aabb, 0.0, i);
+	}
+}
+
+// Transforms an AABB given in the local space of 'from' to the local space of 'to'. The result bounds the rotated box.
+static Collider_AABB transform_local_aabb(const Collider_AABB* aabb, const Entity* from, const Entity* to) {
+	vec3 center = gm_vec3_scalar_product(0.5, gm_vec3_add(aabb->min, aabb->max));
+	vec3 extents = gm_vec3_scalar_product(0.5, gm_vec3_subtract(aabb->max, aabb->min));
+
+	// Rotation and translation that take points from the local space of 'from' to the local space of 'to'
+	Quaternion to_inverse_rotation = quaternion_inverse(&to->world_rotation);
+	Quaternion relative_rotation = quaternion_product(&to_inverse_rotation, &from->world_rotation);
+	mat3 r = quaternion_get_matrix3(&relative_rotation);
+	vec3 world_center = gm_vec3_add(from->world_position, quaternion_apply_to_vec3(&from->world_rotation, center));
+	vec3 new_center = quaternion_apply_to_vec3(&to_inverse_rotation, gm_vec3_subtract(world_center, to->world_position));
+
+	// Each axis of the new box is the projection of the rotated extents
+	vec3 new_extents;
+	new_extents.x = fabs(r.data[0][0]) * extents.x + fabs(r.data[0][1]) * extents.y + fabs(r.data[0][2]) * extents.z;
+	new_extents.y = fabs(r.data[1][0]) * extents.x + fabs(r.data[1][1]) * extents.y + fabs(r.data[1][2]) * extents.z;
+	new_extents.z = fabs(r.data[2][0]) * extents.x + fabs(r.data[2][1]) * extents.y + fabs(r.data[2][2]) * extents.z;
+
+	Collider_AABB result;
+	result.min = gm_vec3_subtract(new_center, new_extents);
+	result.max = gm_vec3_add(new_center, new_extents);
+	return result;
+}
+
+static boolean mid_query_callback(s32 leaf, u64 user_data, void* ctx) {
+	Mid_Query_Context* query_context = (Mid_Query_Context*)ctx;
+	Collider* tree_collider = &query_context->tree_colliders[user_data];
+	u32 first_contact = array_length(*query_context->contacts);
+	u32 collider1_idx, collider2_idx;
+	if (query_context->query_is_first) {
+		collider1_idx = query_context->query_collider_idx;
+		collider2_idx = (u32)user_data;
+		Collider_Pair_Cache* cache = get_collider_pair_cache(query_context->pair_data, collider1_idx, collider2_idx);
+		collider_get_contacts(query_context->query_collider, tree_collider, cache, query_context->margin, query_context->contacts);
+	} else {
+		collider1_idx = (u32)user_data;
+		collider2_idx = query_context->query_collider_idx;
+		Collider_Pair_Cache* cache = get_collider_pair_cache(query_context->pair_data, collider1_idx, collider2_idx);
+		collider_get_contacts(tree_collider, query_context->query_collider, cache, query_context->margin, query_context->contacts);
+	}
+
+	// Feature IDs are only unique within a pair of colliders, so the pair is mixed into the IDs of its contacts
+	Collider_Contact* contacts = *query_context->contacts;
+	for (u32 i = first_contact; i < array_length(contacts); ++i) {
+		contacts[i].feature_id = clipping_combine_feature_ids(contacts[i].feature_id,
+			clipping_combine_feature_ids(collider1_idx, collider2_idx));
+	}
+	return true;
+}
+
+// Same as 'colliders_get_contacts', but pairs of colliders whose bounds don't overlap (once grown by 'margin') are skipped.
+// The colliders of both entities must be updated. 'slot' is the slot of the pair in the pair cache, it can be
+// PAIR_CACHE_INVALID_SLOT if the pair is not in the cache (then nothing is reused between calls).
+Collider_Contact* mid_get_contacts(Entity* e1, Entity* e2, u32 slot, r64 margin) {
+	u32 num_colliders1 = array_length(e1->colliders);
+	u32 num_colliders2 = array_length(e2->colliders);
+	Mid_Pair_Data* pair_data = get_pair_data(e1, e2, slot);
+
+	if (num_colliders1 == 1 && num_colliders2 == 1) {
+		Collider_Contact* contacts = array_new_len(Collider_Contact, 16);
+		collider_get_contacts(&e1->colliders[0], &e2->colliders[0], get_collider_pair_cache(pair_data, 0, 0), margin, &contacts);
+		return contacts;
+	}
+
+	// The entity with more colliders is the one whose tree is queried
+	Entity* tree_entity = num_colliders1 >= num_colliders2 ? e1 : e2;
+	Entity* query_entity = num_colliders1 >= num_colliders2 ? e2 : e1;
+
+	Collider_Contact* contacts = array_new_len(Collider_Contact, 16);
+	Mid_Query_Context query_context;
+	query_context.tree_colliders = tree_entity->colliders;
+	query_context.query_is_first = query_entity == e1;
+	query_context.pair_data = pair_data;
+	query_context.margin = margin;
+	query_context.contacts = &contacts;
+	for (u32 i = 0; i < array_length(query_entity->colliders); ++i) {
+		query_context.query_collider = &query_entity->colliders[i];
+		query_context.query_collider_idx = i;
+		Collider_AABB aabb = transform_local_aabb(&query_context.query_collider->local_aabb, query_entity, tree_entity);
+		aabb = collider_aabb_expand(&aabb, margin);
+		bvh_query_aabb(&tree_entity->colliders_bvh, aabb, mid_query_callback, &query_context);
+	}
+
+	return contacts;
+}
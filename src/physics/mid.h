@@ -0,0 +1,9 @@
+#ifndef RAW_PHYSICS_PHYSICS_MID_H
+#define RAW_PHYSICS_PHYSICS_MID_H
+#include "../entity.h"
+
+void mid_create_colliders_bvh(const Collider* colliders, Bvh* bvh);
+void mid_update_pair_caches();
+Collider_Contact* mid_get_contacts(Entity* e1, Entity* e2, u32 slot, r64 margin);
+
+#endif
@@ -0,0 +1,253 @@
+#include "pair_cache.h"
+#include <light_array.h>
+#include <hash_map.h>
+
+// The pair cache keeps the pairs reported by the broad phase across frames. Each pair lives in a stable slot from the
+// frame it begins until the frame after it ends, so data associated with a pair (narrow-phase caches, contacts, ...)
+// can be stored in arrays indexed by slot.
+
+typedef struct {
+	eid e1_id;
+	eid e2_id;
+} Pair_Key;
+
+typedef struct {
+	boolean initialized;
+	u64 frame;
+	Cached_Pair* pairs;
+	u32* free_slots;
+	Hash_Map pair_to_slot_map;
+
+	u32* collision_pair_slots;
+	u32* began_slots;
+	u32* persisted_slots;
+	u32* ended_slots;
+
+	Pair_Cache_Event_Callback on_begin;
+	Pair_Cache_Event_Callback on_persist;
+	Pair_Cache_Event_Callback on_end;
+	void* callbacks_ctx;
+} Pair_Cache;
+
+static Pair_Cache pair_cache;
+
+static int pair_key_compare(const void *key1, const void *key2) {
+	const Pair_Key* k1 = (const Pair_Key*)key1;
+	const Pair_Key* k2 = (const Pair_Key*)key2;
+	return k1->e1_id == k2->e1_id && k1->e2_id == k2->e2_id;
+}
+
+static unsigned int pair_key_hash(const void *key) {
+	const Pair_Key* k = (const Pair_Key*)key;
+	u64 h = k->e1_id * 0x9E3779B97F4A7C15ULL;
+	h ^= k->e2_id + 0x7F4A7C159E3779B9ULL + (h << 6) + (h >> 2);
+	return (unsigned int)(h ^ (h >> 32));
+}
+
+static Pair_Key pair_key_new(eid e1_id, eid e2_id) {
+	Pair_Key key;
+	key.e1_id = MIN(e1_id, e2_id);
+	key.e2_id = MAX(e1_id, e2_id);
+	return key;
+}
+
+static void pair_cache_init() {
+	pair_cache.pairs = array_new_len(Cached_Pair, 256);
+	pair_cache.free_slots = array_new_len(u32, 256);
+	pair_cache.collision_pair_slots = array_new_len(u32, 256);
+	pair_cache.began_slots = array_new_len(u32, 64);
+	pair_cache.persisted_slots = array_new_len(u32, 256);
+	pair_cache.ended_slots = array_new_len(u32, 64);
+	assert(!hash_map_create(&pair_cache.pair_to_slot_map, 1024, sizeof(Pair_Key), sizeof(u32), pair_key_compare, pair_key_hash));
+	pair_cache.initialized = true;
+}
+
+static u32 pair_cache_allocate_slot(const Pair_Key* key) {
+	u32 slot;
+	if (array_length(pair_cache.free_slots) > 0) {
+		slot = pair_cache.free_slots[--array_length(pair_cache.free_slots)];
+	} else {
+		Cached_Pair empty = {0};
+		slot = array_length(pair_cache.pairs);
+		array_push(pair_cache.pairs, empty);
+	}
+
+	Cached_Pair* pair = &pair_cache.pairs[slot];
+	pair->e1_id = key->e1_id;
+	pair->e2_id = key->e2_id;
+	pair->state = PAIR_STATE_BEGIN;
+	pair->generation++;
+	pair->first_frame = pair_cache.frame;
+	pair->last_frame = pair_cache.frame;
+	pair->in_use = true;
+
+	int r = hash_map_put(&pair_cache.pair_to_slot_map, key, &slot);
+	assert(r == 0);
+	return slot;
+}
+
+static void pair_cache_release_slot(u32 slot) {
+	Cached_Pair* pair = &pair_cache.pairs[slot];
+	Pair_Key key = pair_key_new(pair->e1_id, pair->e2_id);
+	hash_map_delete(&pair_cache.pair_to_slot_map, &key);
+	pair->in_use = false;
+	array_push(pair_cache.free_slots, slot);
+}
+
+// Updates the cache with the pairs reported by the broad phase in this frame.
+// The order of 'collision_pairs' is preserved in 'pair_cache_get_collision_pair_slots'.
+void pair_cache_update(const Broad_Collision_Pair* collision_pairs) {
+	if (!pair_cache.initialized) {
+		pair_cache_init();
+	}
+
+	++pair_cache.frame;
+
+	// Pairs that ended in the previous update were kept alive for one frame, so their events could be consumed
+	for (u32 i = 0; i < array_length(pair_cache.ended_slots); ++i) {
+		pair_cache_release_slot(pair_cache.ended_slots[i]);
+	}
+
+	array_clear(pair_cache.collision_pair_slots);
+	array_clear(pair_cache.began_slots);
+	array_clear(pair_cache.persisted_slots);
+	array_clear(pair_cache.ended_slots);
+
+	for (u32 i = 0; i < array_length(collision_pairs); ++i) {
+		Pair_Key key = pair_key_new(collision_pairs[i].e1_id, collision_pairs[i].e2_id);
+		u32 slot;
+		if (hash_map_get(&pair_cache.pair_to_slot_map, &key, &slot)) {
+			slot = pair_cache_allocate_slot(&key);
+			array_push(pair_cache.began_slots, slot);
+		} else {
+			Cached_Pair* pair = &pair_cache.pairs[slot];
+			// The broad phase shouldn't report duplicates, but don't generate two events if it does
+			if (pair->last_frame != pair_cache.frame) {
+				pair->state = PAIR_STATE_PERSIST;
+				pair->last_frame = pair_cache.frame;
+				array_push(pair_cache.persisted_slots, slot);
+			}
+		}
+		array_push(pair_cache.collision_pair_slots, slot);
+	}
+
+	for (u32 i = 0; i < array_length(pair_cache.pairs); ++i) {
+		Cached_Pair* pair = &pair_cache.pairs[i];
+		if (pair->in_use && pair->last_frame != pair_cache.frame) {
+			pair->state = PAIR_STATE_END;
+			array_push(pair_cache.ended_slots, i);
+		}
+	}
+
+	if (pair_cache.on_begin) {
+		for (u32 i = 0; i < array_length(pair_cache.began_slots); ++i) {
+			u32 slot = pair_cache.began_slots[i];
+			pair_cache.on_begin(slot, &pair_cache.pairs[slot], pair_cache.callbacks_ctx);
+		}
+	}
+
+	if (pair_cache.on_persist) {
+		for (u32 i = 0; i < array_length(pair_cache.persisted_slots); ++i) {
+			u32 slot = pair_cache.persisted_slots[i];
+			pair_cache.on_persist(slot, &pair_cache.pairs[slot], pair_cache.callbacks_ctx);
+		}
+	}
+
+	if (pair_cache.on_end) {
+		for (u32 i = 0; i < array_length(pair_cache.ended_slots); ++i) {
+			u32 slot = pair_cache.ended_slots[i];
+			pair_cache.on_end(slot, &pair_cache.pairs[slot], pair_cache.callbacks_ctx);
+		}
+	}
+}
+
+// Releases all pairs, without generating END events. Useful when the whole scene is replaced.
+void pair_cache_clear() {
+	if (!pair_cache.initialized) {
+		return;
+	}
+
+	for (u32 i = 0; i < array_length(pair_cache.pairs); ++i) {
+		if (pair_cache.pairs[i].in_use) {
+			pair_cache_release_slot(i);
+		}
+	}
+
+	array_clear(pair_cache.collision_pair_slots);
+	array_clear(pair_cache.began_slots);
+	array_clear(pair_cache.persisted_slots);
+	array_clear(pair_cache.ended_slots);
+}
+
+void pair_cache_set_callbacks(Pair_Cache_Event_Callback on_begin, Pair_Cache_Event_Callback on_persist,
+	Pair_Cache_Event_Callback on_end, void* ctx) {
+	pair_cache.on_begin = on_begin;
+	pair_cache.on_persist = on_persist;
+	pair_cache.on_end = on_end;
+	pair_cache.callbacks_ctx = ctx;
+}
+
+u32 pair_cache_get_slot(eid e1_id, eid e2_id) {
+	if (!pair_cache.initialized) {
+		return PAIR_CACHE_INVALID_SLOT;
+	}
+
+	Pair_Key key = pair_key_new(e1_id, e2_id);
+	u32 slot;
+	if (hash_map_get(&pair_cache.pair_to_slot_map, &key, &slot)) {
+		return PAIR_CACHE_INVALID_SLOT;
+	}
+	return slot;
+}
+
+const Cached_Pair* pair_cache_get_pair(u32 slot) {
+	assert(slot < array_length(pair_cache.pairs));
+	return &pair_cache.pairs[slot];
+}
+
+// Number of slots, arrays indexed by slot must have at least this length
+u32 pair_cache_get_capacity() {
+	return pair_cache.initialized ? array_length(pair_cache.pairs) : 0;
+}
+
+// Slots of the pairs passed to the last update, in the same order
+const u32* pair_cache_get_collision_pair_slots() {
+	if (!pair_cache.initialized) {
+		pair_cache_init();
+	}
+	return pair_cache.collision_pair_slots;
+}
+
+const u32* pair_cache_get_began_slots() {
+	if (!pair_cache.initialized) {
+		pair_cache_init();
+	}
+	return pair_cache.began_slots;
+}
+
+const u32* pair_cache_get_persisted_slots() {
+	if (!pair_cache.initialized) {
+		pair_cache_init();
+	}
+	return pair_cache.persisted_slots;
+}
+
+const u32* pair_cache_get_ended_slots() {
+	if (!pair_cache.initialized) {
+		pair_cache_init();
+	}
+	return pair_cache.ended_slots;
+}
+
+Pair_Cache_Statistics pair_cache_get_statistics() {
+	Pair_Cache_Statistics statistics = {0};
+	if (!pair_cache.initialized) {
+		return statistics;
+	}
+
+	statistics.num_pairs = array_length(pair_cache.pairs) - array_length(pair_cache.free_slots);
+	statistics.num_began = array_length(pair_cache.began_slots);
+	statistics.num_persisted = array_length(pair_cache.persisted_slots);
+	statistics.num_ended = array_length(pair_cache.ended_slots);
+	return statistics;
+}
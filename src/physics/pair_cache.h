@@ -0,0 +1,47 @@
+#ifndef RAW_PHYSICS_PHYSICS_PAIR_CACHE_H
+#define RAW_PHYSICS_PHYSICS_PAIR_CACHE_H
+#include "broad.h"
+
+#define PAIR_CACHE_INVALID_SLOT ((u32)-1)
+
+typedef enum {
+	PAIR_STATE_BEGIN,    // the pair was reported by the broad phase for the first time in this frame
+	PAIR_STATE_PERSIST,  // the pair was also reported in the previous frame
+	PAIR_STATE_END       // the pair was not reported in this frame, its slot will be released in the next update
+} Pair_State;
+
+typedef struct {
+	eid e1_id;          // always the smallest id of the pair
+	eid e2_id;
+	Pair_State state;
+	u32 generation;     // incremented every time the slot is reused, so external caches can detect stale data
+	u64 first_frame;    // frame in which the pair began
+	u64 last_frame;     // last frame in which the pair was reported by the broad phase
+	boolean in_use;
+} Cached_Pair;
+
+typedef struct {
+	u32 num_pairs;      // pairs alive in the cache (including the ones that ended in this frame)
+	u32 num_began;
+	u32 num_persisted;
+	u32 num_ended;
+} Pair_Cache_Statistics;
+
+// Called for every pair that began, persisted or ended in the last update
+typedef void (*Pair_Cache_Event_Callback)(u32 slot, const Cached_Pair* pair, void* ctx);
+
+void pair_cache_update(const Broad_Collision_Pair* collision_pairs);
+void pair_cache_clear();
+void pair_cache_set_callbacks(Pair_Cache_Event_Callback on_begin, Pair_Cache_Event_Callback on_persist,
+	Pair_Cache_Event_Callback on_end, void* ctx);
+
+u32 pair_cache_get_slot(eid e1_id, eid e2_id);
+const Cached_Pair* pair_cache_get_pair(u32 slot);
+u32 pair_cache_get_capacity();
+const u32* pair_cache_get_collision_pair_slots();
+const u32* pair_cache_get_began_slots();
+const u32* pair_cache_get_persisted_slots();
+const u32* pair_cache_get_ended_slots();
+Pair_Cache_Statistics pair_cache_get_statistics();
+
+#endif
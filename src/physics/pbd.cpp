@@ -3,8 +3,12 @@
 #include <assert.h>
 #include <float.h>
 #include "broad.h"
+#include "pair_cache.h"
+#include "mid.h"
+#include "ccd.h"
 #include "pbd_base_constraints.h"
 #include "../util.h"
+#include "../thread_pool.h"
 #include "physics_util.h"
 
 //#include <fenv.h>
@@ -14,11 +18,16 @@
 #define ANGULAR_SLEEPING_THRESHOLD 0.10
 #define DEACTIVATION_TIME_TO_BE_INACTIVE 1.0
 #define USE_QUATERNIONS_LINEARIZED_FORMULAS
+// Islands with a continuous collision take enough substeps for the entities of the pair to move by at most this many
+// bounding sphere radii in each substep, up to CCD_MAX_SUBSTEPS
+#define CCD_MAX_SUBSTEP_MOTION 1.0
+#define CCD_MAX_SUBSTEPS 32
 
 void pbd_positional_constraint_init(Constraint* constraint, eid e1_id, eid e2_id, vec3 r1_lc, vec3 r2_lc, r64 compliance, vec3 distance) {
 	constraint->type = POSITIONAL_CONSTRAINT;
 	constraint->e1_id = e1_id;
 	constraint->e2_id = e2_id;
+	constraint->disable_collision = false;
 	constraint->positional_constraint.r1_lc = r1_lc;
 	constraint->positional_constraint.r2_lc = r2_lc;
 	constraint->positional_constraint.compliance = compliance;
@@ -29,6 +38,7 @@ void pbd_mutual_orientation_constraint_init(Constraint* constraint, eid e1_id, e
 	constraint->type = MUTUAL_ORIENTATION_CONSTRAINT;
 	constraint->e1_id = e1_id;
 	constraint->e2_id = e2_id;
+	constraint->disable_collision = false;
 	constraint->mutual_orientation_constraint.compliance = compliance;
 }
 
@@ -36,6 +46,7 @@ void pbd_hinge_joint_constraint_unlimited_init(Constraint* constraint, eid e1_id
 	constraint->type = HINGE_JOINT_CONSTRAINT;
 	constraint->e1_id = e1_id;
 	constraint->e2_id = e2_id;
+	constraint->disable_collision = false;
 	constraint->hinge_joint_constraint.r1_lc = r1_lc;
 	constraint->hinge_joint_constraint.r2_lc = r2_lc;
 	constraint->hinge_joint_constraint.compliance = compliance;
@@ -49,6 +60,7 @@ void pbd_hinge_joint_constraint_limited_init(Constraint* constraint, eid e1_id,
 	constraint->type = HINGE_JOINT_CONSTRAINT;
 	constraint->e1_id = e1_id;
 	constraint->e2_id = e2_id;
+	constraint->disable_collision = false;
 	constraint->hinge_joint_constraint.r1_lc = r1_lc;
 	constraint->hinge_joint_constraint.r2_lc = r2_lc;
 	constraint->hinge_joint_constraint.compliance = compliance;
@@ -66,6 +78,7 @@ void pbd_spherical_joint_constraint_init(Constraint* constraint, eid e1_id, eid
 	constraint->type = SPHERICAL_JOINT_CONSTRAINT;
 	constraint->e1_id = e1_id;
 	constraint->e2_id = e2_id;
+	constraint->disable_collision = false;
 	constraint->spherical_joint_constraint.r1_lc = r1_lc;
 	constraint->spherical_joint_constraint.r2_lc = r2_lc;
 	constraint->spherical_joint_constraint.e1_swing_axis = e1_swing_axis;
@@ -123,14 +136,32 @@ static void collision_constraint_solve(Constraint* constraint, r64 h) {
 		r64 delta_lambda = positional_constraint_get_delta_lambda(&pcpd, h, 0.0, constraint->collision_constraint.lambda_n, delta_x);
 		positional_constraint_apply(&pcpd, delta_lambda, delta_x);
 		constraint->collision_constraint.lambda_n += delta_lambda;
+	}
 
+	// Static friction acts on the contacts that pushed in this substep, including the push of the warm start
+	if (constraint->collision_constraint.lambda_n < 0.0) {
 		// Recalculate entity pair preprocessed data and p1/p2
 		calculate_positional_constraint_preprocessed_data(e1, e2, constraint->collision_constraint.r1_lc, constraint->collision_constraint.r2_lc, &pcpd);
 
 		p1 = gm_vec3_add(e1->world_position, pcpd.r1_wc);
 		p2 = gm_vec3_add(e2->world_position, pcpd.r2_wc);
 
-		delta_lambda = positional_constraint_get_delta_lambda(&pcpd, h, 0.0, constraint->collision_constraint.lambda_t, delta_x);
+		vec3 delta_p;
+		if (constraint->collision_constraint.anchored) {
+			// Both anchors were at the same tangential position when static friction started to hold the contact,
+			// so the tangential offset between them is all the sliding since then, not only the one of this substep
+			delta_p = gm_vec3_subtract(p1, p2);
+		} else {
+			vec3 p1_til = gm_vec3_add(e1->previous_world_position,
+				quaternion_apply_to_vec3(&e1->previous_world_rotation, constraint->collision_constraint.r1_lc));
+			vec3 p2_til = gm_vec3_add(e2->previous_world_position,
+				quaternion_apply_to_vec3(&e2->previous_world_rotation, constraint->collision_constraint.r2_lc));
+			delta_p = gm_vec3_subtract(gm_vec3_subtract(p1, p1_til), gm_vec3_subtract(p2, p2_til));
+		}
+		vec3 delta_p_t = gm_vec3_subtract(delta_p, gm_vec3_scalar_product(
+			gm_vec3_dot(delta_p, constraint->collision_constraint.normal), constraint->collision_constraint.normal));
+
+		r64 delta_lambda = positional_constraint_get_delta_lambda(&pcpd, h, 0.0, constraint->collision_constraint.lambda_t, delta_p_t);
 
 		// We should also add a constraint for static friction, but only if lambda_t < u_s * lambda_n
 		const r64 static_friction_coefficient = (e1->static_friction_coefficient + e2->static_friction_coefficient) / 2.0f;
@@ -139,20 +170,43 @@ static void collision_constraint_solve(Constraint* constraint, r64 h) {
 		r64 lambda_t = constraint->collision_constraint.lambda_t + delta_lambda;
 		// @NOTE(fek): This inequation shown in 3.5 was changed because the lambdas will always be negative!
 		if (lambda_t > static_friction_coefficient * lambda_n) {
-			vec3 p1_til = gm_vec3_add(e1->previous_world_position,
-				quaternion_apply_to_vec3(&e1->previous_world_rotation, constraint->collision_constraint.r1_lc));
-			vec3 p2_til = gm_vec3_add(e2->previous_world_position,
-				quaternion_apply_to_vec3(&e2->previous_world_rotation, constraint->collision_constraint.r2_lc));
-			vec3 delta_p = gm_vec3_subtract(gm_vec3_subtract(p1, p1_til), gm_vec3_subtract(p2, p2_til));
-			vec3 delta_p_t = gm_vec3_subtract(delta_p, gm_vec3_scalar_product(
-				gm_vec3_dot(delta_p, constraint->collision_constraint.normal), constraint->collision_constraint.normal));
-
 			positional_constraint_apply(&pcpd, delta_lambda, delta_p_t);
 			constraint->collision_constraint.lambda_t += delta_lambda;
+			constraint->collision_constraint.sticking = true;
 		}
 	}
 }
 
+// Warm starting: the contact first pushes with the normal lambda that it needed in the previous substep, but never
+// further than its current penetration. Resting contacts then start the iterations close to their solution.
+static void collision_constraint_warm_start(Constraint* constraint, r64 h) {
+	assert(constraint->type == COLLISION_CONSTRAINT);
+
+	r64 previous_lambda_n = constraint->collision_constraint.lambda_n;
+	constraint->collision_constraint.lambda_n = 0.0;
+	if (previous_lambda_n >= 0.0) {
+		return;
+	}
+
+	Entity* e1 = entity_get_by_id(constraint->e1_id);
+	Entity* e2 = entity_get_by_id(constraint->e2_id);
+
+	Position_Constraint_Preprocessed_Data pcpd;
+	calculate_positional_constraint_preprocessed_data(e1, e2, constraint->collision_constraint.r1_lc, constraint->collision_constraint.r2_lc, &pcpd);
+
+	vec3 p1 = gm_vec3_add(e1->world_position, pcpd.r1_wc);
+	vec3 p2 = gm_vec3_add(e2->world_position, pcpd.r2_wc);
+	r64 d = gm_vec3_dot(gm_vec3_subtract(p1, p2), constraint->collision_constraint.normal);
+
+	if (d > 0.0) {
+		vec3 delta_x = gm_vec3_scalar_product(d, constraint->collision_constraint.normal);
+		// Lambdas are negative, so the maximum is the smallest push
+		r64 delta_lambda = MAX(positional_constraint_get_delta_lambda(&pcpd, h, 0.0, 0.0, delta_x), previous_lambda_n);
+		positional_constraint_apply(&pcpd, delta_lambda, delta_x);
+		constraint->collision_constraint.lambda_n = delta_lambda;
+	}
+}
+
 static void mutual_orientation_constraint_solve(Constraint* constraint, r64 h) {
 	assert(constraint->type == MUTUAL_ORIENTATION_CONSTRAINT);
 
@@ -409,9 +463,14 @@ void clipping_contact_to_collision_constraint(Entity* e1, Entity* e2, Collider_C
 	constraint->type = COLLISION_CONSTRAINT;
 	constraint->e1_id = e1->id;
 	constraint->e2_id = e2->id;
+	constraint->disable_collision = false;
 	constraint->collision_constraint.normal = contact->normal;
 	constraint->collision_constraint.lambda_n = 0.0;
 	constraint->collision_constraint.lambda_t = 0.0;
+	constraint->collision_constraint.feature_id = contact->feature_id;
+	constraint->collision_constraint.anchored = false;
+	constraint->collision_constraint.sticking = false;
+	constraint->collision_constraint.speculative = false;
 
 	vec3 r1_wc = gm_vec3_subtract(contact->collision_point1, e1->world_position);
 	vec3 r2_wc = gm_vec3_subtract(contact->collision_point2, e2->world_position);
@@ -423,167 +482,422 @@ void clipping_contact_to_collision_constraint(Entity* e1, Entity* e2, Collider_C
 	constraint->collision_constraint.r2_lc = quaternion_apply_to_vec3(&q2_inv, r2_wc);
 }
 
-static Constraint* copy_constraints(Constraint* constraints) {
-	if (constraints == NULL) {
-		return array_new(Constraint);
-	}
-
-	Constraint* copied_constraints = (Constraint*)array_copy(constraints);
-
-	for (u32 i = 0; i < array_length(copied_constraints); ++i) {
-		Constraint* constraint = &copied_constraints[i];
-
-		// Reset lambda
-		switch (constraint->type) {
-			case POSITIONAL_CONSTRAINT: {
-				constraint->positional_constraint.lambda = 0.0;
-			} break;
-			case COLLISION_CONSTRAINT: {
-				constraint->collision_constraint.lambda_t = 0.0;
-				constraint->collision_constraint.lambda_n = 0.0;
-			} break;
-			case MUTUAL_ORIENTATION_CONSTRAINT: {
-				constraint->mutual_orientation_constraint.lambda = 0.0;
-			} break;
-			case HINGE_JOINT_CONSTRAINT: {
-				constraint->hinge_joint_constraint.lambda_pos = 0.0;
-				constraint->hinge_joint_constraint.lambda_aligned_axes = 0.0;
-				constraint->hinge_joint_constraint.lambda_limit_axes = 0.0;
-			} break;
-			case SPHERICAL_JOINT_CONSTRAINT: {
-				constraint->spherical_joint_constraint.lambda_pos = 0.0;
-				constraint->spherical_joint_constraint.lambda_swing = 0.0;
-				constraint->spherical_joint_constraint.lambda_twist = 0.0;
-			} break;
-		}
+static void reset_constraint_lambdas(Constraint* constraint) {
+	switch (constraint->type) {
+		case POSITIONAL_CONSTRAINT: {
+			constraint->positional_constraint.lambda = 0.0;
+		} break;
+		case COLLISION_CONSTRAINT: {
+			constraint->collision_constraint.lambda_t = 0.0;
+			constraint->collision_constraint.lambda_n = 0.0;
+		} break;
+		case MUTUAL_ORIENTATION_CONSTRAINT: {
+			constraint->mutual_orientation_constraint.lambda = 0.0;
+		} break;
+		case HINGE_JOINT_CONSTRAINT: {
+			constraint->hinge_joint_constraint.lambda_pos = 0.0;
+			constraint->hinge_joint_constraint.lambda_aligned_axes = 0.0;
+			constraint->hinge_joint_constraint.lambda_limit_axes = 0.0;
+		} break;
+		case SPHERICAL_JOINT_CONSTRAINT: {
+			constraint->spherical_joint_constraint.lambda_pos = 0.0;
+			constraint->spherical_joint_constraint.lambda_swing = 0.0;
+			constraint->spherical_joint_constraint.lambda_twist = 0.0;
+		} break;
 	}
+}
 
-	return copied_constraints;
+// Prepares a contact kept from the previous substep: its normal lambda is kept for the warm start, and its contact
+// points become friction anchors if static friction held it
+static void prepare_collision_constraint(Constraint* constraint) {
+	assert(constraint->type == COLLISION_CONSTRAINT);
+	constraint->collision_constraint.lambda_t = 0.0;
+	constraint->collision_constraint.anchored = constraint->collision_constraint.sticking;
+	constraint->collision_constraint.sticking = false;
 }
 
-void pbd_simulate(r64 dt, Entity** entities, u32 num_substeps, u32 num_pos_iters, boolean enable_collisions) {
-	pbd_simulate_with_constraints(dt, entities, NULL, num_substeps, num_pos_iters, enable_collisions);
+// Contacts of a pair at the end of the last substep that used them. The contacts of the next narrow-phase pass that
+// come from the same features reuse their lambdas and friction anchors.
+typedef struct {
+	u32 generation;                 // generation of the pair cache slot when the manifold was created
+	eid e1_id;                      // the contacts depend on the order of the entities
+	Collision_Constraint* contacts;
+} Contact_Manifold;
+
+// Range of the collision constraints of an island that belong to a pair
+typedef struct {
+	u32 slot;
+	u32 first_constraint;
+	u32 num_constraints;
+} Contact_Manifold_Range;
+
+// Indexed by the slot of the pair in the pair cache. A pair belongs to a single island, so its manifold is only
+// touched by one thread at a time.
+static Contact_Manifold* manifolds_by_slot;
+
+// Reused across frames, to avoid reallocating the islands every step
+static Broad_Simulation_Islands simulation_islands;
+
+// Scratch arrays that hold the constraints of the island being simulated, one per worker thread
+static Constraint* island_constraints[THREAD_POOL_MAX_THREADS];
+// Collision constraints of the island being simulated, kept between contact refreshes, one per worker thread
+static Constraint* island_collision_constraints[THREAD_POOL_MAX_THREADS];
+// Contacts found by continuous collision detection for the island being simulated, kept for the whole step, one per
+// worker thread
+static Constraint* island_ccd_constraints[THREAD_POOL_MAX_THREADS];
+// Pairs whose contacts are in 'island_collision_constraints', one per worker thread
+static Contact_Manifold_Range* island_manifold_ranges[THREAD_POOL_MAX_THREADS];
+
+// Number of substeps between two narrow-phase passes. 1 detects contacts in every substep, 0 only in the first one.
+static u32 contact_refresh_interval = 1;
+
+// Simulation islands that are awake in the current frame, sorted by decreasing cost
+static u32* islands_to_simulate;
+static u32* island_costs;
+static boolean thread_pool_ready;
+
+typedef struct {
+	Entity** entities;
+	Broad_Collision_Pair* broad_collision_pairs;
+	Constraint* external_constraints;
+	r64 h;
+	u32 num_substeps;
+	u32 num_pos_iters;
+	boolean enable_collisions;
+} Island_Simulation_Context;
+
+// Updates the entity position and orientation based on the current velocities and applied forces
+static void integrate_entity(Entity* e, r64 h) {
+	// Calculate the external force and torque of the entity
+	vec3 external_force = calculate_external_force(e);
+	vec3 external_torque = calculate_external_torque(e);
+
+	// Update the entity position and linear velocity based on the current velocity and applied forces
+	e->linear_velocity = gm_vec3_add(e->linear_velocity, gm_vec3_scalar_product(h * e->inverse_mass, external_force));
+	e->world_position = gm_vec3_add(e->world_position, gm_vec3_scalar_product(h, e->linear_velocity));
+
+	// Update the entity orientation and angular velocity based on the current velocity and applied forces
+	mat3 e_inverse_inertia_tensor = get_dynamic_inverse_inertia_tensor(e);
+	mat3 e_inertia_tensor = get_dynamic_inertia_tensor(e);
+	e->angular_velocity = gm_vec3_add(e->angular_velocity, gm_vec3_scalar_product(h, 
+		gm_mat3_multiply_vec3(&e_inverse_inertia_tensor, gm_vec3_subtract(external_torque,
+		gm_vec3_cross(e->angular_velocity, gm_mat3_multiply_vec3(&e_inertia_tensor, e->angular_velocity))))));
+#ifdef USE_QUATERNIONS_LINEARIZED_FORMULAS
+	Quaternion aux = (Quaternion){e->angular_velocity.x, e->angular_velocity.y, e->angular_velocity.z, 0.0};
+	Quaternion q = quaternion_product(&aux, &e->world_rotation);
+	e->world_rotation.x = e->world_rotation.x + h * 0.5 * q.x;
+	e->world_rotation.y = e->world_rotation.y + h * 0.5 * q.y;
+	e->world_rotation.z = e->world_rotation.z + h * 0.5 * q.z;
+	e->world_rotation.w = e->world_rotation.w + h * 0.5 * q.w;
+	// should we normalize?
+	e->world_rotation = quaternion_normalize(&e->world_rotation);
+#else
+	r64 rotation_angle = gm_vec3_length(e->angular_velocity) * h;
+	vec3 rotation_axis = gm_vec3_normalize(e->angular_velocity);
+	Quaternion orientation_change = quaternion_new_radians(rotation_axis, rotation_angle);
+	e->world_rotation = quaternion_product(&orientation_change, &e->world_rotation);
+	// should we normalize?
+	e->world_rotation = quaternion_normalize(&e->world_rotation);
+#endif
 }
 
-void pbd_simulate_with_constraints(r64 dt, Entity** entities, Constraint* external_constraints, u32 num_substeps, u32 num_pos_iters, boolean enable_collisions) {
-	//feenableexcept(FE_INVALID | FE_OVERFLOW);
+// Bounds how much the entities of a pair can approach each other in the next 't' seconds, from their relative velocity,
+// the velocity that external forces can add to it, and the speed of their farthest points due to their rotation
+static r64 get_pair_approach_distance(Entity* e1, Entity* e2, r64 t) {
+	if (t <= 0.0) {
+		return 0.0;
+	}
 
-	if (dt <= 0.0) return;
-	r64 h = dt / num_substeps;
+	r64 speed = gm_vec3_length(gm_vec3_subtract(e1->linear_velocity, e2->linear_velocity));
+	speed += (e1->inverse_mass * gm_vec3_length(calculate_external_force(e1)) +
+		e2->inverse_mass * gm_vec3_length(calculate_external_force(e2))) * t;
+	speed += gm_vec3_length(e1->angular_velocity) * e1->bounding_sphere_radius +
+		gm_vec3_length(e2->angular_velocity) * e2->bounding_sphere_radius;
+	return speed * t;
+}
 
-	Broad_Collision_Pair* broad_collision_pairs = broad_get_collision_pairs(entities);
+// The PBD velocity update: derives the velocities of the entity from its position and orientation change
+static void update_entity_velocities(Entity* e, r64 h) {
+	// We start by storing the current velocities (this is needed for the velocity solver that comes at the end of the loop)
+	e->previous_linear_velocity = e->linear_velocity;
+	e->previous_angular_velocity = e->angular_velocity;
+
+	// Update the linear velocity based on the position difference
+	e->linear_velocity = gm_vec3_scalar_product(1.0 / h, gm_vec3_subtract(e->world_position, e->previous_world_position));
+
+	// Update the angular velocity based on the orientation difference
+	Quaternion inv = quaternion_inverse(&e->previous_world_rotation);
+	Quaternion delta_q = quaternion_product(&e->world_rotation, &inv);
+	if (delta_q.w >= 0.0) {
+		e->angular_velocity = gm_vec3_scalar_product(2.0 / h, (vec3){delta_q.x, delta_q.y, delta_q.z});
+	} else {
+		e->angular_velocity = gm_vec3_scalar_product(-2.0 / h, (vec3){delta_q.x, delta_q.y, delta_q.z});
+	}
+}
 
-#ifdef ENABLE_SIMULATION_ISLANDS
-	eid** simulation_islands = broad_collect_simulation_islands(entities, broad_collision_pairs, external_constraints);
+// The velocity solver - we run this additional solver for every collision that we found.
+// When contacts are kept across substeps, 'skip_separated_contacts' ignores the ones that didn't push in this substep.
+// Speculative contacts are always ignored until they push.
+static void solve_velocities(Constraint* constraints, r64 h, boolean skip_separated_contacts) {
+	for (u32 j = 0; j < array_length(constraints); ++j) {
+		Constraint* constraint = &constraints[j];
+		if (constraint->type == COLLISION_CONSTRAINT) {
+			if ((skip_separated_contacts || constraint->collision_constraint.speculative) &&
+				constraint->collision_constraint.lambda_n == 0.0) {
+				continue;
+			}
 
-	// All entities will be contained in the simulation islands.
-	// Update deactivation time and also, at the same time, its active status
-	for (u32 j = 0; j < array_length(simulation_islands); ++j) {
-		eid* simulation_island = simulation_islands[j];
+			Entity* e1 = entity_get_by_id(constraint->e1_id);
+			Entity* e2 = entity_get_by_id(constraint->e2_id);
+			vec3 n = constraint->collision_constraint.normal;
+			r64 lambda_n = constraint->collision_constraint.lambda_n;
 
-		boolean all_inactive = true;
-		for (u32 k = 0; k < array_length(simulation_island); ++k) {
-			Entity* e = entity_get_by_id(simulation_island[k]);
+			Position_Constraint_Preprocessed_Data pcpd;
+			calculate_positional_constraint_preprocessed_data(e1, e2, constraint->collision_constraint.r1_lc,
+				constraint->collision_constraint.r2_lc, &pcpd);
 
-			r64 linear_velocity_len = gm_vec3_length(e->linear_velocity);
-			r64 angular_velocity_len = gm_vec3_length(e->angular_velocity);
-			if (linear_velocity_len < LINEAR_SLEEPING_THRESHOLD && angular_velocity_len < ANGULAR_SLEEPING_THRESHOLD) {
-				e->deactivation_time += dt; // we should use 'dt' if doing once per frame
-			} else {
-				e->deactivation_time = 0.0;
-			}
+			vec3 v1 = e1->linear_velocity;
+			vec3 w1 = e1->angular_velocity;
+			vec3 v2 = e2->linear_velocity;
+			vec3 w2 = e2->angular_velocity;
 
-			if (e->deactivation_time < DEACTIVATION_TIME_TO_BE_INACTIVE) {
-				all_inactive = false;
+			// We start by calculating the relative normal and tangential velocities at the contact point, as described in (3.6)
+			// @NOTE: equation (29) was modified here
+			vec3 v = gm_vec3_subtract(gm_vec3_add(v1, gm_vec3_cross(w1, pcpd.r1_wc)), gm_vec3_add(v2, gm_vec3_cross(w2, pcpd.r2_wc)));
+			r64 vn = gm_vec3_dot(n, v);
+			vec3 vt = gm_vec3_subtract(v, gm_vec3_scalar_product(vn, n));
+
+			// delta_v stores the velocity change that we need to perform at the end of the solver
+			vec3 delta_v = (vec3){0.0, 0.0, 0.0};
+			
+			// we start by applying Coloumb's dynamic friction force
+			const r64 dynamic_friction_coefficient = (e1->dynamic_friction_coefficient + e2->dynamic_friction_coefficient) / 2.0f;
+			r64 fn = lambda_n / h; // simplifly h^2 by ommiting h in the next calculation
+			// @NOTE: equation (30) was modified here
+			r64 fact = MIN(dynamic_friction_coefficient * fabs(fn), gm_vec3_length(vt));
+			// update delta_v
+			delta_v = gm_vec3_add(delta_v, gm_vec3_scalar_product(-fact, gm_vec3_normalize(vt)));
+
+			// Now we handle restitution
+			vec3 old_v1 = e1->previous_linear_velocity;
+			vec3 old_w1 = e1->previous_angular_velocity;
+			vec3 old_v2 = e2->previous_linear_velocity;
+			vec3 old_w2 = e2->previous_angular_velocity;
+			vec3 v_til = gm_vec3_subtract(gm_vec3_add(old_v1, gm_vec3_cross(old_w1, pcpd.r1_wc)), gm_vec3_add(old_v2, gm_vec3_cross(old_w2, pcpd.r2_wc)));
+			r64 vn_til = gm_vec3_dot(n, v_til);
+			//r64 e = (fabs(vn) > 2.0 * GRAVITY * h) ? 0.8 : 0.0;
+			r64 e = e1->restitution_coefficient * e2->restitution_coefficient;
+			// @NOTE: equation (34) was modified here
+			fact = -vn + MIN(-e * vn_til, 0.0);
+			// update delta_v
+			delta_v = gm_vec3_add(delta_v, gm_vec3_scalar_product(fact, n));
+
+			// Finally, we end the solver by applying delta_v, considering the inverse masses of both entities
+			r64 _w1 = e1->inverse_mass + gm_vec3_dot(gm_vec3_cross(pcpd.r1_wc, n),
+				gm_mat3_multiply_vec3(&pcpd.e1_inverse_inertia_tensor, gm_vec3_cross(pcpd.r1_wc, n)));
+			r64 _w2 = e2->inverse_mass + gm_vec3_dot(gm_vec3_cross(pcpd.r2_wc, n),
+				gm_mat3_multiply_vec3(&pcpd.e2_inverse_inertia_tensor, gm_vec3_cross(pcpd.r2_wc, n)));
+			vec3 p = gm_vec3_scalar_product(1.0 / (_w1 + _w2), delta_v);
+
+			if (!e1->fixed) {
+				e1->linear_velocity = gm_vec3_add(e1->linear_velocity, gm_vec3_scalar_product(e1->inverse_mass, p));
+				e1->angular_velocity = gm_vec3_add(e1->angular_velocity,
+					gm_mat3_multiply_vec3(&pcpd.e1_inverse_inertia_tensor, gm_vec3_cross(pcpd.r1_wc, p)));
+			}
+			if (!e2->fixed) {
+				e2->linear_velocity = gm_vec3_add(e2->linear_velocity, gm_vec3_invert(gm_vec3_scalar_product(e2->inverse_mass, p)));
+				e2->angular_velocity = gm_vec3_add(e2->angular_velocity,
+					gm_vec3_invert(gm_mat3_multiply_vec3(&pcpd.e2_inverse_inertia_tensor, gm_vec3_cross(pcpd.r2_wc, p))));
 			}
+		} else if (constraint->type == HINGE_JOINT_CONSTRAINT) {
+			// TODO: Joint damping
+
+			//Entity* e1 = entity_get_by_id(constraint->hinge_joint_constraint.e1_id);
+			//Entity* e2 = entity_get_by_id(constraint->hinge_joint_constraint.e2_id);
+
+			//// angular damping
+			//vec3 omega_diff = gm_vec3_subtract(e2->angular_velocity, e1->angular_velocity);
+			//omega_diff = gm_vec3_scalar_product(MIN(1.0, 10.0 * h), omega_diff);
+			//e1->angular_velocity = gm_vec3_add(e1->angular_velocity, omega_diff);
+			//e2->angular_velocity = gm_vec3_subtract(e2->angular_velocity, omega_diff);
+
+			//// linear damping
+			//vec3 delta_v = gm_vec3_subtract(e2->linear_velocity, e1->linear_velocity);
+			//delta_v = gm_vec3_scalar_product(MIN(1.0, 10.0 * h), delta_v);
+
+			//// Finally, we end the solver by applying delta_v, considering the inverse masses of both entities
+			//r64 _w1 = e1->inverse_mass;
+			//r64 _w2 = e2->inverse_mass;
+			//vec3 p = gm_vec3_scalar_product(1.0 / (_w1 + _w2), delta_v);
+
+			//if (!e1->fixed) {
+			//	e1->linear_velocity = gm_vec3_add(e1->linear_velocity, gm_vec3_scalar_product(e1->inverse_mass, p));
+			//}
+			//if (!e2->fixed) {
+			//	e2->linear_velocity = gm_vec3_add(e2->linear_velocity, gm_vec3_invert(gm_vec3_scalar_product(e2->inverse_mass, p)));
+			//}
 		}
+	}
+}
 
-		// We only set entities to inactive if the whole island is inactive!
-		for (u32 k = 0; k < array_length(simulation_island); ++k) {
-			Entity* e = entity_get_by_id(simulation_island[k]);
-			e->active = !all_inactive;
-		}
+// Makes room for the manifolds of all pairs in the pair cache
+static void update_contact_manifolds() {
+	if (!manifolds_by_slot) {
+		manifolds_by_slot = array_new_len(Contact_Manifold, 256);
 	}
-#if 0
-	for (u32 j = 0; j < array_length(simulation_islands); ++j) {
-		eid* simulation_island = simulation_islands[j];
-		vec4 color = util_pallete(j);
-		for (u32 k = 0; k < array_length(simulation_island); ++k) {
-			Entity* e = entity_get_by_id(simulation_island[k]);
-			e->color = color;
+
+	Contact_Manifold empty = {0};
+	while (array_length(manifolds_by_slot) < pair_cache_get_capacity()) {
+		array_push(manifolds_by_slot, empty);
+	}
+}
+
+static Contact_Manifold* get_contact_manifold(Entity* e1, u32 slot) {
+	if (slot == PAIR_CACHE_INVALID_SLOT) {
+		return NULL;
+	}
+
+	assert(slot < array_length(manifolds_by_slot));
+	Contact_Manifold* manifold = &manifolds_by_slot[slot];
+	u32 generation = pair_cache_get_pair(slot)->generation;
+
+	// The slot was reused by another pair, or the order of the entities changed
+	if (!manifold->contacts || manifold->generation != generation || manifold->e1_id != e1->id) {
+		if (!manifold->contacts) {
+			manifold->contacts = array_new_len(Collision_Constraint, 8);
 		}
+		array_clear(manifold->contacts);
+		manifold->generation = generation;
+		manifold->e1_id = e1->id;
 	}
-#else
-/*
-	for (u32 j = 0; j < array_length(simulation_islands); ++j) {
-		eid* simulation_island = simulation_islands[j];
-		for (u32 k = 0; k < array_length(simulation_island); ++k) {
-			Entity* e = entity_get_by_id(simulation_island[k]);
-			if (e->active) {
-				e->color = util_pallete(1);
-			} else {
-				e->color = util_pallete(0);
+
+	return manifold;
+}
+
+// If the contact comes from the same features as a contact of the manifold, it continues that contact
+static void match_contact_with_manifold(const Contact_Manifold* manifold, Collision_Constraint* contact) {
+	for (u32 i = 0; i < array_length(manifold->contacts); ++i) {
+		const Collision_Constraint* previous_contact = &manifold->contacts[i];
+		if (previous_contact->feature_id == contact->feature_id) {
+			contact->lambda_n = previous_contact->lambda_n;
+			if (previous_contact->sticking) {
+				contact->r1_lc = previous_contact->r1_lc;
+				contact->r2_lc = previous_contact->r2_lc;
+				contact->sticking = true;
 			}
+			return;
 		}
 	}
-*/
-#endif
+}
 
-	broad_simulation_islands_destroy(simulation_islands);
-#endif
+// Stores the collision constraints of the island in the manifolds of their pairs
+static void store_contact_manifolds(u32 worker) {
+	Contact_Manifold_Range* ranges = island_manifold_ranges[worker];
+	const Constraint* collision_constraints = island_collision_constraints[worker];
+	for (u32 i = 0; i < array_length(ranges); ++i) {
+		Contact_Manifold* manifold = &manifolds_by_slot[ranges[i].slot];
+		array_clear(manifold->contacts);
+		for (u32 j = 0; j < ranges[i].num_constraints; ++j) {
+			array_push(manifold->contacts, collision_constraints[ranges[i].first_constraint + j].collision_constraint);
+		}
+	}
+	array_clear(ranges);
+	island_manifold_ranges[worker] = ranges;
+}
+
+// Runs all substeps of a single simulation island. Islands don't share any non-fixed entity, so the result
+// doesn't depend on the order in which islands are simulated.
+static void simulate_simulation_island(u32 island, u32 worker, Entity** entities, Broad_Collision_Pair* broad_collision_pairs,
+	Constraint* external_constraints, r64 h, u32 num_substeps, u32 num_pos_iters, boolean enable_collisions) {
+	const u32* island_entities = simulation_islands.entities;
+	u32 entities_start = simulation_islands.offsets[island];
+	u32 entities_end = simulation_islands.offsets[island + 1];
+	u32 pairs_start = simulation_islands.collision_pair_offsets[island];
+	u32 pairs_end = simulation_islands.collision_pair_offsets[island + 1];
+	u32 constraints_start = simulation_islands.constraint_offsets[island];
+	u32 constraints_end = simulation_islands.constraint_offsets[island + 1];
+	// Same order as 'broad_collision_pairs'
+	const u32* collision_pair_slots = pair_cache_get_collision_pair_slots();
+	u32 num_external_constraints = constraints_end - constraints_start;
+	array_clear(island_manifold_ranges[worker]);
+
+	// Continuous collision detection: the pairs of entities flagged with 'ccd' are swept over the whole step, and the
+	// contacts at their time of impact are added to all substeps as speculative contacts. They only push once the
+	// entities reach each other, so a fast entity is stopped even if it would cross the other one within a substep.
+	// A push that undoes the motion of a long substep at an off-center contact mostly becomes a spin, which can still
+	// carry the entity across, so only the islands with an impact also take more substeps in this step.
+	Constraint* ccd_constraints = island_ccd_constraints[worker];
+	array_clear(ccd_constraints);
+	r64 dt = h * num_substeps;
+	u32 ccd_num_substeps = num_substeps;
+	if (enable_collisions) {
+		for (u32 j = pairs_start; j < pairs_end; ++j) {
+			const Broad_Collision_Pair* collision_pair = &broad_collision_pairs[simulation_islands.collision_pairs[j]];
+			Entity* e1 = entities[collision_pair->e1_idx];
+			Entity* e2 = entities[collision_pair->e2_idx];
+			if (!e1->ccd && !e2->ccd) {
+				continue;
+			}
+			if ((e1->fixed || !e1->active) && (e2->fixed || !e2->active)) {
+				continue;
+			}
+
+			Collider_Contact* contacts = ccd_get_contacts(e1, e2, dt);
+			if (contacts) {
+				for (u32 l = 0; l < array_length(contacts); ++l) {
+					Constraint constraint;
+					clipping_contact_to_collision_constraint(e1, e2, &contacts[l], &constraint);
+					constraint.collision_constraint.speculative = true;
+					array_push(ccd_constraints, constraint);
+				}
+				array_free(contacts);
+
+				r64 motion = gm_vec3_length(gm_vec3_subtract(e1->linear_velocity, e2->linear_velocity)) * dt;
+				r64 radius = MIN(e1->ccd ? e1->bounding_sphere_radius : DBL_MAX, e2->ccd ? e2->bounding_sphere_radius : DBL_MAX);
+				u32 required_substeps = (u32)MIN(ceil(motion / (CCD_MAX_SUBSTEP_MOTION * radius)), (r64)CCD_MAX_SUBSTEPS);
+				ccd_num_substeps = MAX(ccd_num_substeps, required_substeps);
+			}
+		}
+		// The array may have been reallocated
+		island_ccd_constraints[worker] = ccd_constraints;
+	}
+	if (ccd_num_substeps > num_substeps) {
+		num_substeps = ccd_num_substeps;
+		h = dt / num_substeps;
+	}
 
-	// The main loop of the PBD simulation
 	for (u32 i = 0; i < num_substeps; ++i) {
-		for (u32 j = 0; j < array_length(entities); ++j) {
-			Entity* e = entities[j];
+		for (u32 j = entities_start; j < entities_end; ++j) {
+			Entity* e = entities[island_entities[j]];
 			// Stores the previous position and orientation of the entity
 			e->previous_world_position = e->world_position;
 			e->previous_world_rotation = e->world_rotation;
 
-			if (e->fixed) continue;	
 			if (!e->active) continue;
-
-			// Calculate the external force and torque of the entity
-			vec3 external_force = calculate_external_force(e);
-			vec3 external_torque = calculate_external_torque(e);
-
-			// Update the entity position and linear velocity based on the current velocity and applied forces
-			e->linear_velocity = gm_vec3_add(e->linear_velocity, gm_vec3_scalar_product(h * e->inverse_mass, external_force));
-			e->world_position = gm_vec3_add(e->world_position, gm_vec3_scalar_product(h, e->linear_velocity));
-
-			// Update the entity orientation and angular velocity based on the current velocity and applied forces
-			mat3 e_inverse_inertia_tensor = get_dynamic_inverse_inertia_tensor(e);
-			mat3 e_inertia_tensor = get_dynamic_inertia_tensor(e);
-			e->angular_velocity = gm_vec3_add(e->angular_velocity, gm_vec3_scalar_product(h, 
-				gm_mat3_multiply_vec3(&e_inverse_inertia_tensor, gm_vec3_subtract(external_torque,
-				gm_vec3_cross(e->angular_velocity, gm_mat3_multiply_vec3(&e_inertia_tensor, e->angular_velocity))))));
-#ifdef USE_QUATERNIONS_LINEARIZED_FORMULAS
-			Quaternion aux = (Quaternion){e->angular_velocity.x, e->angular_velocity.y, e->angular_velocity.z, 0.0};
-			Quaternion q = quaternion_product(&aux, &e->world_rotation);
-			e->world_rotation.x = e->world_rotation.x + h * 0.5 * q.x;
-			e->world_rotation.y = e->world_rotation.y + h * 0.5 * q.y;
-			e->world_rotation.z = e->world_rotation.z + h * 0.5 * q.z;
-			e->world_rotation.w = e->world_rotation.w + h * 0.5 * q.w;
-			// should we normalize?
-			e->world_rotation = quaternion_normalize(&e->world_rotation);
-#else
-			r64 rotation_angle = gm_vec3_length(e->angular_velocity) * h;
-			vec3 rotation_axis = gm_vec3_normalize(e->angular_velocity);
-			Quaternion orientation_change = quaternion_new_radians(rotation_axis, rotation_angle);
-			e->world_rotation = quaternion_product(&orientation_change, &e->world_rotation);
-			// should we normalize?
-			e->world_rotation = quaternion_normalize(&e->world_rotation);
-#endif
+			integrate_entity(e, h);
 		}
 
-		// Create the constraints array
-		Constraint* constraints = copy_constraints(external_constraints);
-
-		// As explained in sec 3.5, in each substep we need to check for collisions
-		if (enable_collisions) {
-			for (u32 j = 0; j < array_length(broad_collision_pairs); ++j) {
-				Entity* e1 = entity_get_by_id(broad_collision_pairs[j].e1_id);
-				Entity* e2 = entity_get_by_id(broad_collision_pairs[j].e2_id);
+		// As explained in sec 3.5, we need to check for collisions. Contacts can also be detected only every
+		// 'contact_refresh_interval' substeps: the substeps in between reuse the same contact points, and 'd' is
+		// re-evaluated from 'r1_lc'/'r2_lc' with the current poses in collision_constraint_solve.
+		boolean refresh_contacts = (contact_refresh_interval == 0) ? (i == 0) : (i % contact_refresh_interval == 0);
+		Constraint* collision_constraints = island_collision_constraints[worker];
+		if (enable_collisions && refresh_contacts) {
+			// The contacts found in the last pass become the manifolds that the new contacts are matched against
+			store_contact_manifolds(worker);
+			array_clear(collision_constraints);
+			Contact_Manifold_Range* ranges = island_manifold_ranges[worker];
+
+			// Contacts that are kept for the next substeps must also cover the pairs that only touch during those
+			// substeps. Pairs that may close their separation before the next pass get speculative contacts: they stay
+			// inactive while 'd' is negative, and only push once the entities actually reach each other.
+			u32 num_substeps_left = num_substeps - i;
+			u32 contact_window = (contact_refresh_interval == 0) ? num_substeps_left - 1 : MIN(contact_refresh_interval, num_substeps_left) - 1;
+
+			for (u32 j = pairs_start; j < pairs_end; ++j) {
+				const Broad_Collision_Pair* collision_pair = &broad_collision_pairs[simulation_islands.collision_pairs[j]];
+				Entity* e1 = entities[collision_pair->e1_idx];
+				Entity* e2 = entities[collision_pair->e2_idx];
 
 				// If e1 is "colliding" with e2, they must be either both active or both inactive
 				if (!e1->fixed && !e2->fixed) {
@@ -595,19 +909,64 @@ void pbd_simulate_with_constraints(r64 dt, Entity** entities, Constraint* extern
 					continue;
 				}
 
-				colliders_update(e1->colliders, e1->world_position, &e1->world_rotation);
-				colliders_update(e2->colliders, e2->world_position, &e2->world_rotation);
+				// Fixed entities are shared by many islands, their colliders were already updated for this frame
+				if (!e1->fixed) {
+					colliders_update(e1->colliders, e1->world_position, &e1->world_rotation);
+				}
+				if (!e2->fixed) {
+					colliders_update(e2->colliders, e2->world_position, &e2->world_rotation);
+				}
+
+				u32 slot = collision_pair_slots[simulation_islands.collision_pairs[j]];
+				Contact_Manifold* manifold = get_contact_manifold(e1, slot);
+				Contact_Manifold_Range range;
+				range.slot = slot;
+				range.first_constraint = array_length(collision_constraints);
 
-				Collider_Contact* contacts = colliders_get_contacts(e1->colliders, e2->colliders);
+				r64 margin = get_pair_approach_distance(e1, e2, contact_window * h);
+				Collider_Contact* contacts = mid_get_contacts(e1, e2, slot, margin);
 				if (contacts) {
 					for (u32 l = 0; l < array_length(contacts); ++l) {
 						Collider_Contact* contact = &contacts[l];
 						Constraint constraint;
 						clipping_contact_to_collision_constraint(e1, e2, contact, &constraint);
-						array_push(constraints, constraint);
+						if (manifold) {
+							match_contact_with_manifold(manifold, &constraint.collision_constraint);
+						}
+						array_push(collision_constraints, constraint);
 					}
 					array_free(contacts);
 				}
+
+				if (manifold) {
+					range.num_constraints = array_length(collision_constraints) - range.first_constraint;
+					array_push(ranges, range);
+				}
+			}
+
+			// The arrays may have been reallocated
+			island_collision_constraints[worker] = collision_constraints;
+			island_manifold_ranges[worker] = ranges;
+		}
+
+		// Create the constraints array, starting from the external constraints of the island
+		Constraint* constraints = island_constraints[worker];
+		array_clear(constraints);
+		for (u32 j = constraints_start; j < constraints_end; ++j) {
+			array_push(constraints, external_constraints[simulation_islands.constraints[j]]);
+			reset_constraint_lambdas(&constraints[array_length(constraints) - 1]);
+		}
+		if (enable_collisions) {
+			for (u32 j = 0; j < array_length(collision_constraints); ++j) {
+				array_push(constraints, collision_constraints[j]);
+				prepare_collision_constraint(&constraints[array_length(constraints) - 1]);
+			}
+			for (u32 j = 0; j < array_length(ccd_constraints); ++j) {
+				array_push(constraints, ccd_constraints[j]);
+				prepare_collision_constraint(&constraints[array_length(constraints) - 1]);
+			}
+			for (u32 j = num_external_constraints; j < array_length(constraints); ++j) {
+				collision_constraint_warm_start(&constraints[j], h);
 			}
 		}
 
@@ -616,132 +975,200 @@ void pbd_simulate_with_constraints(r64 dt, Entity** entities, Constraint* extern
 			for (u32 k = 0; k < array_length(constraints); ++k) {
 				Constraint* constraint = &constraints[k];
 				solve_constraint(constraint, h);
-			}	
+			}
 		}
 
-		// The PBD velocity update
-		for (u32 j = 0; j < array_length(entities); ++j) {
-			Entity* e = entities[j];
-			if (e->fixed) continue;
+		for (u32 j = entities_start; j < entities_end; ++j) {
+			Entity* e = entities[island_entities[j]];
 			if (!e->active) continue;
-			
-			// We start by storing the current velocities (this is needed for the velocity solver that comes at the end of the loop)
-			e->previous_linear_velocity = e->linear_velocity;
-			e->previous_angular_velocity = e->angular_velocity;
-
-			// Update the linear velocity based on the position difference
-			e->linear_velocity = gm_vec3_scalar_product(1.0 / h, gm_vec3_subtract(e->world_position, e->previous_world_position));
-
-			// Update the angular velocity based on the orientation difference
-			Quaternion inv = quaternion_inverse(&e->previous_world_rotation);
-			Quaternion delta_q = quaternion_product(&e->world_rotation, &inv);
-			if (delta_q.w >= 0.0) {
-				e->angular_velocity = gm_vec3_scalar_product(2.0 / h, (vec3){delta_q.x, delta_q.y, delta_q.z});
+			update_entity_velocities(e, h);
+		}
+
+		solve_velocities(constraints, h, contact_refresh_interval != 1);
+
+		// The next substep continues the contacts with the lambdas and the friction state of this one
+		if (enable_collisions) {
+			for (u32 j = 0; j < array_length(collision_constraints); ++j) {
+				collision_constraints[j] = constraints[num_external_constraints + j];
+			}
+			u32 num_collision_constraints = array_length(collision_constraints);
+			for (u32 j = 0; j < array_length(ccd_constraints); ++j) {
+				ccd_constraints[j] = constraints[num_external_constraints + num_collision_constraints + j];
+			}
+		}
+
+		// The array may have been reallocated
+		island_constraints[worker] = constraints;
+	}
+
+	if (enable_collisions) {
+		store_contact_manifolds(worker);
+	}
+}
+
+static void simulate_simulation_island_task(u32 island, u32 worker, void* ctx) {
+	Island_Simulation_Context* context = (Island_Simulation_Context*)ctx;
+	simulate_simulation_island(island, worker, context->entities, context->broad_collision_pairs, context->external_constraints,
+		context->h, context->num_substeps, context->num_pos_iters, context->enable_collisions);
+}
+
+static int compare_island_costs(const void* a, const void* b) {
+	u32 island1 = *(const u32*)a;
+	u32 island2 = *(const u32*)b;
+	if (island_costs[island1] != island_costs[island2]) {
+		return island_costs[island1] > island_costs[island2] ? -1 : 1;
+	}
+	return island1 < island2 ? -1 : (island1 > island2 ? 1 : 0);
+}
+
+// Sets the number of threads used to simulate the islands. 0 means one thread per hardware thread.
+// Islands are independent, so the result of the simulation doesn't depend on the number of threads.
+void pbd_set_num_threads(u32 num_threads) {
+	thread_pool_init(num_threads);
+	thread_pool_ready = true;
+}
+
+// Sets how many substeps reuse the contacts found by the narrow phase before it runs again.
+// 1 (the default) detects contacts in every substep, and 0 detects them only once per step.
+void pbd_set_contact_refresh_interval(u32 num_substeps) {
+	contact_refresh_interval = num_substeps;
+}
+
+u32 pbd_get_contact_refresh_interval() {
+	return contact_refresh_interval;
+}
+
+void pbd_simulate(r64 dt, Entity** entities, u32 num_substeps, u32 num_pos_iters, boolean enable_collisions) {
+	pbd_simulate_with_constraints(dt, entities, NULL, num_substeps, num_pos_iters, enable_collisions);
+}
+
+void pbd_simulate_with_constraints(r64 dt, Entity** entities, Constraint* external_constraints, u32 num_substeps, u32 num_pos_iters, boolean enable_collisions) {
+	//feenableexcept(FE_INVALID | FE_OVERFLOW);
+
+	if (dt <= 0.0) return;
+	r64 h = dt / num_substeps;
+
+	Broad_Collision_Pair* broad_collision_pairs = broad_get_collision_pairs(entities, external_constraints, dt);
+
+	// Keep track of which pairs began, persisted or ended since the last frame
+	pair_cache_update(broad_collision_pairs);
+	mid_update_pair_caches();
+	update_contact_manifolds();
+
+	// Simulation islands are the unit of work of the solver: the entities, collision pairs and constraints
+	// of each island are simulated independently of the other islands
+	broad_collect_simulation_islands(entities, broad_collision_pairs, external_constraints, &simulation_islands);
+	u32 num_simulation_islands = broad_simulation_islands_get_count(&simulation_islands);
+
+#ifdef ENABLE_SIMULATION_ISLANDS
+	// All non-fixed entities of awake islands will be contained in the simulation islands.
+	// Update deactivation time and also, at the same time, its active status
+	for (u32 j = 0; j < num_simulation_islands; ++j) {
+		u32 island_start = simulation_islands.offsets[j];
+		u32 island_end = simulation_islands.offsets[j + 1];
+
+		boolean all_inactive = true;
+		for (u32 k = island_start; k < island_end; ++k) {
+			Entity* e = entities[simulation_islands.entities[k]];
+
+			r64 linear_velocity_len = gm_vec3_length(e->linear_velocity);
+			r64 angular_velocity_len = gm_vec3_length(e->angular_velocity);
+			if (linear_velocity_len < LINEAR_SLEEPING_THRESHOLD && angular_velocity_len < ANGULAR_SLEEPING_THRESHOLD) {
+				e->deactivation_time += dt; // we should use 'dt' if doing once per frame
 			} else {
-				e->angular_velocity = gm_vec3_scalar_product(-2.0 / h, (vec3){delta_q.x, delta_q.y, delta_q.z});
+				e->deactivation_time = 0.0;
+			}
+
+			if (e->deactivation_time < DEACTIVATION_TIME_TO_BE_INACTIVE) {
+				all_inactive = false;
 			}
 		}
 
-		// The velocity solver - we run this additional solver for every collision that we found
-		for (u32 j = 0; j < array_length(constraints); ++j) {
-			Constraint* constraint = &constraints[j];
-			if (constraint->type == COLLISION_CONSTRAINT) {
-				Entity* e1 = entity_get_by_id(constraint->e1_id);
-				Entity* e2 = entity_get_by_id(constraint->e2_id);
-				vec3 n = constraint->collision_constraint.normal;
-				r64 lambda_n = constraint->collision_constraint.lambda_n;
-				r64 lambda_t = constraint->collision_constraint.lambda_t;
-
-				Position_Constraint_Preprocessed_Data pcpd;
-				calculate_positional_constraint_preprocessed_data(e1, e2, constraint->collision_constraint.r1_lc,
-					constraint->collision_constraint.r2_lc, &pcpd);
-
-				vec3 v1 = e1->linear_velocity;
-				vec3 w1 = e1->angular_velocity;
-				vec3 v2 = e2->linear_velocity;
-				vec3 w2 = e2->angular_velocity;
-
-				// We start by calculating the relative normal and tangential velocities at the contact point, as described in (3.6)
-				// @NOTE: equation (29) was modified here
-				vec3 v = gm_vec3_subtract(gm_vec3_add(v1, gm_vec3_cross(w1, pcpd.r1_wc)), gm_vec3_add(v2, gm_vec3_cross(w2, pcpd.r2_wc)));
-				r64 vn = gm_vec3_dot(n, v);
-				vec3 vt = gm_vec3_subtract(v, gm_vec3_scalar_product(vn, n));
-
-				// delta_v stores the velocity change that we need to perform at the end of the solver
-				vec3 delta_v = (vec3){0.0, 0.0, 0.0};
-				
-				// we start by applying Coloumb's dynamic friction force
-				const r64 dynamic_friction_coefficient = (e1->dynamic_friction_coefficient + e2->dynamic_friction_coefficient) / 2.0f;
-				r64 fn = lambda_n / h; // simplifly h^2 by ommiting h in the next calculation
-				// @NOTE: equation (30) was modified here
-				r64 fact = MIN(dynamic_friction_coefficient * fabs(fn), gm_vec3_length(vt));
-				// update delta_v
-				delta_v = gm_vec3_add(delta_v, gm_vec3_scalar_product(-fact, gm_vec3_normalize(vt)));
-
-				// Now we handle restitution
-				vec3 old_v1 = e1->previous_linear_velocity;
-				vec3 old_w1 = e1->previous_angular_velocity;
-				vec3 old_v2 = e2->previous_linear_velocity;
-				vec3 old_w2 = e2->previous_angular_velocity;
-				vec3 v_til = gm_vec3_subtract(gm_vec3_add(old_v1, gm_vec3_cross(old_w1, pcpd.r1_wc)), gm_vec3_add(old_v2, gm_vec3_cross(old_w2, pcpd.r2_wc)));
-				r64 vn_til = gm_vec3_dot(n, v_til);
-				//r64 e = (fabs(vn) > 2.0 * GRAVITY * h) ? 0.8 : 0.0;
-				r64 e = e1->restitution_coefficient * e2->restitution_coefficient;
-				// @NOTE: equation (34) was modified here
-				fact = -vn + MIN(-e * vn_til, 0.0);
-				// update delta_v
-				delta_v = gm_vec3_add(delta_v, gm_vec3_scalar_product(fact, n));
-
-				// Finally, we end the solver by applying delta_v, considering the inverse masses of both entities
-				r64 _w1 = e1->inverse_mass + gm_vec3_dot(gm_vec3_cross(pcpd.r1_wc, n),
-					gm_mat3_multiply_vec3(&pcpd.e1_inverse_inertia_tensor, gm_vec3_cross(pcpd.r1_wc, n)));
-				r64 _w2 = e2->inverse_mass + gm_vec3_dot(gm_vec3_cross(pcpd.r2_wc, n),
-					gm_mat3_multiply_vec3(&pcpd.e2_inverse_inertia_tensor, gm_vec3_cross(pcpd.r2_wc, n)));
-				vec3 p = gm_vec3_scalar_product(1.0 / (_w1 + _w2), delta_v);
+		// We only set entities to inactive if the whole island is inactive!
+		// Sleeping islands are not simulated until something wakes them up.
+		if (all_inactive) {
+			broad_simulation_islands_put_to_sleep(&simulation_islands, entities, j);
+		}
+	}
+#if 0
+	for (u32 j = 0; j < num_simulation_islands; ++j) {
+		vec4 color = util_pallete(j);
+		for (u32 k = simulation_islands.offsets[j]; k < simulation_islands.offsets[j + 1]; ++k) {
+			Entity* e = entities[simulation_islands.entities[k]];
+			e->color = color;
+		}
+	}
+#else
+/*
+	for (u32 j = 0; j < num_simulation_islands; ++j) {
+		for (u32 k = simulation_islands.offsets[j]; k < simulation_islands.offsets[j + 1]; ++k) {
+			Entity* e = entities[simulation_islands.entities[k]];
+			if (e->active) {
+				e->color = util_pallete(1);
+			} else {
+				e->color = util_pallete(0);
+			}
+		}
+	}
+*/
+#endif
+#endif
 
-				if (!e1->fixed) {
-					e1->linear_velocity = gm_vec3_add(e1->linear_velocity, gm_vec3_scalar_product(e1->inverse_mass, p));
-					e1->angular_velocity = gm_vec3_add(e1->angular_velocity,
-						gm_mat3_multiply_vec3(&pcpd.e1_inverse_inertia_tensor, gm_vec3_cross(pcpd.r1_wc, p)));
-				}
-				if (!e2->fixed) {
-					e2->linear_velocity = gm_vec3_add(e2->linear_velocity, gm_vec3_invert(gm_vec3_scalar_product(e2->inverse_mass, p)));
-					e2->angular_velocity = gm_vec3_add(e2->angular_velocity,
-						gm_vec3_invert(gm_mat3_multiply_vec3(&pcpd.e2_inverse_inertia_tensor, gm_vec3_cross(pcpd.r2_wc, p))));
-				}
-			} else if (constraint->type == HINGE_JOINT_CONSTRAINT) {
-				// TODO: Joint damping
-
-				//Entity* e1 = entity_get_by_id(constraint->hinge_joint_constraint.e1_id);
-				//Entity* e2 = entity_get_by_id(constraint->hinge_joint_constraint.e2_id);
-
-				//// angular damping
-				//vec3 omega_diff = gm_vec3_subtract(e2->angular_velocity, e1->angular_velocity);
-				//omega_diff = gm_vec3_scalar_product(MIN(1.0, 10.0 * h), omega_diff);
-				//e1->angular_velocity = gm_vec3_add(e1->angular_velocity, omega_diff);
-				//e2->angular_velocity = gm_vec3_subtract(e2->angular_velocity, omega_diff);
-
-				//// linear damping
-				//vec3 delta_v = gm_vec3_subtract(e2->linear_velocity, e1->linear_velocity);
-				//delta_v = gm_vec3_scalar_product(MIN(1.0, 10.0 * h), delta_v);
-
-				//// Finally, we end the solver by applying delta_v, considering the inverse masses of both entities
-				//r64 _w1 = e1->inverse_mass;
-				//r64 _w2 = e2->inverse_mass;
-				//vec3 p = gm_vec3_scalar_product(1.0 / (_w1 + _w2), delta_v);
-
-				//if (!e1->fixed) {
-				//	e1->linear_velocity = gm_vec3_add(e1->linear_velocity, gm_vec3_scalar_product(e1->inverse_mass, p));
-				//}
-				//if (!e2->fixed) {
-				//	e2->linear_velocity = gm_vec3_add(e2->linear_velocity, gm_vec3_invert(gm_vec3_scalar_product(e2->inverse_mass, p)));
-				//}
+	// Fixed entities are not part of any island and never move during the simulation, so they only need to be
+	// refreshed when the broad phase detects that one of them was added or moved
+	if (broad_static_scene_was_rebuilt()) {
+		for (u32 j = 0; j < array_length(entities); ++j) {
+			Entity* e = entities[j];
+			if (e->fixed) {
+				e->previous_world_position = e->world_position;
+				e->previous_world_rotation = e->world_rotation;
+				colliders_update(e->colliders, e->world_position, &e->world_rotation);
 			}
 		}
+	}
+
+	if (!thread_pool_ready) {
+		pbd_set_num_threads(0);
+	}
+
+	if (!islands_to_simulate) {
+		islands_to_simulate = array_new_len(u32, 64);
+		island_costs = array_new_len(u32, 64);
+		for (u32 j = 0; j < THREAD_POOL_MAX_THREADS; ++j) {
+			island_constraints[j] = array_new_len(Constraint, 64);
+			island_collision_constraints[j] = array_new_len(Constraint, 64);
+			island_ccd_constraints[j] = array_new_len(Constraint, 16);
+			island_manifold_ranges[j] = array_new_len(Contact_Manifold_Range, 64);
+		}
+	}
 
-		array_free(constraints);
+	// Collect the islands that are awake. All entities of an island share the same active status, so sleeping
+	// islands can be skipped entirely. The most expensive islands are scheduled first, to balance the load.
+	array_clear(islands_to_simulate);
+	array_clear(island_costs);
+	for (u32 j = 0; j < num_simulation_islands; ++j) {
+		Entity* first_entity = entities[simulation_islands.entities[simulation_islands.offsets[j]]];
+		u32 cost = (simulation_islands.offsets[j + 1] - simulation_islands.offsets[j]) +
+			(simulation_islands.collision_pair_offsets[j + 1] - simulation_islands.collision_pair_offsets[j]) +
+			(simulation_islands.constraint_offsets[j + 1] - simulation_islands.constraint_offsets[j]);
+		array_push(island_costs, cost);
+		if (first_entity->active) {
+			array_push(islands_to_simulate, j);
+		}
 	}
+	qsort(islands_to_simulate, array_length(islands_to_simulate), sizeof(u32), compare_island_costs);
+
+	// The main loop of the PBD simulation, each island runs all of its substeps on its own
+	Island_Simulation_Context context;
+	context.entities = entities;
+	context.broad_collision_pairs = broad_collision_pairs;
+	context.external_constraints = external_constraints;
+	context.h = h;
+	context.num_substeps = num_substeps;
+	context.num_pos_iters = num_pos_iters;
+	context.enable_collisions = enable_collisions;
+	thread_pool_run(islands_to_simulate, array_length(islands_to_simulate), simulate_simulation_island_task, &context);
 
 	array_free(broad_collision_pairs);
 	//fedisableexcept(FE_INVALID | FE_OVERFLOW);
-}
\ No newline at end of file
+}
@@ -33,6 +33,10 @@ typedef struct {
 	vec3 normal;
 	r64 lambda_t;
 	r64 lambda_n;
+	u32 feature_id;   // matches the contact with the one found in the previous substep from the same features
+	boolean anchored; // r1_lc and r2_lc are friction anchors kept since static friction started to hold the contact
+	boolean sticking; // static friction held the contact in the current substep
+	boolean speculative; // found before the entities touch, it only acts once they reach each other
 } Collision_Constraint;
 
 typedef struct {
@@ -80,6 +84,7 @@ typedef struct {
 	Constraint_Type type;
 	eid e1_id;
 	eid e2_id;
+	boolean disable_collision; // if true, the broad phase never reports the pair formed by both entities
 
 	union {
 		Positional_Constraint positional_constraint;
@@ -90,6 +95,9 @@ typedef struct {
 	};
 } Constraint;
 
+void pbd_set_num_threads(u32 num_threads);
+void pbd_set_contact_refresh_interval(u32 num_substeps);
+u32 pbd_get_contact_refresh_interval();
 void pbd_simulate(r64 dt, Entity** entities, u32 num_substeps, u32 num_pos_iters, boolean enable_collisions);
 void pbd_simulate_with_constraints(r64 dt, Entity** entities, Constraint* external_constraints, u32 num_substeps, u32 num_pos_iters, boolean enable_collisions);
 
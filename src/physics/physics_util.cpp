@@ -59,3 +59,16 @@ mat3 get_dynamic_inverse_inertia_tensor(Entity* e) {
 	return gm_mat3_multiply(&aux, &inverse_local_to_world);
 #endif
 }
+
+// Moves the entity to the pose it would reach after 't' seconds with its current velocities, ignoring external forces
+void predict_entity_pose(Entity* e, r64 t) {
+	e->world_position = gm_vec3_add(e->world_position, gm_vec3_scalar_product(t, e->linear_velocity));
+
+	Quaternion aux = (Quaternion){e->angular_velocity.x, e->angular_velocity.y, e->angular_velocity.z, 0.0};
+	Quaternion q = quaternion_product(&aux, &e->world_rotation);
+	e->world_rotation.x = e->world_rotation.x + t * 0.5 * q.x;
+	e->world_rotation.y = e->world_rotation.y + t * 0.5 * q.y;
+	e->world_rotation.z = e->world_rotation.z + t * 0.5 * q.z;
+	e->world_rotation.w = e->world_rotation.w + t * 0.5 * q.w;
+	e->world_rotation = quaternion_normalize(&e->world_rotation);
+}
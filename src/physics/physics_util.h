@@ -6,5 +6,6 @@ vec3 calculate_external_force(Entity* e);
 vec3 calculate_external_torque(Entity* e);
 mat3 get_dynamic_inertia_tensor(Entity* e);
 mat3 get_dynamic_inverse_inertia_tensor(Entity* e);
+void predict_entity_pose(Entity* e, r64 t);
 
 #endif
\ No newline at end of file
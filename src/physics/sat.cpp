@@ -0,0 +1,462 @@
+#include "sat.h"
+#include <light_array.h>
+#include <float.h>
+#include <math.h>
+#include "../thread_pool.h"
+
+// Separating Axis Test for pairs of convex hulls
+// The candidate axes are the face normals of both hulls and the cross products of their edges. Most edge pairs can't
+// produce a separating axis: the cross product is only a candidate when the arcs of both edges intersect on the Gauss
+// map (the edges form a face of the Minkowski difference), which is checked before doing any work with the edges
+// themselves. Everything is done in the local space of the first hull.
+// The normal points from collider1 towards collider2, like the one returned by EPA.
+// Between frames (and substeps) the axis rarely changes, so the last one is kept per pair of colliders: if it still
+// separates the hulls, nothing else has to be tested, and while the pair barely moves, the last axis of minimum
+// penetration is reused. Otherwise, a full search is done.
+
+// Face axes are preferred over edge axes (and faces of collider1 over faces of collider2) unless the other axis is
+// clearly better, so the reference feature doesn't flip between frames when both are nearly as good.
+#define SAT_RELATIVE_TOLERANCE 0.95
+#define SAT_ABSOLUTE_TOLERANCE 0.0005
+// Edges that are closer to parallel than this don't define an axis, the face axes already cover that case
+#define SAT_PARALLEL_EDGES_TOLERANCE 1e-6
+// How much the relative pose of a pair can move away from the pose of the last full search before the cached axis of
+// minimum penetration is no longer trusted
+#define SAT_CACHE_MAX_TRANSLATION 0.005
+#define SAT_CACHE_MAX_ROTATION 0.01 // radians
+
+typedef struct {
+	r64 separation;
+	vec3 normal;
+	Collider_SAT_Axis_Type type;
+	u32 index1;
+	u32 index2;
+} SAT_Axis;
+
+// One slot per worker thread, each in its own cache line, so that the workers never write to the same memory
+static struct {
+	alignas(64) u64 num_calls;
+	u64 num_cached_separations;
+	u64 num_cached_contacts;
+} sat_statistics[THREAD_POOL_MAX_THREADS];
+
+// Copy of the vertices and face normals of a hull, in the local space of the first hull of the pair
+typedef struct {
+	vec3 vertices[SAT_MAX_HULL_VERTICES];
+	vec3 normals[SAT_MAX_HULL_FACES];
+} SAT_Hull;
+
+static r64 dot(vec3 v1, vec3 v2) {
+	return v1.x * v2.x + v1.y * v2.y + v1.z * v2.z;
+}
+
+static vec3 cross(vec3 v1, vec3 v2) {
+	return (vec3) {
+		v1.y * v2.z - v1.z * v2.y,
+		v1.z * v2.x - v1.x * v2.z,
+		v1.x * v2.y - v1.y * v2.x
+	};
+}
+
+static boolean is_hull_small_enough(const Collider_Convex_Hull* convex_hull) {
+	return array_length(convex_hull->edges) <= SAT_MAX_HULL_EDGES && array_length(convex_hull->faces) <= SAT_MAX_HULL_FACES &&
+		array_length(convex_hull->vertices) <= SAT_MAX_HULL_VERTICES;
+}
+
+boolean sat_is_suited(const Collider* collider1, const Collider* collider2) {
+	if (collider1->type != COLLIDER_TYPE_CONVEX_HULL || collider2->type != COLLIDER_TYPE_CONVEX_HULL) {
+		return false;
+	}
+
+	// SAT relies on the hulls being strictly convex
+	if (collider1->convex_hull.has_concave_edges || collider2->convex_hull.has_concave_edges) {
+		return false;
+	}
+
+	return is_hull_small_enough(&collider1->convex_hull) && is_hull_small_enough(&collider2->convex_hull);
+}
+
+static vec3 rotate(const mat3* r, vec3 v) {
+	return (vec3) {
+		r->data[0][0] * v.x + r->data[0][1] * v.y + r->data[0][2] * v.z,
+		r->data[1][0] * v.x + r->data[1][1] * v.y + r->data[1][2] * v.z,
+		r->data[2][0] * v.x + r->data[2][1] * v.y + r->data[2][2] * v.z
+	};
+}
+
+static vec3 rotate_transposed(const mat3* r, vec3 v) {
+	return (vec3) {
+		r->data[0][0] * v.x + r->data[1][0] * v.y + r->data[2][0] * v.z,
+		r->data[0][1] * v.x + r->data[1][1] * v.y + r->data[2][1] * v.z,
+		r->data[0][2] * v.x + r->data[1][2] * v.y + r->data[2][2] * v.z
+	};
+}
+
+// Copies the vertices and face normals of the hull, transformed by 'rotation' and 'translation'. If 'rotation' is NULL,
+// they are copied in local space. Every vertex and normal is used many times by the queries, so they are transformed
+// only once.
+static void load_hull(const Collider* collider, const mat3* rotation, vec3 translation, SAT_Hull* hull) {
+	const Collider_Convex_Hull* convex_hull = &collider->convex_hull;
+	if (!rotation) {
+		for (u32 i = 0; i < array_length(convex_hull->vertices); ++i) {
+			hull->vertices[i] = convex_hull->vertices[i];
+		}
+		for (u32 i = 0; i < array_length(convex_hull->faces); ++i) {
+			hull->normals[i] = convex_hull->faces[i].normal;
+		}
+		return;
+	}
+
+	for (u32 i = 0; i < array_length(convex_hull->vertices); ++i) {
+		hull->vertices[i] = gm_vec3_add(rotate(rotation, convex_hull->vertices[i]), translation);
+	}
+	for (u32 i = 0; i < array_length(convex_hull->faces); ++i) {
+		hull->normals[i] = rotate(rotation, convex_hull->faces[i].normal);
+	}
+}
+
+// Separation of the hulls along the normal of a face of 'hull1'. The hulls are small, so the support point of the second
+// hull is found by a plain scan over its vertices.
+static r64 get_face_separation(const Collider* collider1, const SAT_Hull* hull1, u32 face_idx, const Collider* collider2,
+	const SAT_Hull* hull2) {
+	vec3 normal = hull1->normals[face_idx];
+	r64 min_projection = DBL_MAX;
+	for (u32 i = 0; i < array_length(collider2->convex_hull.vertices); ++i) {
+		min_projection = MIN(min_projection, dot(normal, hull2->vertices[i]));
+	}
+
+	return min_projection - dot(normal, hull1->vertices[collider1->convex_hull.faces[face_idx].elements[0]]);
+}
+
+// Finds the face of 'collider1' whose plane separates it the most from 'collider2'
+static SAT_Axis query_face_directions(const Collider* collider1, const SAT_Hull* hull1, const Collider* collider2,
+	const SAT_Hull* hull2) {
+	SAT_Axis best;
+	best.separation = -DBL_MAX;
+	best.normal = (vec3){0.0, 0.0, 0.0};
+	best.type = COLLIDER_SAT_AXIS_FACE1;
+	best.index1 = 0;
+	best.index2 = 0;
+
+	for (u32 i = 0; i < array_length(collider1->convex_hull.faces); ++i) {
+		r64 separation = get_face_separation(collider1, hull1, i, collider2, hull2);
+		if (separation > best.separation) {
+			best.separation = separation;
+			best.normal = hull1->normals[i];
+			best.index1 = i;
+			if (separation > 0.0) {
+				break;
+			}
+		}
+	}
+
+	return best;
+}
+
+// Edges AB and CD build a face of the Minkowski difference if the arcs AB and (-C)(-D) intersect on the Gauss map, that
+// is, if each arc crosses the plane of the other one and both arcs are on the same hemisphere. The test only needs the
+// projections of the four normals on the normals of the planes through the arcs (BxA and DxC):
+// 'cba' = C.(BxA), 'dba' = D.(BxA), 'adc' = A.(DxC), 'bdc' = B.(DxC). Almost all pairs fail it and which ones do is hard
+// to predict, so the conditions are combined without branches.
+static boolean is_minkowski_face(r64 cba, r64 dba, r64 adc, r64 bdc) {
+	return (cba * dba < 0.0) & (adc * bdc < 0.0) & (cba * bdc > 0.0);
+}
+
+// Builds the axis of a pair of edges that form a face of the Minkowski difference. The axis is the cross product of the
+// edges, pointing from the first hull to the second one. Returns false if the edges are parallel.
+static boolean get_edges_axis(const Collider* collider1, const SAT_Hull* hull1, u32 edge1_idx, const Collider* collider2,
+	const SAT_Hull* hull2, u32 edge2_idx, SAT_Axis* axis) {
+	const Collider_Convex_Hull_Edge* edge1 = &collider1->convex_hull.edges[edge1_idx];
+	const Collider_Convex_Hull_Edge* edge2 = &collider2->convex_hull.edges[edge2_idx];
+	vec3 p1 = hull1->vertices[edge1->v1];
+	vec3 p2 = hull2->vertices[edge2->v1];
+	vec3 edge1_direction = gm_vec3_subtract(hull1->vertices[edge1->v2], p1);
+	vec3 edge2_direction = gm_vec3_subtract(hull2->vertices[edge2->v2], p2);
+
+	vec3 normal = cross(edge1_direction, edge2_direction);
+	r64 normal_length_sqd = dot(normal, normal);
+	r64 parallel_threshold = SAT_PARALLEL_EDGES_TOLERANCE * SAT_PARALLEL_EDGES_TOLERANCE *
+		dot(edge1_direction, edge1_direction) * dot(edge2_direction, edge2_direction);
+	if (normal_length_sqd < parallel_threshold) {
+		return false;
+	}
+	normal = gm_vec3_scalar_product(1.0 / sqrt(normal_length_sqd), normal);
+
+	// The axis lies between the normals of the faces of the first edge, so it must point to their side
+	if (dot(normal, gm_vec3_add(hull1->normals[edge1->face1], hull1->normals[edge1->face2])) < 0.0) {
+		normal = gm_vec3_invert(normal);
+	}
+
+	axis->separation = dot(normal, gm_vec3_subtract(p2, p1));
+	axis->normal = normal;
+	axis->type = COLLIDER_SAT_AXIS_EDGES;
+	axis->index1 = edge1_idx;
+	axis->index2 = edge2_idx;
+	return true;
+}
+
+// Finds the pair of edges whose cross product separates the hulls the most.
+// The Gauss map test is done with projections calculated up front: the normals of 'collider2' on the arc of each edge of
+// 'collider1', and the normals of 'collider1' on the arc of each edge of 'collider2'. So each pair of edges only needs a
+// few lookups, instead of four dot products.
+static SAT_Axis query_edge_directions(const Collider* collider1, const SAT_Hull* hull1, const Collider* collider2,
+	const SAT_Hull* hull2) {
+	SAT_Axis best;
+	best.separation = -DBL_MAX;
+	best.normal = (vec3){0.0, 0.0, 0.0};
+	best.type = COLLIDER_SAT_AXIS_EDGES;
+	best.index1 = 0;
+	best.index2 = 0;
+
+	const Collider_Convex_Hull_Edge* edges1 = collider1->convex_hull.edges;
+	const Collider_Convex_Hull_Edge* edges2 = collider2->convex_hull.edges;
+	u32 num_faces1 = array_length(collider1->convex_hull.faces);
+	u32 num_faces2 = array_length(collider2->convex_hull.faces);
+	u32 num_edges2 = array_length(edges2);
+
+	// The normals of the second hull are negated, since the Minkowski difference is taken as A - B. The arc normal
+	// (-D)x(-C) is the same as DxC, so only the projections of the normals on the first arcs change sign.
+	r64 face1_projections[SAT_MAX_HULL_EDGES][SAT_MAX_HULL_FACES]; // A.(DxC) for every edge of the second hull
+	for (u32 j = 0; j < num_edges2; ++j) {
+		vec3 d_x_c = cross(hull2->normals[edges2[j].face2], hull2->normals[edges2[j].face1]);
+		for (u32 k = 0; k < num_faces1; ++k) {
+			face1_projections[j][k] = dot(hull1->normals[k], d_x_c);
+		}
+	}
+
+	for (u32 i = 0; i < array_length(edges1); ++i) {
+		u32 face_a = edges1[i].face1;
+		u32 face_b = edges1[i].face2;
+		vec3 b_x_a = cross(hull1->normals[face_b], hull1->normals[face_a]);
+
+		r64 face2_projections[SAT_MAX_HULL_FACES]; // (-C).(BxA) for every face of the second hull
+		for (u32 k = 0; k < num_faces2; ++k) {
+			face2_projections[k] = -dot(hull2->normals[k], b_x_a);
+		}
+
+		for (u32 j = 0; j < num_edges2; ++j) {
+			r64 cba = face2_projections[edges2[j].face1];
+			r64 dba = face2_projections[edges2[j].face2];
+			r64 adc = face1_projections[j][face_a];
+			r64 bdc = face1_projections[j][face_b];
+			if (!is_minkowski_face(cba, dba, adc, bdc)) {
+				continue;
+			}
+
+			SAT_Axis axis;
+			if (!get_edges_axis(collider1, hull1, i, collider2, hull2, j, &axis)) {
+				continue;
+			}
+
+			if (axis.separation > best.separation) {
+				best = axis;
+				if (axis.separation > 0.0) {
+					return best;
+				}
+			}
+		}
+	}
+
+	return best;
+}
+
+// Same as 'get_face_separation', for a single face. 'rotation' and 'position' give the pose of 'hull2' in the local
+// space of 'hull1'. The normal is taken to the local space of 'hull2' instead of transforming all of its vertices.
+static r64 get_single_face_separation(const Collider_Convex_Hull* hull1, u32 face_idx, const Collider_Convex_Hull* hull2,
+	const mat3* rotation, vec3 position) {
+	vec3 normal = hull1->faces[face_idx].normal;
+	vec3 local_normal = rotate_transposed(rotation, normal);
+	r64 min_projection = DBL_MAX;
+	for (u32 i = 0; i < array_length(hull2->vertices); ++i) {
+		min_projection = MIN(min_projection, dot(local_normal, hull2->vertices[i]));
+	}
+
+	return min_projection + dot(normal, position) - dot(normal, hull1->vertices[hull1->faces[face_idx].elements[0]]);
+}
+
+// Evaluates the cached axis with the current relative pose. Returns false if its features don't define an axis anymore
+// (the edges stopped forming a face of the Minkowski difference, or became parallel).
+static boolean evaluate_cached_axis(const Collider_SAT_Cache* cache, const Collider* collider1, const Collider* collider2,
+	const mat3* relative_rotation, vec3 relative_position, SAT_Axis* axis) {
+	const Collider_Convex_Hull* convex_hull1 = &collider1->convex_hull;
+	const Collider_Convex_Hull* convex_hull2 = &collider2->convex_hull;
+	u32 index1 = cache->axis_index1;
+	u32 index2 = cache->axis_index2;
+	axis->type = cache->axis_type;
+	axis->index1 = index1;
+	axis->index2 = index2;
+
+	switch (cache->axis_type) {
+		case COLLIDER_SAT_AXIS_FACE1: {
+			if (index1 >= array_length(convex_hull1->faces)) {
+				return false;
+			}
+			axis->separation = get_single_face_separation(convex_hull1, index1, convex_hull2, relative_rotation,
+				relative_position);
+			axis->normal = convex_hull1->faces[index1].normal;
+			return true;
+		} break;
+		case COLLIDER_SAT_AXIS_FACE2: {
+			if (index2 >= array_length(convex_hull2->faces)) {
+				return false;
+			}
+			// Pose of the first hull in the local space of the second one
+			mat3 inverse_rotation = gm_mat3_transpose(relative_rotation);
+			vec3 inverse_position = gm_vec3_invert(rotate(&inverse_rotation, relative_position));
+			axis->separation = get_single_face_separation(convex_hull2, index2, convex_hull1, &inverse_rotation,
+				inverse_position);
+			axis->normal = gm_vec3_invert(rotate(relative_rotation, convex_hull2->faces[index2].normal));
+			return true;
+		} break;
+		case COLLIDER_SAT_AXIS_EDGES: {
+			if (index1 >= array_length(convex_hull1->edges) || index2 >= array_length(convex_hull2->edges)) {
+				return false;
+			}
+			SAT_Hull hull1, hull2;
+			load_hull(collider1, NULL, (vec3){0.0, 0.0, 0.0}, &hull1);
+			load_hull(collider2, relative_rotation, relative_position, &hull2);
+			const Collider_Convex_Hull_Edge* edge1 = &convex_hull1->edges[index1];
+			const Collider_Convex_Hull_Edge* edge2 = &convex_hull2->edges[index2];
+			vec3 a = hull1.normals[edge1->face1];
+			vec3 b = hull1.normals[edge1->face2];
+			vec3 c = gm_vec3_invert(hull2.normals[edge2->face1]);
+			vec3 d = gm_vec3_invert(hull2.normals[edge2->face2]);
+			vec3 b_x_a = cross(b, a);
+			vec3 d_x_c = cross(d, c);
+			if (!is_minkowski_face(dot(c, b_x_a), dot(d, b_x_a), dot(a, d_x_c), dot(b, d_x_c))) {
+				return false;
+			}
+			return get_edges_axis(collider1, &hull1, index1, collider2, &hull2, index2, axis);
+		} break;
+		case COLLIDER_SAT_AXIS_NONE: {
+			return false;
+		} break;
+	}
+
+	assert(0);
+	return false;
+}
+
+static boolean is_pose_close_to_cached_pose(const Collider_SAT_Cache* cache, const mat3* relative_rotation,
+	vec3 relative_position) {
+	vec3 delta = gm_vec3_subtract(relative_position, cache->relative_position);
+	if (dot(delta, delta) > SAT_CACHE_MAX_TRANSLATION * SAT_CACHE_MAX_TRANSLATION) {
+		return false;
+	}
+
+	// The trace of R^T * R_cached is 1 + 2 * cos(angle between both rotations), and it's just the sum of the products of
+	// their elements
+	r64 trace = 0.0;
+	for (u32 i = 0; i < 3; ++i) {
+		for (u32 j = 0; j < 3; ++j) {
+			trace += relative_rotation->data[i][j] * cache->relative_rotation.data[i][j];
+		}
+	}
+	return trace >= 1.0 + 2.0 * cos(SAT_CACHE_MAX_ROTATION);
+}
+
+static void cache_axis(Collider_SAT_Cache* cache, const SAT_Axis* axis, const mat3* relative_rotation,
+	vec3 relative_position) {
+	if (!cache) {
+		return;
+	}
+
+	cache->axis_type = axis->type;
+	cache->axis_index1 = axis->index1;
+	cache->axis_index2 = axis->index2;
+	cache->penetrating = axis->separation <= 0.0;
+	cache->relative_rotation = *relative_rotation;
+	cache->relative_position = relative_position;
+}
+
+// Returns whether the hulls intersect. If they do, 'normal' and 'penetration' describe the axis of minimum penetration
+// and can be fed directly to 'clipping_get_contact_manifold'.
+// 'cache' is optional, if given it must always be the same for the same pair of colliders.
+boolean sat_collides(const Collider* collider1, const Collider* collider2, Collider_SAT_Cache* cache, vec3* normal,
+	r64* penetration) {
+	assert(sat_is_suited(collider1, collider2));
+	u32 worker = thread_pool_get_current_worker();
+	++sat_statistics[worker].num_calls;
+
+	// The test is done in the local space of the first hull, so only the second one needs to be transformed
+	const mat3* rotation1 = &collider1->world_rotation_matrix;
+	mat3 inverse_rotation1 = gm_mat3_transpose(rotation1);
+	mat3 relative_rotation = gm_mat3_multiply(&inverse_rotation1, &collider2->world_rotation_matrix);
+	vec3 relative_position = rotate(&inverse_rotation1, gm_vec3_subtract(collider2->world_position,
+		collider1->world_position));
+
+	SAT_Axis cached_axis;
+	if (cache && evaluate_cached_axis(cache, collider1, collider2, &relative_rotation, relative_position, &cached_axis)) {
+		// Any separating axis proves that the hulls don't intersect
+		if (cached_axis.separation > 0.0) {
+			++sat_statistics[worker].num_cached_separations;
+			return false;
+		}
+
+		if (cache->penetrating && is_pose_close_to_cached_pose(cache, &relative_rotation, relative_position)) {
+			++sat_statistics[worker].num_cached_contacts;
+			*normal = rotate(rotation1, cached_axis.normal);
+			*penetration = -cached_axis.separation;
+			return true;
+		}
+	}
+
+	SAT_Hull hull1, hull2;
+	load_hull(collider1, NULL, (vec3){0.0, 0.0, 0.0}, &hull1);
+	load_hull(collider2, &relative_rotation, relative_position, &hull2);
+
+	SAT_Axis face_query1 = query_face_directions(collider1, &hull1, collider2, &hull2);
+	if (face_query1.separation > 0.0) {
+		cache_axis(cache, &face_query1, &relative_rotation, relative_position);
+		return false;
+	}
+
+	// The query is done from the point of view of the second hull, so the result is turned into an axis of the pair
+	SAT_Axis face_query2 = query_face_directions(collider2, &hull2, collider1, &hull1);
+	face_query2.type = COLLIDER_SAT_AXIS_FACE2;
+	face_query2.index2 = face_query2.index1;
+	face_query2.index1 = 0;
+	face_query2.normal = gm_vec3_invert(face_query2.normal);
+	if (face_query2.separation > 0.0) {
+		cache_axis(cache, &face_query2, &relative_rotation, relative_position);
+		return false;
+	}
+
+	SAT_Axis edge_query = query_edge_directions(collider1, &hull1, collider2, &hull2);
+	if (edge_query.separation > 0.0) {
+		cache_axis(cache, &edge_query, &relative_rotation, relative_position);
+		return false;
+	}
+
+	SAT_Axis best = face_query1;
+	if (face_query2.separation > SAT_RELATIVE_TOLERANCE * best.separation + SAT_ABSOLUTE_TOLERANCE) {
+		best = face_query2;
+	}
+	if (edge_query.separation > SAT_RELATIVE_TOLERANCE * best.separation + SAT_ABSOLUTE_TOLERANCE) {
+		best = edge_query;
+	}
+	cache_axis(cache, &best, &relative_rotation, relative_position);
+
+	*normal = rotate(rotation1, best.normal);
+	*penetration = -best.separation;
+	return true;
+}
+
+// Counters since the last reset, added up over the worker threads. Must not be called while the simulation runs.
+SAT_Statistics sat_get_statistics() {
+	SAT_Statistics statistics = {0};
+	for (u32 i = 0; i < THREAD_POOL_MAX_THREADS; ++i) {
+		statistics.num_calls += sat_statistics[i].num_calls;
+		statistics.num_cached_separations += sat_statistics[i].num_cached_separations;
+		statistics.num_cached_contacts += sat_statistics[i].num_cached_contacts;
+	}
+	return statistics;
+}
+
+void sat_reset_statistics() {
+	for (u32 i = 0; i < THREAD_POOL_MAX_THREADS; ++i) {
+		sat_statistics[i].num_calls = 0;
+		sat_statistics[i].num_cached_separations = 0;
+		sat_statistics[i].num_cached_contacts = 0;
+	}
+}
@@ -0,0 +1,25 @@
+#ifndef RAW_PHYSICS_PHYSICS_SAT_H
+#define RAW_PHYSICS_PHYSICS_SAT_H
+
+#include <common.h>
+#include <gm.h>
+#include "collider.h"
+
+// Bigger hulls are left to GJK+EPA, since the number of edge pairs that SAT tests grows quadratically
+#define SAT_MAX_HULL_EDGES 48
+#define SAT_MAX_HULL_FACES 32
+#define SAT_MAX_HULL_VERTICES 32
+
+typedef struct {
+	u64 num_calls;
+	u64 num_cached_separations;  // calls answered by the cached axis still separating the hulls
+	u64 num_cached_contacts;     // calls answered by the cached axis of minimum penetration
+} SAT_Statistics;
+
+boolean sat_is_suited(const Collider* collider1, const Collider* collider2);
+boolean sat_collides(const Collider* collider1, const Collider* collider2, Collider_SAT_Cache* cache, vec3* normal,
+	r64* penetration);
+SAT_Statistics sat_get_statistics();
+void sat_reset_statistics();
+
+#endif
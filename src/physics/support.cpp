@@ -2,11 +2,45 @@
 #include <float.h>
 #include <light_array.h>
 
-u32 support_point_get_index(Collider_Convex_Hull* convex_hull, vec3 direction) {
+#include <stdint.h>
+
+// The vectorized scans are only compiled for x86-64, where SSE2 is always available and AVX2 is detected at runtime.
+// GCC and Clang compile the AVX2 kernel through a target attribute, so the rest of the code doesn't need -mavx2.
+#if defined(__x86_64__) || defined(_M_X64)
+#define SUPPORT_HAS_X86_KERNELS
+#include <immintrin.h>
+#if defined(_MSC_VER)
+#include <intrin.h>
+#define SUPPORT_TARGET_AVX2
+#else
+#define SUPPORT_TARGET_AVX2 __attribute__((target("avx2")))
+#endif
+#endif
+
+// Hulls with fewer vertices than this are scanned linearly, hill climbing only pays off for bigger hulls (the
+// vectorized scans moved the crossover up)
+#define SUPPORT_HILL_CLIMBING_MIN_VERTICES 128
+#define SUPPORT_AVX2_MIN_VERTICES 16
+#define SUPPORT_CACHE_SIZE 64
+
+// The support vertex of the last query of each hull is used as the starting point of the next one, since GJK and EPA
+// query the same hulls with similar directions many times in a row. Hulls of fixed entities are queried by several
+// threads at the same time, so the cache is per thread. It is direct-mapped on the hull address: a collision between
+// two hulls only makes the next query start from a worse vertex.
+// The cache only changes how fast the support vertex is found, never which one: the result must not depend on the
+// thread that runs the query, otherwise the simulation would change with the number of threads.
+typedef struct {
+	const Collider_Convex_Hull* convex_hull;
+	u32 index;
+} Support_Cache_Entry;
+
+static thread_local Support_Cache_Entry support_cache[SUPPORT_CACHE_SIZE];
+
+static u32 support_point_get_index_linear(const Collider_Convex_Hull* convex_hull, vec3 direction) {
 	u32 selected_index;
 	r64 max_dot = -DBL_MAX;
-	for (u32 i = 0; i < array_length(convex_hull->transformed_vertices); ++i) {
-		r64 dot = gm_vec3_dot(convex_hull->transformed_vertices[i], direction);
+	for (u32 i = 0; i < array_length(convex_hull->vertices); ++i) {
+		r64 dot = gm_vec3_dot(convex_hull->vertices[i], direction);
 		if (dot > max_dot) {
 			selected_index = i;
 			max_dot = dot;
@@ -16,11 +50,235 @@ u32 support_point_get_index(Collider_Convex_Hull* convex_hull, vec3 direction) {
 	return selected_index;
 }
 
+#if defined(SUPPORT_HAS_X86_KERNELS)
+// Reduces the per-lane maxima of a vectorized scan. Every lane holds the first index that reached its maximum, so
+// picking the lowest index among the lanes that tie gives the same result regardless of the vector width.
+static u32 get_lanes_argmax(const r32* lane_dots, const u32* lane_indices, u32 num_lanes) {
+	u32 selected_lane = 0;
+	for (u32 i = 1; i < num_lanes; ++i) {
+		if (lane_dots[i] > lane_dots[selected_lane] ||
+			(lane_dots[i] == lane_dots[selected_lane] && lane_indices[i] < lane_indices[selected_lane])) {
+			selected_lane = i;
+		}
+	}
+
+	return lane_indices[selected_lane];
+}
+
+static u32 support_point_get_index_sse(const Collider_Convex_Hull* convex_hull, vec3 direction) {
+	__m128 dx = _mm_set1_ps((r32)direction.x);
+	__m128 dy = _mm_set1_ps((r32)direction.y);
+	__m128 dz = _mm_set1_ps((r32)direction.z);
+	__m128 max_dots = _mm_set1_ps(-FLT_MAX);
+	__m128i max_indices = _mm_setzero_si128();
+	__m128i indices = _mm_setr_epi32(0, 1, 2, 3);
+	__m128i step = _mm_set1_epi32(4);
+
+	for (u32 i = 0; i < convex_hull->soa_length; i += 4) {
+		__m128 dots = _mm_add_ps(_mm_add_ps(_mm_mul_ps(_mm_load_ps(convex_hull->soa_x + i), dx),
+			_mm_mul_ps(_mm_load_ps(convex_hull->soa_y + i), dy)), _mm_mul_ps(_mm_load_ps(convex_hull->soa_z + i), dz));
+		__m128 greater = _mm_cmpgt_ps(dots, max_dots);
+		__m128i greater_mask = _mm_castps_si128(greater);
+		max_dots = _mm_or_ps(_mm_and_ps(greater, dots), _mm_andnot_ps(greater, max_dots));
+		max_indices = _mm_or_si128(_mm_and_si128(greater_mask, indices), _mm_andnot_si128(greater_mask, max_indices));
+		indices = _mm_add_epi32(indices, step);
+	}
+
+	alignas(16) r32 lane_dots[4];
+	alignas(16) u32 lane_indices[4];
+	_mm_store_ps(lane_dots, max_dots);
+	_mm_store_si128((__m128i*)lane_indices, max_indices);
+	return get_lanes_argmax(lane_dots, lane_indices, 4);
+}
+
+// Same as the SSE kernel, with 8 lanes. The products are not fused, so both kernels return exactly the same vertex.
+SUPPORT_TARGET_AVX2 static u32 support_point_get_index_avx2(const Collider_Convex_Hull* convex_hull, vec3 direction) {
+	__m256 dx = _mm256_set1_ps((r32)direction.x);
+	__m256 dy = _mm256_set1_ps((r32)direction.y);
+	__m256 dz = _mm256_set1_ps((r32)direction.z);
+	__m256 max_dots = _mm256_set1_ps(-FLT_MAX);
+	__m256i max_indices = _mm256_setzero_si256();
+	__m256i indices = _mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7);
+	__m256i step = _mm256_set1_epi32(8);
+
+	for (u32 i = 0; i < convex_hull->soa_length; i += 8) {
+		__m256 dots = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(_mm256_load_ps(convex_hull->soa_x + i), dx),
+			_mm256_mul_ps(_mm256_load_ps(convex_hull->soa_y + i), dy)), _mm256_mul_ps(_mm256_load_ps(convex_hull->soa_z + i), dz));
+		__m256 greater = _mm256_cmp_ps(dots, max_dots, _CMP_GT_OQ);
+		max_dots = _mm256_blendv_ps(max_dots, dots, greater);
+		max_indices = _mm256_blendv_epi8(max_indices, indices, _mm256_castps_si256(greater));
+		indices = _mm256_add_epi32(indices, step);
+	}
+
+	alignas(32) r32 lane_dots[8];
+	alignas(32) u32 lane_indices[8];
+	_mm256_store_ps(lane_dots, max_dots);
+	_mm256_store_si256((__m256i*)lane_indices, max_indices);
+	return get_lanes_argmax(lane_dots, lane_indices, 8);
+}
+
+static boolean cpu_supports_avx2() {
+#if defined(_MSC_VER)
+	int info[4];
+	__cpuid(info, 0);
+	if (info[0] < 7) {
+		return false;
+	}
+	__cpuid(info, 1);
+	// The OS must also save the AVX registers on context switches
+	boolean has_avx = (info[2] & (1 << 27)) && (info[2] & (1 << 28)) && (_xgetbv(0) & 0x6) == 0x6;
+	__cpuidex(info, 7, 0);
+	return has_avx && (info[1] & (1 << 5));
+#else
+	return __builtin_cpu_supports("avx2");
+#endif
+}
+#endif
+
+static Support_Kernel select_kernel() {
+#if defined(SUPPORT_HAS_X86_KERNELS)
+	return cpu_supports_avx2() ? SUPPORT_KERNEL_AVX2 : SUPPORT_KERNEL_SSE;
+#else
+	return SUPPORT_KERNEL_SCALAR;
+#endif
+}
+
+// The best kernel available in this CPU, it is selected the first time it is needed
+Support_Kernel support_get_kernel() {
+	static const Support_Kernel kernel = select_kernel();
+	return kernel;
+}
+
+boolean support_is_kernel_available(Support_Kernel kernel) {
+	switch (kernel) {
+		case SUPPORT_KERNEL_SCALAR: return true;
+#if defined(SUPPORT_HAS_X86_KERNELS)
+		case SUPPORT_KERNEL_SSE: return true;
+		case SUPPORT_KERNEL_AVX2: return support_get_kernel() == SUPPORT_KERNEL_AVX2;
+#endif
+		default: return false;
+	}
+}
+
+const char* support_get_kernel_name(Support_Kernel kernel) {
+	switch (kernel) {
+		case SUPPORT_KERNEL_SCALAR: return "Scalar";
+		case SUPPORT_KERNEL_SSE: return "SSE";
+		case SUPPORT_KERNEL_AVX2: return "AVX2";
+		default: return "Unknown";
+	}
+}
+
+// Scans all vertices of the hull. The vectorized kernels use the single precision copy of the vertices, so when two
+// vertices are almost equally good they may pick a different one than the scalar kernel.
+static u32 support_point_get_index_scan(const Collider_Convex_Hull* convex_hull, vec3 direction, Support_Kernel kernel) {
+	switch (kernel) {
+#if defined(SUPPORT_HAS_X86_KERNELS)
+		case SUPPORT_KERNEL_SSE: return support_point_get_index_sse(convex_hull, direction);
+		case SUPPORT_KERNEL_AVX2: return support_point_get_index_avx2(convex_hull, direction);
+#endif
+		default: return support_point_get_index_linear(convex_hull, direction);
+	}
+}
+
+// Finds the best neighbor of 'index' that is better than 'best_dot'. Returns 'index' if there is none.
+// 'tie' is set if a neighbor is exactly as good as 'best_dot' was when it was checked.
+static u32 get_best_neighbor(const Collider_Convex_Hull* convex_hull, vec3 direction, u32 index, r64* best_dot, boolean* tie) {
+	u32 best_index = index;
+	*tie = false;
+	const u32* neighbors = convex_hull->vertex_to_neighbors[index];
+	for (u32 i = 0; i < array_length(neighbors); ++i) {
+		r64 dot = gm_vec3_dot(convex_hull->vertices[neighbors[i]], direction);
+		if (dot > *best_dot) {
+			best_index = neighbors[i];
+			*best_dot = dot;
+		} else if (dot == *best_dot) {
+			*tie = true;
+		}
+	}
+
+	return best_index;
+}
+
+// Greedy hill climbing over the vertex adjacency: moves to the best neighbor until no neighbor is better.
+// A linear function has no local maxima on a convex hull that aren't global, and a vertex whose neighbors are all
+// worse is the only support vertex, wherever the climb started. When a neighbor is as good as the final vertex, the
+// support vertices form an edge or a face and the one reached depends on the start, so false is returned instead.
+static boolean support_point_get_index_hill_climbing(const Collider_Convex_Hull* convex_hull, vec3 direction, u32 start_index,
+	u32* index) {
+	u32 current_index = start_index;
+	r64 current_dot = gm_vec3_dot(convex_hull->vertices[current_index], direction);
+
+	for (;;) {
+		r64 best_dot = current_dot;
+		boolean tie;
+		u32 best_index = get_best_neighbor(convex_hull, direction, current_index, &best_dot, &tie);
+
+		if (best_index == current_index) {
+			*index = current_index;
+			return !tie;
+		}
+
+		current_index = best_index;
+		current_dot = best_dot;
+	}
+}
+
+// 'direction' must be in the local space of the hull
+static u32 support_point_get_local_index(const Collider_Convex_Hull* convex_hull, vec3 direction) {
+	u32 num_vertices = array_length(convex_hull->vertices);
+	Support_Kernel kernel = support_get_kernel();
+	// With a single iteration, the wider reduction of the AVX2 kernel costs more than what it saves
+	if (kernel == SUPPORT_KERNEL_AVX2 && convex_hull->soa_length < SUPPORT_AVX2_MIN_VERTICES) {
+		kernel = SUPPORT_KERNEL_SSE;
+	}
+
+	// Hulls that are only approximately convex can have local maxima, where the climb would stop at a vertex that
+	// depends on the start
+	if (num_vertices < SUPPORT_HILL_CLIMBING_MIN_VERTICES || convex_hull->has_concave_edges) {
+		return support_point_get_index_scan(convex_hull, direction, kernel);
+	}
+
+	Support_Cache_Entry* cache_entry = &support_cache[((uintptr_t)convex_hull / sizeof(Collider)) % SUPPORT_CACHE_SIZE];
+	u32 start_index = (cache_entry->convex_hull == convex_hull && cache_entry->index < num_vertices) ? cache_entry->index : 0;
+	u32 selected_index;
+	if (!support_point_get_index_hill_climbing(convex_hull, direction, start_index, &selected_index)) {
+		selected_index = support_point_get_index_scan(convex_hull, direction, kernel);
+	}
+
+	cache_entry->convex_hull = convex_hull;
+	cache_entry->index = selected_index;
+	return selected_index;
+}
+
+// Rotates a world direction into the local space of the collider (the rotation is orthonormal, so its inverse is its transpose)
+static vec3 direction_to_local_space(const Collider* collider, vec3 direction) {
+	const mat3* r = &collider->world_rotation_matrix;
+	return (vec3) {
+		r->data[0][0] * direction.x + r->data[1][0] * direction.y + r->data[2][0] * direction.z,
+		r->data[0][1] * direction.x + r->data[1][1] * direction.y + r->data[2][1] * direction.z,
+		r->data[0][2] * direction.x + r->data[1][2] * direction.y + r->data[2][2] * direction.z
+	};
+}
+
+// Index of the support vertex of a convex hull collider, given a direction in world space
+u32 support_point_get_index(const Collider* collider, vec3 direction) {
+	assert(collider->type == COLLIDER_TYPE_CONVEX_HULL);
+	return support_point_get_local_index(&collider->convex_hull, direction_to_local_space(collider, direction));
+}
+
+// Same as 'support_point_get_index', but always scanning all vertices with the given kernel (useful for benchmarks)
+u32 support_point_get_index_by_scan(const Collider* collider, vec3 direction, Support_Kernel kernel) {
+	assert(collider->type == COLLIDER_TYPE_CONVEX_HULL);
+	assert(support_is_kernel_available(kernel));
+	return support_point_get_index_scan(&collider->convex_hull, direction_to_local_space(collider, direction), kernel);
+}
+
 vec3 support_point(Collider* collider, vec3 direction) {
 	switch (collider->type) {
 		case COLLIDER_TYPE_CONVEX_HULL: {
-			u32 selected_index = support_point_get_index(&collider->convex_hull, direction);
-			return collider->convex_hull.transformed_vertices[selected_index];
+			u32 selected_index = support_point_get_index(collider, direction);
+			return collider_convex_hull_get_world_vertex(collider, selected_index);
 		} break;
 		case COLLIDER_TYPE_SPHERE: {
 			return gm_vec3_add(collider->sphere.center, gm_vec3_scalar_product(collider->sphere.radius, gm_vec3_normalize(direction)));
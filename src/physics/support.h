@@ -2,7 +2,19 @@
 #define RAW_PHYSICS_PHYSICS_SUPPORT_H
 #include "collider.h"
 
-u32 support_point_get_index(Collider_Convex_Hull* convex_hull, vec3 direction);
+typedef enum {
+	SUPPORT_KERNEL_SCALAR,
+	SUPPORT_KERNEL_SSE,
+	SUPPORT_KERNEL_AVX2,
+	SUPPORT_KERNEL_END
+} Support_Kernel;
+
+Support_Kernel support_get_kernel();
+boolean support_is_kernel_available(Support_Kernel kernel);
+const char* support_get_kernel_name(Support_Kernel kernel);
+u32 support_point_get_index_by_scan(const Collider* collider, vec3 direction, Support_Kernel kernel);
+
+u32 support_point_get_index(const Collider* collider, vec3 direction);
 vec3 support_point(Collider* collider, vec3 direction);
 vec3 support_point_of_minkowski_difference(Collider* collider1, Collider* collider2, vec3 direction);
 
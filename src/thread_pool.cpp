@@ -0,0 +1,185 @@
+#include "thread_pool.h"
+#include <light_array.h>
+#include <assert.h>
+#include <stdlib.h>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+
+// A small work-stealing thread pool. Each call to 'thread_pool_run' is a batch: the tasks are dealt round-robin to
+// per-worker queues, every worker drains its own queue from the head and, when it runs out of work, steals from the
+// tail of the other queues. The calling thread takes part in the batch as worker 0 and only returns when every worker
+// has finished it, so nothing from a batch is left running when the next one starts.
+
+typedef struct {
+	std::mutex mutex;
+	u32* tasks;
+	u32 head;
+} Thread_Pool_Queue;
+
+typedef struct {
+	boolean initialized;
+	u32 num_threads;
+	std::thread threads[THREAD_POOL_MAX_THREADS];
+	Thread_Pool_Queue queues[THREAD_POOL_MAX_THREADS];
+
+	std::mutex mutex;
+	std::condition_variable batch_started;
+	std::condition_variable batch_finished;
+	u64 batch;
+	u32 num_finished_workers;
+	boolean quit;
+
+	Thread_Pool_Task_Func func;
+	void* ctx;
+} Thread_Pool;
+
+static Thread_Pool thread_pool;
+static thread_local u32 current_worker = 0;
+
+static boolean pop_task(u32 worker, u32* task) {
+	Thread_Pool_Queue* queue = &thread_pool.queues[worker];
+	std::lock_guard<std::mutex> lock(queue->mutex);
+	if (queue->head < array_length(queue->tasks)) {
+		*task = queue->tasks[queue->head++];
+		return true;
+	}
+	return false;
+}
+
+static boolean steal_task(u32 thief, u32* task) {
+	for (u32 i = 1; i < thread_pool.num_threads; ++i) {
+		Thread_Pool_Queue* queue = &thread_pool.queues[(thief + i) % thread_pool.num_threads];
+		std::lock_guard<std::mutex> lock(queue->mutex);
+		if (queue->head < array_length(queue->tasks)) {
+			*task = queue->tasks[--array_length(queue->tasks)];
+			return true;
+		}
+	}
+	return false;
+}
+
+static void run_batch(u32 worker) {
+	u32 task;
+	while (pop_task(worker, &task) || steal_task(worker, &task)) {
+		thread_pool.func(task, worker, thread_pool.ctx);
+	}
+}
+
+static void worker_main(u32 worker) {
+	current_worker = worker;
+	u64 last_batch = 0;
+	for (;;) {
+		{
+			std::unique_lock<std::mutex> lock(thread_pool.mutex);
+			thread_pool.batch_started.wait(lock, [&] { return thread_pool.quit || thread_pool.batch != last_batch; });
+			if (thread_pool.quit) {
+				return;
+			}
+			last_batch = thread_pool.batch;
+		}
+
+		run_batch(worker);
+
+		{
+			std::lock_guard<std::mutex> lock(thread_pool.mutex);
+			++thread_pool.num_finished_workers;
+		}
+		thread_pool.batch_finished.notify_one();
+	}
+}
+
+// Creates 'num_threads' workers (the calling thread counts as one of them). If 'num_threads' is 0, one worker per
+// hardware thread is created. Can be called again to change the number of threads.
+void thread_pool_init(u32 num_threads) {
+	static boolean registered_exit_handler = false;
+	if (!registered_exit_handler) {
+		// Workers must be joined before the static state of the pool is destroyed
+		atexit(thread_pool_destroy);
+		registered_exit_handler = true;
+	}
+
+	if (thread_pool.initialized) {
+		thread_pool_destroy();
+	}
+
+	if (num_threads == 0) {
+		num_threads = MAX(std::thread::hardware_concurrency(), 1u);
+	}
+	num_threads = MIN(num_threads, THREAD_POOL_MAX_THREADS);
+
+	thread_pool.num_threads = num_threads;
+	thread_pool.batch = 0;
+	thread_pool.quit = false;
+	for (u32 i = 0; i < num_threads; ++i) {
+		thread_pool.queues[i].tasks = array_new_len(u32, 64);
+		thread_pool.queues[i].head = 0;
+	}
+	for (u32 i = 1; i < num_threads; ++i) {
+		thread_pool.threads[i] = std::thread(worker_main, i);
+	}
+	thread_pool.initialized = true;
+}
+
+void thread_pool_destroy() {
+	if (!thread_pool.initialized) {
+		return;
+	}
+
+	{
+		std::lock_guard<std::mutex> lock(thread_pool.mutex);
+		thread_pool.quit = true;
+	}
+	thread_pool.batch_started.notify_all();
+
+	for (u32 i = 1; i < thread_pool.num_threads; ++i) {
+		thread_pool.threads[i].join();
+	}
+	for (u32 i = 0; i < thread_pool.num_threads; ++i) {
+		array_free(thread_pool.queues[i].tasks);
+	}
+	thread_pool.initialized = false;
+}
+
+u32 thread_pool_get_num_threads() {
+	return thread_pool.initialized ? thread_pool.num_threads : 1;
+}
+
+// Threads that were not created by the pool, like the one that calls 'thread_pool_run', are worker 0
+u32 thread_pool_get_current_worker() {
+	return current_worker;
+}
+
+// Runs 'func' for every task and waits until all of them are finished. Tasks are started roughly in the given order,
+// so the most expensive ones should come first. Tasks of the same batch must not depend on each other.
+void thread_pool_run(const u32* tasks, u32 num_tasks, Thread_Pool_Task_Func func, void* ctx) {
+	if (!thread_pool.initialized || thread_pool.num_threads == 1 || num_tasks <= 1) {
+		for (u32 i = 0; i < num_tasks; ++i) {
+			func(tasks[i], 0, ctx);
+		}
+		return;
+	}
+
+	// No worker is running at this point, so the queues can be filled without locking
+	for (u32 i = 0; i < thread_pool.num_threads; ++i) {
+		array_clear(thread_pool.queues[i].tasks);
+		thread_pool.queues[i].head = 0;
+	}
+	for (u32 i = 0; i < num_tasks; ++i) {
+		array_push(thread_pool.queues[i % thread_pool.num_threads].tasks, tasks[i]);
+	}
+
+	{
+		std::lock_guard<std::mutex> lock(thread_pool.mutex);
+		thread_pool.func = func;
+		thread_pool.ctx = ctx;
+		thread_pool.num_finished_workers = 0;
+		++thread_pool.batch;
+	}
+	thread_pool.batch_started.notify_all();
+
+	run_batch(0);
+
+	std::unique_lock<std::mutex> lock(thread_pool.mutex);
+	thread_pool.batch_finished.wait(lock, [] { return thread_pool.num_finished_workers == thread_pool.num_threads - 1; });
+}
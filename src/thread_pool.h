@@ -0,0 +1,16 @@
+#ifndef RAW_PHYSICS_THREAD_POOL_H
+#define RAW_PHYSICS_THREAD_POOL_H
+#include <common.h>
+
+#define THREAD_POOL_MAX_THREADS 64
+
+// 'worker' is in the range [0, thread_pool_get_num_threads()), and can be used to index per-thread scratch memory
+typedef void (*Thread_Pool_Task_Func)(u32 task, u32 worker, void* ctx);
+
+void thread_pool_init(u32 num_threads);
+void thread_pool_destroy();
+u32 thread_pool_get_num_threads();
+u32 thread_pool_get_current_worker();
+void thread_pool_run(const u32* tasks, u32 num_tasks, Thread_Pool_Task_Func func, void* ctx);
+
+#endif
@@ -5,6 +5,7 @@
 #include <string.h>
 #include "entity.h"
 #include <limits.h>
+#include <chrono>
 
 r64 util_random_float(r64 min, r64 max) {
 	r64 scale = rand() / (r64)RAND_MAX;
@@ -123,6 +124,12 @@ vec4 util_pallete(u32 n) {
 	return color_palette[idx];
 }
 
+// Returns a monotonic time, in seconds. Only useful to measure elapsed times.
+r64 util_get_time() {
+	auto now = std::chrono::steady_clock::now().time_since_epoch();
+	return std::chrono::duration<r64>(now).count();
+}
+
 // Hash Utils
 
 int util_eid_compare(const void *key1, const void *key2) {
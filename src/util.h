@@ -10,6 +10,7 @@ r64 util_random_float(r64 min, r64 max);
 mat4 util_get_model_matrix_no_scale(const Quaternion* rotation, vec3 translation);
 void util_matrix_to_r32_array(const mat4* m, r32 out[16]);
 vec4 util_pallete(u32 n);
+r64 util_get_time();
 
 // hash utils
 int util_eid_compare(const void *key1, const void *key2);